@@ -0,0 +1,84 @@
+# Turns ROM and font files into constexpr arrays so they can be started
+# without touching the filesystem, see libchip8++_embedded.hpp in the build
+# directory after configuring with CHIP8_EMBED_ROMS or CHIP8_EMBED_FONTS set.
+
+# makes a C++ identifier out of a file name, "15 Puzzle.ch8" -> _15_Puzzle_ch8
+function(chip8_identifier out path)
+    get_filename_component(name "${path}" NAME)
+    string(MAKE_C_IDENTIFIER "${name}" name)
+    set(${out} "${name}" PARENT_SCOPE)
+endfunction()
+
+# reads a file into a comma separated list of hex bytes
+function(chip8_hex_bytes out path)
+    file(READ "${path}" hex HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " hex "${hex}")
+    set(${out} "${hex}" PARENT_SCOPE)
+endfunction()
+
+function(chip8_embed output)
+    cmake_parse_arguments(EMBED "" "" "ROMS;FONTS" ${ARGN})
+
+    set(body "")
+    set(table "")
+    set(count 0)
+
+    foreach(font IN LISTS EMBED_FONTS)
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${font}")
+        chip8_identifier(name "${font}")
+        chip8_hex_bytes(bytes "${font}")
+        file(SIZE "${font}" size)
+        string(APPEND body
+            "inline constexpr std::array<uint8_t, ${size}> ${name}{ ${bytes}};\n\n")
+    endforeach()
+
+    foreach(rom IN LISTS EMBED_ROMS)
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${rom}")
+        chip8_identifier(name "${rom}")
+        chip8_hex_bytes(bytes "${rom}")
+        file(SIZE "${rom}" size)
+        get_filename_component(file "${rom}" NAME)
+        string(APPEND body
+            "inline constexpr std::array<uint8_t, ${size}> ${name}_rom{ ${bytes}};\n"
+            "inline constexpr BootImage ${name} =\n"
+            "  MakeBootImage(${name}_rom, FONT, BIGFONT);\n\n")
+        string(APPEND table "    EmbeddedRom{ \"${file}\", &${name} },\n")
+        math(EXPR count "${count} + 1")
+    endforeach()
+
+    file(CONFIGURE OUTPUT "${output}" CONTENT
+"/* Generated by cmake/Chip8Embed.cmake, do not edit. */
+#ifndef BASED_CHIP8_EMBEDDED
+#define BASED_CHIP8_EMBEDDED
+
+#include \"libchip8++.hpp\"
+
+namespace Chip8_core {
+
+/**
+ * ROMs and fonts embedded at build time. Every ROM is available both as raw
+ * bytes, NAME_rom, and as a ready to copy boot image, NAME, with FONT and
+ * BIGFONT loaded.
+ */
+namespace Embedded {
+
+/**
+ * A ROM embedded at build time, looked up by its file name.
+ */
+struct EmbeddedRom {
+    const char* name;       /**< The file name the ROM was embedded from. */
+    const BootImage* image; /**< The boot image holding the ROM. */
+};
+
+@body@/**
+ * Every embedded ROM, in the order given to CHIP8_EMBED_ROMS.
+ */
+inline constexpr std::array<EmbeddedRom, @count@> ROMS{
+@table@};
+
+} // namespace Embedded
+} // namespace Chip8_core
+
+#endif
+" @ONLY)
+endfunction()
@@ -19,11 +19,13 @@
 
 #include <algorithm>
 #include <array>
-#include <bitset>
+#include <bit>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <random>
+#include <span>
+#include <type_traits>
 
 /**
  * The main namsepace under which the whole implementation
@@ -48,6 +50,9 @@ enum Constants {
     PROGRAM_LD_ADDR = 0x200, /**< The address at which Chip8 ROMs are loaded. */
     INIT_STACK_TOP = -1,     /**< The default value for stack top. */
     KEYCOUNT = 16,           /**< The number of keys present in Chip8. */
+    PAGESIZE = 64, /**< Granularity at which memory writes are tracked. */
+    FONT_ADDR = 0x0,     /**< The address at which the font is loaded. */
+    BIGFONT_ADDR = 0x50, /**< The address at which the SCHIP font is loaded. */
     ROM_MAX_SIZE =
       3215 /**< Maximum number of bytes allowed to be loaded in memory */
 };
@@ -95,6 +100,133 @@ enum Key {
     DOWN /**< The key is pressed. */
 };
 
+/**
+ * The initial contents of Chip8 memory an instance is reset to, usually the
+ * font followed by a ROM at Constants::PROGRAM_LD_ADDR.
+ */
+using BootImage = std::array<uint8_t, Constants::MEMSIZE>;
+
+// clang-format off
+
+/**
+ * The default Chip8 font, 16 hexadecimal digits of 4x5 pixels each.
+ */
+inline constexpr std::array<uint8_t, 80> FONT{
+    0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70,
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0, 0x10, 0xF0, 0x10, 0xF0,
+    0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0,
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40,
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0, 0x10, 0xF0,
+    0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0,
+    0xF0, 0x80, 0x80, 0x80, 0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0,
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80
+};
+
+/**
+ * The SCHIP big font, 10 decimal digits of 8x10 pixels each.
+ */
+inline constexpr std::array<uint8_t, 100> BIGFONT{
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,
+    0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C
+};
+// clang-format on
+
+/**
+ * Builds a boot image at compile time or at runtime.
+ * The font is placed at Constants::FONT_ADDR, the optional big font at
+ * Constants::BIGFONT_ADDR and the ROM at Constants::PROGRAM_LD_ADDR.
+ * @param rom the ROM bytes, must be smaller than Constants::ROM_MAX_SIZE
+ * @param font the font to use, 80 bytes for the usual 16 digits
+ * @param bigfont the SCHIP font to use, pass BIGFONT or leave empty
+ * @return the memory contents of a freshly loaded Chip8
+ */
+constexpr BootImage
+MakeBootImage(std::span<const uint8_t> rom,
+              std::span<const uint8_t> font = FONT,
+              std::span<const uint8_t> bigfont = {})
+{
+    if (rom.size() >= Constants::ROM_MAX_SIZE ||
+        font.size() > Constants::BIGFONT_ADDR - Constants::FONT_ADDR ||
+        bigfont.size() > Constants::PROGRAM_LD_ADDR - Constants::BIGFONT_ADDR) {
+        fprintf(stderr,
+                "MakeBootImage(): rom of %zu bytes, font of %zu bytes or big "
+                "font of %zu bytes does not fit in memory\n",
+                rom.size(),
+                font.size(),
+                bigfont.size());
+        std::exit(1);
+    }
+
+    BootImage image{};
+    std::copy(font.begin(), font.end(), image.begin() + Constants::FONT_ADDR);
+    std::copy(
+      bigfont.begin(), bigfont.end(), image.begin() + Constants::BIGFONT_ADDR);
+    std::copy(
+      rom.begin(), rom.end(), image.begin() + Constants::PROGRAM_LD_ADDR);
+    return image;
+}
+
+/**
+ * The boot image holding only the default font, what a system is constructed
+ * with when no image is given.
+ */
+inline constexpr BootImage DEFAULT_IMAGE = MakeBootImage({});
+
+/**
+ * Hashes a boot image, FNV-1a over the memory contents taken 8 bytes at a
+ * time with a final avalanche. Used to key caches by ROM, it reads all of
+ * memory so hash an image once and keep the result around in hot loops.
+ * @param image the boot image to hash
+ * @return the 64-bit hash
+ */
+constexpr uint64_t
+HashImage(const BootImage& image)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < image.size(); i += 8) {
+        uint64_t word = 0;
+        for (size_t b = 0; b < 8; b++)
+            word |= uint64_t{ image[i + b] } << (b * 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    return hash ^ (hash >> 33);
+}
+
+/**
+ * A 128-bit hash of a machine state.
+ * @see system::Hash()
+ */
+struct Hash128 {
+    uint64_t lo; /**< The lower 64 bits. */
+    uint64_t hi; /**< The upper 64 bits. */
+
+    constexpr bool operator==(const Hash128&) const = default;
+
+    constexpr Hash128& operator^=(const Hash128& other)
+    {
+        lo ^= other.lo;
+        hi ^= other.hi;
+        return *this;
+    }
+};
+
+/**
+ * Bumped whenever the fields of system change, even if sizeof(system) stays
+ * the same. Files holding systems as laid out in memory refuse other
+ * layouts.
+ */
+inline constexpr uint32_t SYSTEM_LAYOUT_VERSION = 2;
+
 /**
  * Represents the entire Chip8 internal state.
  * It provides access to private data through pairs of Getters and Setters.
@@ -105,45 +237,120 @@ enum Key {
  */
 class system {
   private:
-    std::default_random_engine engine;
-    std::uniform_int_distribution<int> distb;
     std::array<uint8_t, Constants::MEMSIZE> memory;
     std::array<uint32_t, Constants::DISPW * Constants::DISPH> display;
     std::array<uint16_t, Constants::STACKSIZE> stack;
     std::array<uint8_t, Constants::REGCNT> registers;
-    std::bitset<Constants::KEYCOUNT> keys;
+    uint16_t keys; /* one bit per key, set while the key is down */
     uint16_t index_reg;
     uint16_t program_counter;
     uint8_t delay_timer;
     uint8_t sound_timer;
     int8_t stacktop;
     bool halt;
+    /* keypad reads (EX9E, EXA1, FX0A) since the last ClearInputPolls(),
+     * saturating. Bookkeeping like the dirty masks, not part of Hash() */
+    uint16_t input_polls;
+    /* the padding the compiler would leave, spelled out and zeroed so equal
+     * states are equal byte for byte, copied, compared or saved to files */
+    uint32_t pad0;
+    /* one bit per Constants::PAGESIZE bytes of memory written since the
+     * last reset, and one bit per display row drawn to */
+    uint64_t dirty_pages;
+    uint32_t dirty_rows;
+    /* state of the std::minstd_rand0 engine InternalRand() draws from */
+    uint32_t rng;
+    /* XOR of HashCell() over every memory byte and display pixel, kept up to
+     * date on every write while hash_valid is set, see Hash() */
+    Hash128 cells_hash;
+    bool hash_valid;
+    uint8_t pad1[3];
+
+    /* Zobrist style key of a cell holding a value, zero for zero so
+     * untouched cells cost nothing. Memory bytes come first, then pixels,
+     * then the packed registers Hash() feeds in. */
+    static constexpr Hash128 HashCell(uint32_t cell, uint64_t v)
+    {
+        if (v == 0) return {};
+        uint64_t x = v + cell * 0x9E3779B97F4A7C15ULL;
+        unsigned __int128 a =
+          static_cast<unsigned __int128>(x ^ 0x9E3779B97F4A7C15ULL) *
+          0xD6E8FEB86659FD93ULL;
+        unsigned __int128 b =
+          static_cast<unsigned __int128>(x ^ 0xC2B2AE3D27D4EB4FULL) *
+          0x9FB21C651E98DF25ULL;
+        return { static_cast<uint64_t>(a) ^ static_cast<uint64_t>(a >> 64),
+                 static_cast<uint64_t>(b) ^ static_cast<uint64_t>(b >> 64) };
+    }
+
+    /* accounts for a cell changing from old to v, kept out of line so
+     * machines nobody hashes only pay for the hash_valid test */
+    [[gnu::noinline]] constexpr void Rehash(uint32_t cell,
+                                            uint32_t old,
+                                            uint32_t v)
+    {
+        cells_hash ^= HashCell(cell, old);
+        cells_hash ^= HashCell(cell, v);
+    }
+
+    /* accounts for the pages in the mask being restored from image */
+    [[gnu::noinline]] constexpr void RehashPages(uint64_t pages,
+                                                 const BootImage& image)
+    {
+        for (; pages != 0; pages &= pages - 1) {
+            unsigned off = std::countr_zero(pages) * Constants::PAGESIZE;
+            for (unsigned i = off; i < off + Constants::PAGESIZE; i++) {
+                cells_hash ^= HashCell(i, memory[i]);
+                cells_hash ^= HashCell(i, image[i]);
+            }
+        }
+    }
+
+    /* accounts for the display rows in the mask being cleared */
+    [[gnu::noinline]] constexpr void UnhashRows(uint32_t rows)
+    {
+        for (; rows != 0; rows &= rows - 1) {
+            unsigned off = std::countr_zero(rows) * Constants::DISPW;
+            for (unsigned i = off; i < off + Constants::DISPW; i++)
+                cells_hash ^= HashCell(Constants::MEMSIZE + i, display[i]);
+        }
+    }
+
+    /* advances rng, std::minstd_rand0::operator() */
+    constexpr uint32_t NextRandom()
+    {
+        rng = static_cast<uint32_t>(uint64_t{ rng } * 16807 % 2147483647);
+        return rng;
+    }
+
+    static_assert(Constants::MEMSIZE / Constants::PAGESIZE == 64);
+    static_assert(Constants::DISPH == 32);
 
   public:
     uint32_t display_fg; /**< Foreground color */
     uint32_t display_bg; /**< Background color */
+
+  private:
+    uint32_t pad2;
+
+  public:
     /**
      * Constructs the Chip8 class.
-     * This constructor loads the font into memory at address 0x0, sets the
+     * This constructor copies the boot image into memory, sets the
      * program_counter to 0x200 which is the program load address, sets the
-     * stack top, initialises random number generation engine with device
-     * argument, sets the distribution between 0 and 255 (inclusive) and zero
-     * initialises the rest.
-     * @param device reference to a std::random_device for generating random
-     * numbers.
+     * stack top, seeds the random number generation engine, a
+     * std::minstd_rand0 kept in the system itself, with the seed argument
+     * and zero initialises the rest. No file is touched, so this is all it
+     * takes to start an embedded ROM.
+     * @param image the memory contents to start with, see MakeBootImage()
+     * @param seed the value to seed the random number generation engine with.
      * @see Constants
      */
-    system(std::random_device&& device,
-           uint32_t foreground = 0xffffffff,
-           uint32_t background = 0x0)
-      : memory{ 0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70,
-                0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0, 0x10, 0xF0, 0x10, 0xF0,
-                0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0,
-                0xF0, 0x80, 0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40,
-                0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0, 0x10, 0xF0,
-                0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0,
-                0xF0, 0x80, 0x80, 0x80, 0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0,
-                0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80 }
+    constexpr system(const BootImage& image,
+                     uint32_t seed,
+                     uint32_t foreground = 0xffffffff,
+                     uint32_t background = 0x0)
+      : memory{ image }
       , display{ 0 }
       , stack{ 0 }
       , registers{ 0 }
@@ -153,10 +360,46 @@ class system {
       , delay_timer{ 0 }
       , sound_timer{ 0 }
       , stacktop{ Constants::INIT_STACK_TOP }
-      , engine{ device() }
-      , distb{ 0, 255 }
+      , halt{ false }
+      , input_polls{ 0 }
+      , pad0{ 0 }
+      , dirty_pages{ 0 }
+      , dirty_rows{ 0 }
+      , rng{ 0 }
+      , cells_hash{}
+      , hash_valid{ false }
+      , pad1{}
       , display_fg{ foreground }
       , display_bg{ background }
+      , pad2{ 0 }
+    {
+        Seed(seed);
+    }
+
+    /**
+     * Constructs the Chip8 class with only the default font loaded into
+     * memory at address 0x0.
+     * @param seed the value to seed the random number generation engine with.
+     * @see system(const BootImage&, uint32_t, uint32_t, uint32_t)
+     */
+    constexpr system(uint32_t seed,
+                     uint32_t foreground = 0xffffffff,
+                     uint32_t background = 0x0)
+      : system(DEFAULT_IMAGE, seed, foreground, background)
+    {
+    }
+
+    /**
+     * Constructs the Chip8 class, seeding the random number generation engine
+     * from a std::random_device.
+     * @param device reference to a std::random_device for generating random
+     * numbers.
+     * @see system(uint32_t, uint32_t, uint32_t)
+     */
+    system(std::random_device&& device,
+           uint32_t foreground = 0xffffffff,
+           uint32_t background = 0x0)
+      : system(device(), foreground, background)
     {
     }
 
@@ -198,6 +441,7 @@ class system {
                     Constants::ROM_MAX_SIZE);
             std::exit(1);
         }
+        hash_valid = false;
         rs.read(reinterpret_cast<char*>(&memory[Constants::PROGRAM_LD_ADDR]),
                 size);
         if (rs.gcount() != size) {
@@ -217,30 +461,83 @@ class system {
      * by 2.
      * @return 16-bit opcode containing a full chip8 instruction
      */
-    uint16_t Fetch()
+    constexpr uint16_t Fetch()
     {
-        uint16_t opcode =
-          (memory[program_counter] << 8) | memory[program_counter + 1];
+        uint16_t opcode = Peek();
         program_counter += 2;
         return opcode;
     }
 
+    /**
+     * Returns the opcode the next Fetch() will return without incrementing
+     * the program_counter.
+     * @return 16-bit opcode containing a full chip8 instruction
+     */
+    constexpr uint16_t Peek()
+    {
+        return (memory[program_counter & (Constants::MEMSIZE - 1)] << 8) |
+               memory[(program_counter + 1) & (Constants::MEMSIZE - 1)];
+    }
+
     /**
      * Returns a reference to private data member memory.
+     * Writes made through this reference are not tracked, follow them up with
+     * MarkMemory() or reset() will not undo them.
      * @return reference to chip8 memory
      */
-    std::array<uint8_t, Constants::MEMSIZE>& RefMemory()
+    constexpr std::array<uint8_t, Constants::MEMSIZE>& RefMemory()
     {
         return memory;
     }
 
+    /**
+     * Returns the byte stored at a memory address.
+     * @param addr the address, wraps around at Constants::MEMSIZE
+     */
+    constexpr uint8_t GetMemory(uint16_t addr)
+    {
+        return memory[addr & (Constants::MEMSIZE - 1)];
+    }
+
+    /**
+     * Stores a byte at a memory address.
+     * @param addr the address, wraps around at Constants::MEMSIZE
+     * @param v the value to store
+     */
+    constexpr void SetMemory(uint16_t addr, uint8_t v)
+    {
+        addr &= Constants::MEMSIZE - 1;
+        if (hash_valid) [[unlikely]] Rehash(addr, memory[addr], v);
+        memory[addr] = v;
+        dirty_pages |= uint64_t{ 1 } << (addr / Constants::PAGESIZE);
+    }
+
+    /**
+     * Records that a range of memory was written to through RefMemory().
+     * The state hash is recomputed on the next Hash() call.
+     * @param addr the first address written
+     * @param len the number of bytes written
+     */
+    constexpr void MarkMemory(uint16_t addr, uint16_t len)
+    {
+        if (len == 0) return;
+        hash_valid = false;
+        unsigned first = (addr & (Constants::MEMSIZE - 1)) /
+                         Constants::PAGESIZE;
+        unsigned last =
+          std::min<unsigned>(addr + len - 1, Constants::MEMSIZE - 1) /
+          Constants::PAGESIZE;
+        for (unsigned p = first; p <= last; p++)
+            dirty_pages |= uint64_t{ 1 } << p;
+    }
+
     /**
      * Sets a register to some value.
      * @param r the register to modify, like SetRegister(0xA, 0x288) or
      * SetRegister(Registers::RA, 0x288)
      * @param v the value to set the register to.
      */
-    void SetRegister(Registers r, uint8_t v)
+    constexpr void SetRegister(Registers r, uint8_t v)
     {
         registers[r] = v;
     }
@@ -250,7 +547,7 @@ class system {
      * @param r the register to get the value of, like GetRegitser(0xA) or
      * GetRegister(Registers::RA)
      */
-    uint8_t GetRegister(Registers r)
+    constexpr uint8_t GetRegister(Registers r)
     {
         return registers[r];
     }
@@ -259,7 +556,7 @@ class system {
      * Returns a reference to private data member registers.
      * @return reference to chip8 register array
      */
-    std::array<uint8_t, Constants::REGCNT>& RefRegisterArray()
+    constexpr std::array<uint8_t, Constants::REGCNT>& RefRegisterArray()
     {
         return registers;
     }
@@ -268,7 +565,7 @@ class system {
      * Set the value of the index register.
      * @param v the value to set
      */
-    void SetIndexRegister(uint16_t v)
+    constexpr void SetIndexRegister(uint16_t v)
     {
         index_reg = v;
     }
@@ -277,7 +574,7 @@ class system {
      * Returns the value stored in index register.
      * @return 16-bit value. Probably an address
      */
-    uint16_t GetIndexRegister()
+    constexpr uint16_t GetIndexRegister()
     {
         return index_reg;
     }
@@ -287,26 +584,27 @@ class system {
      * @param k KeyCode representing the key to set
      * @param v A value containing either Key::UP or Key::DOWN
      */
-    void SetKey(KeyCode k, uint8_t v)
+    constexpr void SetKey(KeyCode k, uint8_t v)
     {
-        keys[k] = v;
+        keys = (keys & ~(1u << k)) | ((v ? 1u : 0u) << k);
     }
 
     /**
      * Returns the value to which a key is set.
-     * @param k KeyCode representing the key
+     * @param k KeyCode representing the key, only the low nibble is used as
+     * EX9E and EXA1 may pass any register value
      * @return either Key::UP or Key::DOWN
      */
-    uint8_t GetKey(KeyCode k)
+    constexpr uint8_t GetKey(KeyCode k)
     {
-        return keys[k];
+        return (keys >> (k & 0xF)) & 1;
     }
 
     /**
      * Push an address to the stack. Also increment the stacktop
      * @param v the address to push
      */
-    void Push(uint16_t v)
+    constexpr void Push(uint16_t v)
     {
         stack[++stacktop] = v;
     }
@@ -316,16 +614,43 @@ class system {
      * the stacktop
      * @return A 16-bit value containig the address from top
      */
-    uint16_t Pop()
+    constexpr uint16_t Pop()
     {
         return stack[stacktop--];
     }
 
+    /**
+     * Returns a reference to private data member stack.
+     * @return reference to chip8 stack
+     */
+    constexpr std::array<uint16_t, Constants::STACKSIZE>& RefStack()
+    {
+        return stack;
+    }
+
+    /**
+     * Returns the index of the top of the stack, Constants::INIT_STACK_TOP
+     * when the stack is empty.
+     */
+    constexpr int8_t GetStackTop()
+    {
+        return stacktop;
+    }
+
+    /**
+     * Set the index of the top of the stack.
+     * @param v the index to set
+     */
+    constexpr void SetStackTop(int8_t v)
+    {
+        stacktop = v;
+    }
+
     /**
      * Set the program_counter to some address.
      * @param v the address to set
      */
-    void SetPC(uint16_t v)
+    constexpr void SetPC(uint16_t v)
     {
         program_counter = v;
     }
@@ -334,7 +659,7 @@ class system {
      * Returns the current value of program_counter.
      * @return A 16-bit address
      */
-    uint16_t GetPC()
+    constexpr uint16_t GetPC()
     {
         return program_counter;
     }
@@ -342,7 +667,7 @@ class system {
     /**
      * Increment the program_counter by 1.
      */
-    void IncPC()
+    constexpr void IncPC()
     {
         program_counter++;
     }
@@ -350,7 +675,7 @@ class system {
     /**
      * Decrement the program_counter by 1.
      */
-    void DecPC()
+    constexpr void DecPC()
     {
         program_counter--;
     }
@@ -359,7 +684,7 @@ class system {
      * Set the delay_timer to some value.
      * @param v the value to set
      */
-    void SetDT(uint8_t v)
+    constexpr void SetDT(uint8_t v)
     {
         delay_timer = v;
     }
@@ -368,7 +693,7 @@ class system {
      * Get the current value of delay_timer.
      * @return value of the delay timer
      */
-    uint8_t GetDT()
+    constexpr uint8_t GetDT()
     {
         return delay_timer;
     }
@@ -376,7 +701,7 @@ class system {
     /**
      * Increment the delay timer by 1
      */
-    void IncDT()
+    constexpr void IncDT()
     {
         delay_timer++;
     }
@@ -384,7 +709,7 @@ class system {
     /**
      * Decrement the delay timer by 1
      */
-    void DecDT()
+    constexpr void DecDT()
     {
         delay_timer--;
     }
@@ -393,7 +718,7 @@ class system {
      * Set the sound_timer to some value.
      * @param v the value to set
      */
-    void SetST(uint8_t v)
+    constexpr void SetST(uint8_t v)
     {
         sound_timer = v;
     }
@@ -402,7 +727,7 @@ class system {
      * Get the current value of sound_timer.
      * @return value of the sound timer
      */
-    uint8_t GetST()
+    constexpr uint8_t GetST()
     {
         return sound_timer;
     }
@@ -410,7 +735,7 @@ class system {
     /**
      * Increment the sound timer by 1
      */
-    void IncST()
+    constexpr void IncST()
     {
         sound_timer++;
     }
@@ -418,7 +743,7 @@ class system {
     /**
      * Decrement the sound timer by 1
      */
-    void DecST()
+    constexpr void DecST()
     {
         sound_timer--;
     }
@@ -429,9 +754,11 @@ class system {
      * (row * 64))
      * @param v the RGBA value to set pixel to
      */
-    void SetPixel(uint16_t idx, uint32_t v)
+    constexpr void SetPixel(uint16_t idx, uint32_t v)
     {
+        if (hash_valid) [[unlikely]] Rehash(Constants::MEMSIZE + idx, display[idx], v);
         display[idx] = v;
+        dirty_rows |= uint32_t{ 1 } << (idx / Constants::DISPW);
     }
 
     /**
@@ -440,24 +767,34 @@ class system {
      * (row * 64))
      * @return the RGBA value of pixel at idx
      */
-    uint32_t GetPixel(uint16_t idx)
+    constexpr uint32_t GetPixel(uint16_t idx)
     {
         return display[idx];
     }
 
+    /**
+     * Tells whether a pixel is set, that is drawn and not erased since.
+     * Erased pixels hold display_bg, cleared ones hold 0.
+     * @param idx the index at which the pixel resides
+     */
+    constexpr bool IsLit(uint16_t idx)
+    {
+        return display[idx] != 0 && display[idx] != display_bg;
+    }
+
     /**
      * Subscript operator overload allowing access to memory array of Chip8
-     * class.
+     * class. Like RefMemory(), writes through it are not tracked.
      */
-    uint8_t& operator[](long i)
+    constexpr uint8_t& operator[](long i)
     {
-        if (i > 0) {
+        if (i < 0) {
             fprintf(stderr,
                     "Negative argument to subscript operator for class "
                     "Chip8_core::system");
             std::exit(1);
         }
-        if (i < (Constants::MEMSIZE + 1)) {
+        if (i >= Constants::MEMSIZE) {
             fprintf(stderr,
                     "Too large of an argument to subscript operator for class "
                     "Chip8_core::system. Argument should be in range [%d,%d)\n",
@@ -470,28 +807,174 @@ class system {
     }
 
     /**
-     * Reset the entire display i.e set all pixels to 0 (UNSET)
+     * Reset the entire display i.e set all pixels to 0 (UNSET).
+     * Only the rows drawn to since the last reset are touched.
+     */
+    constexpr void reset_display()
+    {
+        if (hash_valid) [[unlikely]]
+            UnhashRows(dirty_rows);
+        for (uint32_t rows = dirty_rows; rows != 0; rows &= rows - 1) {
+            unsigned off = std::countr_zero(rows) * Constants::DISPW;
+            std::fill_n(&display[off], Constants::DISPW, 0);
+        }
+        dirty_rows = 0;
+    }
+
+    /**
+     * Bring the system back to the state it was constructed in with image
+     * loaded into memory. Only the memory pages written and display rows drawn
+     * to since the last reset are restored, so image must be the same memory
+     * contents this instance was loaded with. Colors are left as they are and
+     * the random engine keeps its state, use Seed() to restart it.
+     * @param image the boot image the instance was loaded with, obtained as a
+     * copy of RefMemory() right after LoadRom()
+     */
+    constexpr void reset(const BootImage& image)
+    {
+        if (hash_valid) [[unlikely]]
+            RehashPages(dirty_pages, image);
+        for (uint64_t pages = dirty_pages; pages != 0; pages &= pages - 1) {
+            unsigned off = std::countr_zero(pages) * Constants::PAGESIZE;
+            std::copy_n(&image[off], Constants::PAGESIZE, &memory[off]);
+        }
+        dirty_pages = 0;
+        reset_display();
+
+        stack.fill(0);
+        registers.fill(0);
+        keys = 0;
+        index_reg = 0;
+        program_counter = Constants::PROGRAM_LD_ADDR;
+        delay_timer = 0;
+        sound_timer = 0;
+        stacktop = Constants::INIT_STACK_TOP;
+        halt = false;
+        input_polls = 0;
+    }
+
+    /**
+     * Bring the system back to the state of a template instance, which may be
+     * anywhere past power-on (a BootCache state for example). Only the memory
+     * pages written and display rows drawn to since the last reset are
+     * restored, so this instance must have started out as a copy of pristine
+     * and image must be a copy of pristine's memory. Colors and the random
+     * engine are left as they are, like reset(image).
+     * @param pristine the instance this one was copied from
+     * @param image a copy of pristine.RefMemory()
+     */
+    constexpr void reset(const system& pristine, const BootImage& image)
+    {
+        for (uint64_t pages = dirty_pages; pages != 0; pages &= pages - 1) {
+            unsigned off = std::countr_zero(pages) * Constants::PAGESIZE;
+            std::copy_n(&image[off], Constants::PAGESIZE, &memory[off]);
+        }
+        for (uint32_t rows = dirty_rows | pristine.dirty_rows; rows != 0;
+             rows &= rows - 1) {
+            unsigned off = std::countr_zero(rows) * Constants::DISPW;
+            std::copy_n(&pristine.display[off],
+                        Constants::DISPW,
+                        &display[off]);
+        }
+        /* what pristine wrote stays dirty, a later reset(image) has to
+         * restore it. Memory and display now equal pristine's, so does
+         * their hash */
+        dirty_pages = pristine.dirty_pages;
+        dirty_rows = pristine.dirty_rows;
+        cells_hash = pristine.cells_hash;
+        hash_valid = pristine.hash_valid;
+
+        stack = pristine.stack;
+        registers = pristine.registers;
+        keys = pristine.keys;
+        index_reg = pristine.index_reg;
+        program_counter = pristine.program_counter;
+        delay_timer = pristine.delay_timer;
+        sound_timer = pristine.sound_timer;
+        stacktop = pristine.stacktop;
+        halt = pristine.halt;
+        input_polls = pristine.input_polls;
+    }
+
+    /**
+     * Returns a 128-bit hash of the whole machine state: registers, I, PC,
+     * the live part of the stack, timers, keys, halt, the random engine,
+     * memory and display. Memory and display are hashed incrementally on
+     * every write, so apart from the first call after construction or an
+     * untracked write this costs about as much as hashing the registers.
+     * Equal states hash equal no matter how they were reached.
+     * @return the state hash
      */
-    void reset_display()
+    constexpr Hash128 Hash()
     {
-        std::memset(&display[0], 0, Constants::DISPH * Constants::DISPW);
+        if (hash_valid == false) {
+            cells_hash = {};
+            for (uint32_t i = 0; i < Constants::MEMSIZE; i++)
+                cells_hash ^= HashCell(i, memory[i]);
+            for (uint32_t i = 0; i < display.size(); i++)
+                cells_hash ^= HashCell(Constants::MEMSIZE + i, display[i]);
+            hash_valid = true;
+        }
+
+        /* everything else is packed into 64-bit words numbered after the
+         * display, four stack entries to a word */
+        uint32_t cell = Constants::MEMSIZE + display.size();
+        Hash128 h = cells_hash;
+        auto regs = std::bit_cast<std::array<uint64_t, 2>>(registers);
+        h ^= HashCell(cell++, regs[0]);
+        h ^= HashCell(cell++, regs[1]);
+        h ^= HashCell(cell++,
+                      uint64_t{ index_reg } | uint64_t{ program_counter } << 16 |
+                        uint64_t{ delay_timer } << 32 |
+                        uint64_t{ sound_timer } << 40 |
+                        uint64_t{ static_cast<uint8_t>(stacktop) } << 48 |
+                        uint64_t{ halt } << 56);
+        h ^= HashCell(cell++, uint64_t{ keys } | uint64_t{ rng } << 16);
+        uint64_t word = 0;
+        for (int i = 0; i <= stacktop; i++) {
+            word |= uint64_t{ stack[i] } << (i % 4 * 16);
+            if (i % 4 == 3 || i == stacktop) {
+                h ^= HashCell(cell + i / 4, word);
+                word = 0;
+            }
+        }
+        return h;
     }
 
     /**
      * Reset all the keys i.e set all keys to Key::UP (un-pressed)
      */
-    void reset_keys()
+    constexpr void reset_keys()
     {
-        keys.reset();
+        keys = 0;
     }
 
     /**
      *  Returns a random integer between 0 and 255.
      * @return unsigned 8 bit random integer
      */
-    uint8_t InternalRand()
+    constexpr uint8_t InternalRand()
+    {
+        /* std::uniform_int_distribution<int>{ 0, 255 } as implemented by
+         * libstdc++, the numbers drawn match what this class produced back
+         * when it held the standard library engine and distribution */
+        constexpr uint32_t scaling = (2147483646 - 1) / 256;
+        uint32_t r;
+        do
+            r = NextRandom() - 1;
+        while (r >= 256 * scaling);
+        return r / scaling;
+    }
+
+    /**
+     * Re-seeds the random number generation engine. Used to hand out a
+     * recycled instance without going through a std::random_device.
+     * @param seed the value to seed the engine with
+     */
+    constexpr void Seed(uint32_t seed)
     {
-        return distb(engine);
+        rng = seed % 2147483647;
+        if (rng == 0) rng = 1;
     }
 
     /**
@@ -499,7 +982,7 @@ class system {
      * that block, used internally in load_key only as of now.
      * @return a boolean value
      */
-    bool isHalted()
+    constexpr bool isHalted()
     {
         return halt;
     }
@@ -508,12 +991,51 @@ class system {
      * Set the value of chip8 internal halt variable.
      * @param value a boolean value
      */
-    void setHalt(bool value)
+    constexpr void setHalt(bool value)
     {
         halt = value;
     }
+
+    /**
+     * Records that an instruction read the keypad, called by EX9E, EXA1 and
+     * FX0A.
+     */
+    constexpr void NoteInputPoll()
+    {
+        if (input_polls != UINT16_MAX) input_polls++;
+    }
+
+    /**
+     * Returns the number of keypad reads since the last ClearInputPolls(),
+     * saturating at UINT16_MAX. A frame that read nothing is a lag frame:
+     * it runs the same whatever keys are held.
+     */
+    constexpr uint16_t InputPolls()
+    {
+        return input_polls;
+    }
+
+    /**
+     * Tells whether the keypad was read since the last ClearInputPolls().
+     */
+    constexpr bool InputPolled()
+    {
+        return input_polls != 0;
+    }
+
+    /**
+     * Forgets the keypad reads recorded so far, usually at the start of a
+     * frame.
+     */
+    constexpr void ClearInputPolls()
+    {
+        input_polls = 0;
+    }
 };
 
+/* a new field has to take the place of padding or come with its own */
+static_assert(std::has_unique_object_representations_v<system>);
+
 /**
  * Subnamespace inside the Chip8_core namespace.
  * Contains all declarations and definitions of Chip8 instructions.
@@ -523,92 +1045,92 @@ namespace Instructions {
 /**
  * 00E0 - Clear the display.
  */
-void
-cls(system Chip8);
+constexpr void
+cls(system& Chip8);
 
 /**
  * 00EE - return.
  */
-void
-ret(system Chip8);
+constexpr void
+ret(system& Chip8);
 
 /**
  * 1NNN - jump to NNN.
  */
-void
-jmp(uint16_t opcode, system Chip8);
+constexpr void
+jmp(uint16_t opcode, system& Chip8);
 
 /**
  * 2NNN - call subroutine at NNN.
  */
-void
-call(uint16_t opcode, system Chip8);
+constexpr void
+call(uint16_t opcode, system& Chip8);
 
 /**
  * 3XNN - if RX != NN then do.
  */
-void
-skip_eq(uint16_t opcode, system Chip8);
+constexpr void
+skip_eq(uint16_t opcode, system& Chip8);
 
 /**
  * 4XNN - if RX == NN then do.
  */
-void
-skip_noteq(uint16_t opcode, system Chip8);
+constexpr void
+skip_noteq(uint16_t opcode, system& Chip8);
 
 /**
  * 5XY0 - if RX != RY then do.
  */
-void
-skip_xyeq(uint16_t opcode, system Chip8);
-void
+constexpr void
+skip_xyeq(uint16_t opcode, system& Chip8);
 
 /**
  * 6XNN - RX := NN.
  */
-load(uint16_t opcode, system Chip8);
+constexpr void
+load(uint16_t opcode, system& Chip8);
 
 /**
  * 7XNN - RX += NN.
  */
-void
-add(uint16_t opcode, system Chip8);
+constexpr void
+add(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY0 - RX := NN.
  */
-void
-load_reg(uint16_t opcode, system Chip8);
+constexpr void
+load_reg(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY1 - RX |= RY.
  */
-void
-regor(uint16_t opcode, system Chip8);
+constexpr void
+regor(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY2 - RX &= RY.
  */
-void
-regand(uint16_t opcode, system Chip8);
+constexpr void
+regand(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY3 - RX &= RY.
  */
-void
-regxor(uint16_t opcode, system Chip8);
+constexpr void
+regxor(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY4 - RX ^= RY.
  */
-void
-regaddc(uint16_t opcode, system Chip8);
+constexpr void
+regaddc(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY5 - RX += RY.
  */
-void
-regsubc(uint16_t opcode, system Chip8);
+constexpr void
+regsubc(uint16_t opcode, system& Chip8);
 
 /**
  * 8XY6 - RX >>= RY.
@@ -616,14 +1138,14 @@ regsubc(uint16_t opcode, system Chip8);
  * Pass mode as Quirks::SHIFT_RY or Quirks::SHIFT_RX
  * for enabling the behaviour as described at enum Quriks.
  */
-void
-regshift_right(Quirks mode, uint16_t opcode, system Chip8);
+constexpr void
+regshift_right(Quirks mode, uint16_t opcode, system& Chip8);
 
 /**
  * 8XY7 - RX = RY - RX.
  */
-void
-regsubc_reverse(uint16_t opcode, system Chip8);
+constexpr void
+regsubc_reverse(uint16_t opcode, system& Chip8);
 
 /**
  * 8XYE - RX <<= RY.
@@ -631,108 +1153,127 @@ regsubc_reverse(uint16_t opcode, system Chip8);
  * Pass mode as Quirks::SHIFT_RY or Quirks::SHIFT_RX
  * for enabling the behaviour as described at enum Quriks.
  */
-void
-regshift_left(Quirks mode, uint16_t opcode, system Chip8);
+constexpr void
+regshift_left(Quirks mode, uint16_t opcode, system& Chip8);
 
 /**
  * 9XY0 - if RX == RY then do.
  */
-void
-skip_regnoteq(uint16_t opcode, system Chip8);
+constexpr void
+skip_regnoteq(uint16_t opcode, system& Chip8);
 
 /**
  * ANNN - I := NNN.
  */
-void
-load_idxreg_addr(uint16_t opcode, system Chip8);
+constexpr void
+load_idxreg_addr(uint16_t opcode, system& Chip8);
 
 /**
  * BNNN - JMP (R0 + NNN).
  */
-void
-jmpreg(uint16_t opcode, system Chip8);
+constexpr void
+jmpreg(uint16_t opcode, system& Chip8);
 
 /**
  * CXNN - RX = Random_number & NN.
  * Note &:bitwise AND - similar to 8XY1,2,3 which are also bitwise operations.
  */
-void
-genrandom(uint16_t opcode, system Chip8);
+constexpr void
+genrandom(uint16_t opcode, system& Chip8);
 
 /**
  * DXYN - Draw a sprite at Co-ordinates RX,RY of height N.
  * Note &:bitwise AND - similar to 8XY1,2,3 which are also bitwise operations.
  */
-void
-draw(uint16_t opcode, system Chip8);
+constexpr void
+draw(uint16_t opcode, system& Chip8);
 
 /**
  * EX9E - if Keys[RX] set to Key::DOWN then do.
  */
-void
-skip_ifkeypress(uint16_t opcode, system Chip8);
+constexpr void
+skip_ifkeypress(uint16_t opcode, system& Chip8);
 
 /**
  * EXA1 - if Keys[RX] set to Key::UP then do.
  */
-void
-skip_ifkeynotpress(uint16_t opcode, system Chip8);
+constexpr void
+skip_ifkeynotpress(uint16_t opcode, system& Chip8);
 
 /**
  * FX07 - VX := Delay Timer.
  */
-void
-load_dt_to_reg(uint16_t opcode, system Chip8);
+constexpr void
+load_dt_to_reg(uint16_t opcode, system& Chip8);
 
 /**
  * FX0A - Wait for keypress, upon pressing load that key to RX.
  */
-void
-load_key(uint16_t opcode, system Chip8);
+constexpr void
+load_key(uint16_t opcode, system& Chip8);
 
 /**
  * FX15 - Delay Timer := RX.
  */
-void
-set_dt(uint16_t opcode, system Chip8);
+constexpr void
+set_dt(uint16_t opcode, system& Chip8);
 
 /**
  * FX18 - Sound Timer := RX.
  */
-void
-set_st(uint16_t opcode, system Chip8);
+constexpr void
+set_st(uint16_t opcode, system& Chip8);
 
 /**
  * FX1E - Index += RX.
  */
-void
-regadd_idx(uint16_t opcode, system Chip8);
+constexpr void
+regadd_idx(uint16_t opcode, system& Chip8);
 
 /**
  * FX29 - Set Index register to the location of a sprite in font memory.
  */
-void
-sprite(uint16_t opcode, system Chip8);
+constexpr void
+sprite(uint16_t opcode, system& Chip8);
 
 /**
  * FX33 - Decode RX into Binary Coded Decimal.
  */
-void
-decode_bcd(uint16_t opcode, system Chip8);
+constexpr void
+decode_bcd(uint16_t opcode, system& Chip8);
 
 /**
  * FX55 - Save R0 to RX into memory[index] and onwards.
  * Pass mode = Quirks::MATT to follow Matt mikolay's documentation
  */
-void
-load_reg_into_memory(Quirks mode, uint16_t opcode, system Chip8) noexcept;
+constexpr void
+load_reg_into_memory(Quirks mode, uint16_t opcode, system& Chip8) noexcept;
 
 /**
  * FX65 - Save memory[Index] to memory[Index + X] into R0 and onwards.
  * Pass mode = Quirks::MATT to follow Matt mikolay's documentation
  */
-void
-load_memory_into_reg(Quirks mode, uint16_t opcode, system Chip8) noexcept;
+constexpr void
+load_memory_into_reg(Quirks mode, uint16_t opcode, system& Chip8) noexcept;
+
+/**
+ * Decodes a single opcode and executes the matching instruction.
+ * Opcodes that do not name an instruction are ignored like 0NNN.
+ * @param mode the quirks to follow for 8XY6, 8XYE, FX55 and FX65
+ * @param opcode the 16-bit opcode, usually obtained through system::Fetch()
+ */
+constexpr void
+execute(Quirks mode, uint16_t opcode, system& Chip8);
+
+/**
+ * Tells whether an instruction depends on anything besides the machine state,
+ * that is the keypad (EX9E, EXA1, FX0A), the random engine (CXNN) or the delay
+ * timer which the frontend ticks (FX07). Everything before the first such
+ * instruction runs the same way every time a ROM is started.
+ * @param opcode the 16-bit opcode
+ */
+constexpr bool
+is_impure(uint16_t opcode);
 
 /** @defgroup Opcode Utilities
  * The functions described here extract specific nibble from 16-bit opcode.
@@ -747,7 +1288,7 @@ load_memory_into_reg(Quirks mode, uint16_t opcode, system Chip8) noexcept;
  * @param opcode the 16-bit opcode
  * @return the first nibble stored in a uint8_t
  */
-uint8_t
+constexpr uint8_t
 fetch_nib1(uint16_t opcode);
 
 /**
@@ -755,7 +1296,7 @@ fetch_nib1(uint16_t opcode);
  * @param opcode the 16-bit opcode
  * @return the second nibble stored in a uint8_t
  */
-uint8_t
+constexpr uint8_t
 fetch_nib2(uint16_t opcode);
 
 /**
@@ -763,7 +1304,7 @@ fetch_nib2(uint16_t opcode);
  * @param opcode the 16-bit opcode
  * @return the third nibble stored in a uint8_t
  */
-uint8_t
+constexpr uint8_t
 fetch_nib3(uint16_t opcode);
 
 /**
@@ -771,7 +1312,7 @@ fetch_nib3(uint16_t opcode);
  * @param opcode the 16-bit opcode
  * @return the fourth nibble stored in a uint8_t
  */
-uint8_t
+constexpr uint8_t
 fetch_nib4(uint16_t opcode);
 
 /**
@@ -780,13 +1321,10 @@ fetch_nib4(uint16_t opcode);
  * @param ln the lower nibble of an 8 bit byte
  * @return a single 8-bit byte comprising of un << 4 | ln
  */
-uint8_t
+constexpr uint8_t
 nibble2byte(uint8_t un, uint8_t ln);
 
 /** @} */ // end the Opcode Utilities group here
-// #define LIBCHIP8_IMPLEMENTATION_SOURCE
-#ifdef LIBCHIP8_IMPLEMENTATION_SOURCE
-#undef LIBCHIP8_IMPLEMENTATION_SOURCE
 
 /* utility functions */
 /* excatly what the function names denote
@@ -795,103 +1333,103 @@ nibble2byte(uint8_t un, uint8_t ln);
  * then X - Y makes up the higher byte of the opcode
  * and  Z - A makes up the lower byte of the opcode
  */
-uint8_t
-nibble2byte(uint8_t un, uint8_t ln) // NOLINT(misc-definitions-in-headers)
+constexpr uint8_t
+nibble2byte(uint8_t un, uint8_t ln)
 {
     return un << 4 | ln;
 }
 
-uint8_t
-fetch_nib1(uint16_t opcode) // NOLINT(misc-definitions-in-headers)
+constexpr uint8_t
+fetch_nib1(uint16_t opcode)
 {
     return (opcode >> 12);
 }
 
-uint8_t
-fetch_nib2(uint16_t opcode) // NOLINT(misc-definitions-in-headers)
+constexpr uint8_t
+fetch_nib2(uint16_t opcode)
 {
-    return ((opcode << 4) >> 8);
+    return ((opcode >> 8) & 0xF);
 }
 
-uint8_t
-fetch_nib3(uint16_t opcode) // NOLINT(misc-definitions-in-headers)
+constexpr uint8_t
+fetch_nib3(uint16_t opcode)
 {
-    return ((opcode << 8) >> 12);
+    return ((opcode >> 4) & 0xF);
 }
 
-uint8_t
-fetch_nib4(uint16_t opcode) // NOLINT(misc-definitions-in-headers)
+constexpr uint8_t
+fetch_nib4(uint16_t opcode)
 {
-    return ((opcode << 12) >> 12);
+    return (opcode & 0xF);
 }
 
 /** instructions **/
-void
-sys_addr(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+sys_addr(uint16_t opcode, system& Chip8)
 {
     (void)opcode;
     (void)Chip8;
 }
 
-void
-cls(system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+cls(system& Chip8)
 {
     Chip8.reset_display();
 }
 
-void
-ret(system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+ret(system& Chip8)
 {
     Chip8.SetPC(Chip8.Pop());
 }
 
-void
-jmp(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+jmp(uint16_t opcode, system& Chip8)
 {
     Chip8.SetPC((fetch_nib2(opcode) << 8) |
                 nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode)));
 }
 
-void
-call(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+call(uint16_t opcode, system& Chip8)
 {
     Chip8.Push(Chip8.GetPC());
     jmp(opcode, Chip8);
 }
 
-void
-skip_eq(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+skip_eq(uint16_t opcode, system& Chip8)
 {
     if (Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode))) ==
         nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode)))
         Chip8.SetPC(Chip8.GetPC() + 2);
 }
 
-void
-skip_noteq(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+skip_noteq(uint16_t opcode, system& Chip8)
 {
     if (Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode))) !=
         nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode)))
         Chip8.SetPC(Chip8.GetPC() + 2);
 }
 
-void
-skip_xyeq(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+skip_xyeq(uint16_t opcode, system& Chip8)
 {
     if (Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode))) ==
         Chip8.GetRegister(static_cast<Registers>(fetch_nib3(opcode))))
         Chip8.SetPC(Chip8.GetPC() + 2);
 }
 
-void
-load(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+load(uint16_t opcode, system& Chip8)
 {
     Chip8.SetRegister(static_cast<Registers>(fetch_nib2(opcode)),
                       nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode)));
 }
 
-void
-add(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+add(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetRegister(rx,
@@ -899,77 +1437,75 @@ add(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
                         nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode)));
 }
 
-void
-load_reg(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+load_reg(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
     Chip8.SetRegister(rx, Chip8.GetRegister(ry));
 }
 
-void
-regor(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+regor(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
     Chip8.SetRegister(rx, Chip8.GetRegister(rx) | Chip8.GetRegister(ry));
 }
 
-void
-regand(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+regand(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
     Chip8.SetRegister(rx, Chip8.GetRegister(rx) & Chip8.GetRegister(ry));
 }
 
-void
-regxor(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+regxor(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
     Chip8.SetRegister(rx, Chip8.GetRegister(rx) ^ Chip8.GetRegister(ry));
 }
 
-void
-regaddc(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+/* The arithmetic below computes the flag from the operands before writing
+ * the result, and writes VF last so that it ends up holding the flag when
+ * it is also the destination. */
+
+constexpr void
+regaddc(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
 
-    Chip8.SetRegister(Registers::RF, 0);
-    if (UINT8_MAX - Chip8.GetRegister(rx) < Chip8.GetRegister(ry))
-        Chip8.SetRegister(Registers::RF, 1);
-
+    bool carry = UINT8_MAX - Chip8.GetRegister(rx) < Chip8.GetRegister(ry);
     Chip8.SetRegister(rx, Chip8.GetRegister(rx) + Chip8.GetRegister(ry));
+    Chip8.SetRegister(Registers::RF, carry);
 }
 
-void
-regsubc(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+regsubc(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
-    Chip8.SetRegister(Registers::RF, 0);
-
-    if (Chip8.GetRegister(rx) > Chip8.GetRegister(ry))
-        Chip8.SetRegister(Registers::RF, 1);
 
+    /* VF is NOT borrow, there is no borrow when both are equal */
+    bool no_borrow = Chip8.GetRegister(rx) >= Chip8.GetRegister(ry);
     Chip8.SetRegister(rx, Chip8.GetRegister(rx) - Chip8.GetRegister(ry));
+    Chip8.SetRegister(Registers::RF, no_borrow);
 }
 
-void
-regshift_right(Quirks mode, // NOLINT(misc-definitions-in-headers)
-               uint16_t opcode,
-               system Chip8)
+constexpr void
+regshift_right(Quirks mode, uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
-    Chip8.SetRegister(Registers::RF, 0);
 
     auto shift = [&](Registers to_shift, uint8_t shift_cnt) {
-        if (Chip8.GetRegister(to_shift) & 0b1)
-            Chip8.SetRegister(Registers::RF, 1);
+        bool out = Chip8.GetRegister(to_shift) & 0b1;
         Chip8.SetRegister(rx, Chip8.GetRegister(to_shift) >> shift_cnt);
+        Chip8.SetRegister(Registers::RF, out);
     };
 
     switch (mode) {
@@ -987,33 +1523,27 @@ regshift_right(Quirks mode, // NOLINT(misc-definitions-in-headers)
     }
 }
 
-void
-regsubc_reverse(uint16_t opcode,
-                system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+regsubc_reverse(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
-    Chip8.SetRegister(Registers::RF, 0);
-
-    if (Chip8.GetRegister(rx) < Chip8.GetRegister(ry))
-        Chip8.SetRegister(Registers::RF, 1);
 
+    bool no_borrow = Chip8.GetRegister(ry) >= Chip8.GetRegister(rx);
     Chip8.SetRegister(rx, Chip8.GetRegister(ry) - Chip8.GetRegister(rx));
+    Chip8.SetRegister(Registers::RF, no_borrow);
 }
 
-void
-regshift_left(Quirks mode, // NOLINT(misc-definitions-in-headers)
-              uint16_t opcode,
-              system Chip8)
+constexpr void
+regshift_left(Quirks mode, uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     auto ry = static_cast<Registers>(fetch_nib3(opcode));
-    Chip8.SetRegister(Registers::RF, 0);
 
     auto shift = [&](Registers to_shift, uint8_t shift_cnt) {
-        if (Chip8.GetRegister(to_shift) & 0b1000'0000)
-            Chip8.SetRegister(Registers::RF, 1);
+        bool out = Chip8.GetRegister(to_shift) & 0b1000'0000;
         Chip8.SetRegister(rx, Chip8.GetRegister(to_shift) << shift_cnt);
+        Chip8.SetRegister(Registers::RF, out);
     };
 
     switch (mode) {
@@ -1031,34 +1561,32 @@ regshift_left(Quirks mode, // NOLINT(misc-definitions-in-headers)
     }
 }
 
-void
-skip_regnoteq(uint16_t opcode,
-              system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+skip_regnoteq(uint16_t opcode, system& Chip8)
 {
     if (Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode))) !=
         Chip8.GetRegister(static_cast<Registers>(fetch_nib3(opcode))))
         Chip8.SetPC(Chip8.GetPC() + 2);
 }
 
-void
-load_idxreg_addr(uint16_t opcode,
-                 system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+load_idxreg_addr(uint16_t opcode, system& Chip8)
 {
     uint16_t addr = fetch_nib2(opcode) << 8 |
                     nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode));
     Chip8.SetIndexRegister(addr);
 }
 
-void
-jmpreg(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+jmpreg(uint16_t opcode, system& Chip8)
 {
     uint16_t addr = fetch_nib2(opcode) << 8 |
                     nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode));
     Chip8.SetPC(Chip8.GetRegister(Registers::R0) + addr);
 }
 
-void
-genrandom(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+genrandom(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetRegister(rx,
@@ -1066,8 +1594,8 @@ genrandom(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
                         nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode)));
 }
 
-void
-draw(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+draw(uint16_t opcode, system& Chip8)
 {
     /* tobias vl's dxyn impl*/
     uint8_t val_x =
@@ -1079,125 +1607,125 @@ draw(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
     Chip8.SetRegister(Registers::RF, 0);
 
     for (int rows = 0; rows < N; rows++) {
-        uint8_t sprite = Chip8[Chip8.GetIndexRegister() + rows];
+        uint8_t sprite = Chip8.GetMemory(Chip8.GetIndexRegister() + rows);
 
-        val_y += rows;
-        if (val_y >= Constants::DISPH) break;
+        uint8_t y = val_y + rows;
+        if (y >= Constants::DISPH) break;
 
         for (int col = 0; col < 8; col++) {
-            val_x += col;
-            if (val_x >= Constants::DISPW) break;
+            uint8_t x = val_x + col;
+            if (x >= Constants::DISPW) break;
 
             if (sprite & (0b1000'0000 >> col)) {
-                if (Chip8.GetPixel(val_x + val_y * Constants::DISPW)) {
-                    Chip8.SetPixel(val_x + val_y * Constants::DISPW,
-                                   Chip8.display_bg);
-                    Chip8.SetRegister(Registers::RF, 1);
-                    continue;
-                }
-
-                Chip8.SetPixel(val_x + val_y * Constants::DISPW,
-                               Chip8.display_fg);
+                uint16_t idx = x + y * Constants::DISPW;
+                bool lit = Chip8.IsLit(idx);
+                if (lit) Chip8.SetRegister(Registers::RF, 1);
+                Chip8.SetPixel(idx, lit ? Chip8.display_bg : Chip8.display_fg);
             }
         }
     }
 }
 
-void
-skip_ifkeypress(uint16_t opcode,
-                system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+skip_ifkeypress(uint16_t opcode, system& Chip8)
 {
+    Chip8.NoteInputPoll();
     auto regval = Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode)));
     if (Chip8.GetKey(static_cast<KeyCode>(regval)) == Key::DOWN)
         Chip8.SetPC(Chip8.GetPC() + 2);
 }
 
-void
-skip_ifkeynotpress(uint16_t opcode, // NOLINT(misc-definitions-in-headers)
-                   system Chip8)
+constexpr void
+skip_ifkeynotpress(uint16_t opcode, system& Chip8)
 {
+    Chip8.NoteInputPoll();
     auto regval = Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode)));
     if (Chip8.GetKey(static_cast<KeyCode>(regval)) == Key::UP)
         Chip8.SetPC(Chip8.GetPC() + 2);
 }
 
-void
-load_dt_to_reg(uint16_t opcode,
-               system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+load_dt_to_reg(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetRegister(rx, Chip8.GetDT());
 }
 
-void
-load_key(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+load_key(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
-    Chip8.SetPC(Chip8.GetPC() - 2);
-
-    if (Chip8.GetKey(static_cast<KeyCode>(Chip8.GetRegister(rx))) == Key::UP &&
-        Chip8.isHalted()) {
-        Chip8.SetPC(Chip8.GetPC() + 2);
-        Chip8.setHalt(false);
+    Chip8.NoteInputPoll();
+
+    /* a key was latched into RX, carry on once it is released */
+    if (Chip8.isHalted()) {
+        auto latched = static_cast<KeyCode>(Chip8.GetRegister(rx));
+        if (Chip8.GetKey(latched) == Key::UP) {
+            Chip8.setHalt(false);
+            return;
+        }
+        Chip8.SetPC(Chip8.GetPC() - 2);
+        return;
     }
 
-    for (int i = 0x0; i <= 0xf; i++) {
+    /* otherwise latch the highest key held and wait for its release */
+    Chip8.SetPC(Chip8.GetPC() - 2);
+    for (int i = 0xf; i >= 0x0; i--) {
         if (Chip8.GetKey(static_cast<KeyCode>(i)) == Key::DOWN) {
             Chip8.SetRegister(rx, i);
             Chip8.setHalt(true);
+            break;
         }
     }
 }
 
-void
-set_dt(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+set_dt(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetDT(Chip8.GetRegister(rx));
 }
 
-void
-set_st(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+set_st(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetST(Chip8.GetRegister(rx));
 }
 
-void
-radd_idx(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+regadd_idx(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetIndexRegister(Chip8.GetIndexRegister() + Chip8.GetRegister(rx));
 }
 
-void
-sprite(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+sprite(uint16_t opcode, system& Chip8)
 {
     auto rx = static_cast<Registers>(fetch_nib2(opcode));
     Chip8.SetIndexRegister((Chip8.GetRegister(rx) % 16) *
                            5); // modulus 16 because we want hexadecimal value
 }
 
-void
-decode_bcd(uint16_t opcode, system Chip8) // NOLINT(misc-definitions-in-headers)
+constexpr void
+decode_bcd(uint16_t opcode, system& Chip8)
 {
     uint8_t num = Chip8.GetRegister(static_cast<Registers>(fetch_nib2(opcode)));
-    Chip8[Chip8.GetIndexRegister() + 2] = num % 10; // ones place
+    Chip8.SetMemory(Chip8.GetIndexRegister() + 2, num % 10); // ones place
     num = num / 10;
-    Chip8[Chip8.GetIndexRegister() + 1] = num % 10; // tens place
+    Chip8.SetMemory(Chip8.GetIndexRegister() + 1, num % 10); // tens place
     num = num / 10;
-    Chip8[Chip8.GetIndexRegister()] = num; // hundreds place
+    Chip8.SetMemory(Chip8.GetIndexRegister(), num); // hundreds place
 }
 
-void
-load_reg_into_memory(Quirks mode, // NOLINT(misc-definitions-in-headers)
-                     uint16_t opcode,
-                     system Chip8) noexcept
+constexpr void
+load_reg_into_memory(Quirks mode, uint16_t opcode, system& Chip8) noexcept
 {
     uint8_t last_reg{ fetch_nib2(opcode) };
-    std::copy_n(Chip8.RefRegisterArray().begin(),
-                last_reg,
-                Chip8.RefMemory().begin() + Chip8.GetIndexRegister());
+    for (uint8_t i = 0; i <= last_reg; i++)
+        Chip8.SetMemory(Chip8.GetIndexRegister() + i,
+                        Chip8.GetRegister(static_cast<Registers>(i)));
 
     /* According to Matt Mikolay's documentation
      * I is set to I + X + 1 after performing the operation
@@ -1206,15 +1734,13 @@ load_reg_into_memory(Quirks mode, // NOLINT(misc-definitions-in-headers)
         Chip8.SetIndexRegister(Chip8.GetIndexRegister() + last_reg + 1);
 }
 
-void
-load_memory_into_reg(Quirks mode, // NOLINT(misc-definitions-in-headers)
-                     uint16_t opcode,
-                     system Chip8) noexcept
+constexpr void
+load_memory_into_reg(Quirks mode, uint16_t opcode, system& Chip8) noexcept
 {
     uint8_t last_reg{ fetch_nib2(opcode) };
-    std::copy_n(Chip8.RefMemory().begin() + Chip8.GetIndexRegister(),
-                last_reg,
-                Chip8.RefRegisterArray().begin());
+    for (uint8_t i = 0; i <= last_reg; i++)
+        Chip8.SetRegister(static_cast<Registers>(i),
+                          Chip8.GetMemory(Chip8.GetIndexRegister() + i));
 
     /* According to Matt Mikolay's documentation
      * I is set to I + X + 1 after performing the operation
@@ -1222,9 +1748,276 @@ load_memory_into_reg(Quirks mode, // NOLINT(misc-definitions-in-headers)
     if (mode == Quirks::MATT)
         Chip8.SetIndexRegister(Chip8.GetIndexRegister() + last_reg + 1);
 }
+constexpr void
+execute(Quirks mode, uint16_t opcode, system& Chip8)
+{
+    switch (fetch_nib1(opcode)) {
+        case 0x0:
+            switch (nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode))) {
+                case 0xE0:
+                    if (fetch_nib2(opcode) == 0) cls(Chip8);
+                    break;
+
+                case 0xEE:
+                    if (fetch_nib2(opcode) == 0) ret(Chip8);
+                    break;
+
+                default:
+                    sys_addr(opcode, Chip8);
+                    break;
+            }
+            break;
+
+        case 0x1:
+            jmp(opcode, Chip8);
+            break;
+
+        case 0x2:
+            call(opcode, Chip8);
+            break;
+
+        case 0x3:
+            skip_eq(opcode, Chip8);
+            break;
+
+        case 0x4:
+            skip_noteq(opcode, Chip8);
+            break;
+
+        case 0x5:
+            if (fetch_nib4(opcode) == 0) skip_xyeq(opcode, Chip8);
+            break;
+
+        case 0x6:
+            load(opcode, Chip8);
+            break;
+
+        case 0x7:
+            add(opcode, Chip8);
+            break;
+
+        case 0x8:
+            switch (fetch_nib4(opcode)) {
+                case 0x0:
+                    load_reg(opcode, Chip8);
+                    break;
+
+                case 0x1:
+                    regor(opcode, Chip8);
+                    break;
+
+                case 0x2:
+                    regand(opcode, Chip8);
+                    break;
+
+                case 0x3:
+                    regxor(opcode, Chip8);
+                    break;
+
+                case 0x4:
+                    regaddc(opcode, Chip8);
+                    break;
+
+                case 0x5:
+                    regsubc(opcode, Chip8);
+                    break;
+
+                case 0x6:
+                    regshift_right(mode, opcode, Chip8);
+                    break;
+
+                case 0x7:
+                    regsubc_reverse(opcode, Chip8);
+                    break;
+
+                case 0xE:
+                    regshift_left(mode, opcode, Chip8);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+
+        case 0x9:
+            if (fetch_nib4(opcode) == 0) skip_regnoteq(opcode, Chip8);
+            break;
+
+        case 0xA:
+            load_idxreg_addr(opcode, Chip8);
+            break;
+
+        case 0xB:
+            jmpreg(opcode, Chip8);
+            break;
+
+        case 0xC:
+            genrandom(opcode, Chip8);
+            break;
+
+        case 0xD:
+            draw(opcode, Chip8);
+            break;
+
+        case 0xE:
+            switch (nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode))) {
+                case 0x9E:
+                    skip_ifkeypress(opcode, Chip8);
+                    break;
+
+                case 0xA1:
+                    skip_ifkeynotpress(opcode, Chip8);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+
+        case 0xF:
+            switch (nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode))) {
+                case 0x07:
+                    load_dt_to_reg(opcode, Chip8);
+                    break;
+
+                case 0x0A:
+                    load_key(opcode, Chip8);
+                    break;
+
+                case 0x15:
+                    set_dt(opcode, Chip8);
+                    break;
+
+                case 0x18:
+                    set_st(opcode, Chip8);
+                    break;
+
+                case 0x1E:
+                    regadd_idx(opcode, Chip8);
+                    break;
+
+                case 0x29:
+                    sprite(opcode, Chip8);
+                    break;
+
+                case 0x33:
+                    decode_bcd(opcode, Chip8);
+                    break;
+
+                case 0x55:
+                    load_reg_into_memory(mode, opcode, Chip8);
+                    break;
+
+                case 0x65:
+                    load_memory_into_reg(mode, opcode, Chip8);
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+    }
+}
+
+constexpr bool
+is_impure(uint16_t opcode)
+{
+    uint8_t low = nibble2byte(fetch_nib3(opcode), fetch_nib4(opcode));
+    switch (fetch_nib1(opcode)) {
+        case 0xC:
+            return true;
+        case 0xE:
+            return low == 0x9E || low == 0xA1;
+        case 0xF:
+            return low == 0x07 || low == 0x0A;
+        default:
+            return false;
+    }
+}
 
-#endif
 } // namespace Instructions
+
+/**
+ * Runs a single fetch, decode and execute cycle.
+ * @param Chip8 the system to run
+ * @param mode the quirks to follow
+ */
+constexpr void
+cycle(system& Chip8, Quirks mode)
+{
+    Instructions::execute(mode, Chip8.Fetch(), Chip8);
+}
+
+/**
+ * Counts the delay and sound timers down by one, to be called at 60Hz.
+ * @param Chip8 the system whose timers to tick
+ */
+constexpr void
+tick_timers(system& Chip8)
+{
+    if (Chip8.GetDT() > 0) Chip8.SetDT(Chip8.GetDT() - 1);
+    if (Chip8.GetST() > 0) Chip8.SetST(Chip8.GetST() - 1);
+}
+
+/**
+ * Runs one frame: a number of cycles followed by a tick of the timers.
+ * Keypad reads are cleared first, so system::InputPolled() afterwards tells
+ * whether the frame depended on the keys held.
+ * @param Chip8 the system to run
+ * @param mode the quirks to follow
+ * @param cycles the number of cycles per frame, 10 gives the usual 600Hz
+ */
+constexpr void
+frame(system& Chip8, Quirks mode, unsigned cycles)
+{
+    Chip8.ClearInputPolls();
+    for (unsigned i = 0; i < cycles; i++)
+        cycle(Chip8, mode);
+    tick_timers(Chip8);
+}
+
+/**
+ * Runs one frame like frame(), also telling on which cycles the keypad was
+ * read.
+ * @param Chip8 the system to run
+ * @param mode the quirks to follow
+ * @param cycles the number of cycles per frame
+ * @return bit i set if cycle i read the keypad, cycles past 63 all land in
+ * bit 63
+ */
+constexpr uint64_t
+frame_polls(system& Chip8, Quirks mode, unsigned cycles)
+{
+    uint64_t polls = 0;
+    Chip8.ClearInputPolls();
+    for (unsigned i = 0; i < cycles; i++) {
+        uint16_t before = Chip8.InputPolls();
+        cycle(Chip8, mode);
+        if (Chip8.InputPolls() != before) polls |= 1ULL << (i < 63 ? i : 63);
+    }
+    tick_timers(Chip8);
+    return polls;
+}
+
+/**
+ * Runs a number of cycles. Being constexpr, this can run a ROM at compile
+ * time, either to check its outcome in a static_assert or to bake the state
+ * after its init routine into the binary, like so
+ *
+ *     constexpr system booted = run(system{ image, 0 }, Quirks::MATT, 500);
+ *
+ * @param Chip8 the system to start from
+ * @param mode the quirks to follow
+ * @param cycles the number of cycles to run
+ * @return the system after running
+ */
+constexpr system
+run(system Chip8, Quirks mode, unsigned cycles)
+{
+    for (unsigned i = 0; i < cycles; i++)
+        cycle(Chip8, mode);
+    return Chip8;
+}
 } // namespace Chip8_core
 
 #endif
\ No newline at end of file
@@ -0,0 +1,748 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_AOT
+#define BASED_CHIP8_AOT
+
+#include "libchip8++.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Chip8_core {
+
+/**
+ * Bumped whenever generated code would behave differently, be it from a
+ * change to the translator, the instruction handlers or the system layout.
+ * Plugins built for another version are refused.
+ */
+inline constexpr uint32_t AOT_ENGINE_VERSION = 2;
+
+/**
+ * A translated basic block. Runs the block, and the blocks it jumps to while
+ * fewer than budget cycles have run in total, then leaves PC at the next
+ * instruction to execute.
+ * @param Chip8 the system to run
+ * @param budget the cycle count to stop chaining at
+ * @param n the cycles run so far
+ * @return the cycles run so far, n itself if the block's code no longer
+ * matches memory
+ */
+using AotBlockFn = unsigned (*)(system& Chip8, unsigned budget, unsigned n);
+
+/** Entry of a plugin's block table. */
+struct AotBlock {
+    uint16_t addr;  /**< Address of the first instruction. */
+    AotBlockFn run; /**< The translated block. */
+};
+
+/**
+ * What a plugin exports under the name chip8_aot_module.
+ */
+struct AotModule {
+    uint32_t engine_version; /**< AOT_ENGINE_VERSION it was built with. */
+    uint32_t system_size;    /**< sizeof(system) it was built with. */
+    uint64_t image_hash;     /**< HashImage() of the translated image. */
+    Quirks mode;             /**< The quirks it was translated for. */
+    uint32_t block_count;    /**< Number of entries in blocks. */
+    const AotBlock* blocks;  /**< The blocks, in address order. */
+};
+
+/**
+ * Ahead of time translation of a ROM into C++. Control flow is recovered
+ * from 0x200 by following jumps, calls, return sites and both sides of every
+ * skip. Each basic block becomes a function that keeps the registers it
+ * uses in locals, loops on itself without leaving the function and calls
+ * straight into the blocks it jumps to. Every block checks its own bytes
+ * against memory when entered, so self-modified code and anything the
+ * recovery could not see (BNNN targets, code reached through 00EE into
+ * a location no call returns to) is left to the interpreter.
+ * FX0A, which waits by re-executing itself, always runs in the interpreter
+ * and blocks end after FX33 and FX55 so stores never land in the block
+ * running them.
+ */
+class AotTranslator {
+  private:
+    static constexpr unsigned MAX_BLOCK = 64;
+    static constexpr const char* SIGNATURE =
+      "(Chip8_core::system& c, unsigned budget, unsigned n)";
+
+    enum Kind {
+        PLAIN, /* falls through */
+        JUMP,  /* 1NNN */
+        CALL,  /* 2NNN */
+        SKIP,  /* 3XNN 4XNN 5XY0 9XY0 EX9E EXA1 */
+        STORE, /* FX33 FX55, falls through but ends the block */
+        EXIT,  /* 00EE BNNN, target unknown */
+        WAIT,  /* FX0A, interpreted */
+    };
+
+    struct Block {
+        uint16_t addr;
+        std::vector<uint16_t> ops;
+    };
+
+    const BootImage& image;
+    Quirks mode;
+    std::array<bool, Constants::MEMSIZE> leader{};
+    std::array<bool, Constants::MEMSIZE> decoded{};
+    std::array<int, Constants::MEMSIZE> block_at;
+    std::vector<Block> blocks;
+
+    uint16_t Opcode(uint16_t addr) const
+    {
+        return image[addr] << 8 | image[addr + 1];
+    }
+
+    static Kind Classify(uint16_t op)
+    {
+        uint8_t low = op & 0xFF;
+        switch (op >> 12) {
+            case 0x0:
+                return op == 0x00EE ? EXIT : PLAIN;
+            case 0x1:
+                return JUMP;
+            case 0x2:
+                return CALL;
+            case 0x3:
+            case 0x4:
+                return SKIP;
+            case 0x5:
+            case 0x9:
+                return (op & 0xF) == 0 ? SKIP : PLAIN;
+            case 0xB:
+                return EXIT;
+            case 0xE:
+                return low == 0x9E || low == 0xA1 ? SKIP : PLAIN;
+            case 0xF:
+                if (low == 0x0A) return WAIT;
+                return low == 0x33 || low == 0x55 ? STORE : PLAIN;
+            default:
+                return PLAIN;
+        }
+    }
+
+    static bool Reachable(uint32_t addr)
+    {
+        return addr + 1 < Constants::MEMSIZE;
+    }
+
+    void Recover()
+    {
+        std::vector<uint16_t> work{ Constants::PROGRAM_LD_ADDR };
+        leader[Constants::PROGRAM_LD_ADDR] = true;
+        auto target = [&](uint32_t addr) {
+            if (Reachable(addr) == false) return;
+            leader[addr] = true;
+            work.push_back(addr);
+        };
+
+        while (work.empty() == false) {
+            uint16_t pc = work.back();
+            work.pop_back();
+            for (; Reachable(pc) && decoded[pc] == false; pc += 2) {
+                decoded[pc] = true;
+                uint16_t op = Opcode(pc);
+                Kind kind = Classify(op);
+                if (kind == PLAIN) continue;
+
+                if (kind == JUMP) target(op & 0xFFF);
+                if (kind == CALL) {
+                    target(op & 0xFFF);
+                    target(pc + 2);
+                }
+                if (kind == SKIP) {
+                    target(pc + 2);
+                    target(pc + 4);
+                }
+                if (kind == WAIT) leader[pc] = true;
+                if (kind == WAIT || kind == STORE) target(pc + 2);
+                break;
+            }
+        }
+    }
+
+    void Split()
+    {
+        block_at.fill(-1);
+        for (uint32_t addr = 0; addr < Constants::MEMSIZE; addr++) {
+            if (leader[addr] == false || decoded[addr] == false) continue;
+            if (Classify(Opcode(addr)) == WAIT) continue;
+
+            Block block{ static_cast<uint16_t>(addr), {} };
+            for (uint32_t pc = addr; Reachable(pc); pc += 2) {
+                if (pc != addr && (leader[pc] || block.ops.size() == MAX_BLOCK))
+                    break;
+                block.ops.push_back(Opcode(pc));
+                if (Classify(block.ops.back()) != PLAIN) break;
+            }
+            block_at[addr] = blocks.size();
+            blocks.push_back(std::move(block));
+        }
+    }
+
+    static std::string Hex(unsigned v, int width)
+    {
+        char buf[16];
+        snprintf(buf, sizeof buf, "0x%0*X", width, v);
+        return buf;
+    }
+
+    static std::string Name(uint16_t addr)
+    {
+        char buf[16];
+        snprintf(buf, sizeof buf, "b_%03X", addr);
+        return buf;
+    }
+
+    static std::string Reg(unsigned r)
+    {
+        char buf[8];
+        snprintf(buf, sizeof buf, "v%X", r);
+        return buf;
+    }
+
+    /* follows blocks that are nothing but a jump, adding one cycle and the
+     * jump's bytes to the checked ranges for each */
+    uint16_t Thread(uint16_t target,
+                    unsigned& cycles,
+                    std::vector<uint16_t>& checked) const
+    {
+        for (int hops = 0; hops < 8 && target < Constants::MEMSIZE; hops++) {
+            int b = block_at[target];
+            if (b < 0 || blocks[b].ops.size() != 1 ||
+                Classify(blocks[b].ops[0]) != JUMP)
+                break;
+            checked.push_back(target);
+            cycles++;
+            target = blocks[b].ops[0] & 0xFFF;
+        }
+        return target;
+    }
+
+    std::string Emit(const Block& block) const
+    {
+        std::array<bool, Constants::REGCNT> used{}, written{};
+        bool index_used = false, index_written = false;
+        for (uint16_t op : block.ops) {
+            unsigned x = op >> 8 & 0xF, y = op >> 4 & 0xF;
+            uint8_t low = op & 0xFF;
+            switch (op >> 12) {
+                case 0x3:
+                case 0x4:
+                    used[x] = true;
+                    break;
+                case 0x5:
+                case 0x9:
+                    used[x] = used[y] = true;
+                    break;
+                case 0x6:
+                case 0x7:
+                case 0xC:
+                    used[x] = written[x] = true;
+                    break;
+                case 0x8:
+                    used[x] = used[y] = written[x] = true;
+                    if ((op & 0xF) >= 4) used[15] = written[15] = true;
+                    break;
+                case 0xA:
+                    index_used = index_written = true;
+                    break;
+                case 0xB:
+                    used[0] = true;
+                    break;
+                case 0xD:
+                    used[x] = used[y] = used[15] = written[15] = true;
+                    index_used = true;
+                    break;
+                case 0xE:
+                    used[x] = true;
+                    break;
+                case 0xF:
+                    used[x] = true;
+                    if (low == 0x07) written[x] = true;
+                    if (low == 0x1E || low == 0x29 || low == 0x33 ||
+                        low == 0x55 || low == 0x65)
+                        index_used = true;
+                    if (low == 0x1E || low == 0x29) index_written = true;
+                    if ((low == 0x55 || low == 0x65) && mode == Quirks::MATT)
+                        index_written = true;
+                    if (low == 0x55 || low == 0x65)
+                        for (unsigned r = 0; r <= x; r++) {
+                            used[r] = true;
+                            if (low == 0x65) written[r] = true;
+                        }
+                    break;
+            }
+        }
+
+        std::string writeback;
+        for (unsigned r = 0; r < Constants::REGCNT; r++)
+            if (written[r])
+                writeback += "V[" + std::to_string(r) + "] = " + Reg(r) + "; ";
+        if (index_written) writeback += "c.SetIndexRegister(I); ";
+
+        /* exits of the block, filled in while emitting the body */
+        bool loops = false;
+        bool stores = Classify(block.ops.back()) == STORE;
+        std::vector<uint16_t> checked;
+        auto leave = [&](uint16_t target, unsigned cycles) {
+            target = Thread(target, cycles, checked);
+            std::string k = std::to_string(cycles);
+            /* a block that stores may have overwritten itself, it goes
+             * back through its own check rather than looping */
+            if (target == block.addr && stores == false) {
+                loops = true;
+                return "n += " + k + "; if (n < budget) continue; " +
+                       writeback + "c.SetPC(" + Hex(target, 3) +
+                       "); return n;";
+            }
+            std::string out =
+              writeback + "c.SetPC(" + Hex(target, 3) + "); ";
+            if (target < Constants::MEMSIZE && block_at[target] >= 0)
+                out += "if (n + " + k + " < budget) return " + Name(target) +
+                       "(c, budget, n + " + k + "); ";
+            return out + "return n + " + k + ";";
+        };
+
+        std::string body;
+        uint16_t pc = block.addr;
+        unsigned count = 0;
+        bool ended = false;
+        for (uint16_t op : block.ops) {
+            count++;
+            std::string X = Reg(op >> 8 & 0xF), Y = Reg(op >> 4 & 0xF);
+            unsigned x = op >> 8 & 0xF;
+            std::string NN = Hex(op & 0xFF, 2), NNN = Hex(op & 0xFFF, 3);
+            uint8_t low = op & 0xFF;
+            std::string line;
+            std::string src = mode == Quirks::MATT ? Y : X;
+
+            switch (op >> 12) {
+                case 0x0:
+                    if (op == 0x00E0) line = "c.reset_display();";
+                    if (op == 0x00EE) {
+                        line = writeback +
+                               "c.SetPC(c.Pop()); return n + " +
+                               std::to_string(count) + ";";
+                        ended = true;
+                    }
+                    break;
+                case 0x1:
+                    line = leave(op & 0xFFF, count);
+                    ended = true;
+                    break;
+                case 0x2:
+                    line = "c.Push(" + Hex(pc + 2, 3) + "); " +
+                           leave(op & 0xFFF, count);
+                    ended = true;
+                    break;
+                case 0x3:
+                case 0x4:
+                case 0x5:
+                case 0x9:
+                case 0xE: {
+                    if (Classify(op) != SKIP) break;
+                    std::string cond;
+                    if (op >> 12 == 0x3) cond = X + " == " + NN;
+                    if (op >> 12 == 0x4) cond = X + " != " + NN;
+                    if (op >> 12 == 0x5) cond = X + " == " + Y;
+                    if (op >> 12 == 0x9) cond = X + " != " + Y;
+                    if (op >> 12 == 0xE) {
+                        cond = std::string{ "c.GetKey(static_cast<KeyCode>(" } +
+                               X + ")) == " +
+                               (low == 0x9E ? "Key::DOWN" : "Key::UP");
+                        line = "c.NoteInputPoll(); ";
+                    }
+                    line += "if (" + cond + ") { " + leave(pc + 4, count) +
+                            " } " + leave(pc + 2, count);
+                    ended = true;
+                    break;
+                }
+                case 0x6:
+                    line = X + " = " + NN + ";";
+                    break;
+                case 0x7:
+                    line = X + " += " + NN + ";";
+                    break;
+                case 0x8: {
+                    std::string ab = "{ uint8_t a = " + X + ", b = " + Y +
+                                     ", s = " + src + "; (void)a; (void)b; "
+                                     "(void)s; ";
+                    switch (op & 0xF) {
+                        case 0x0:
+                            line = X + " = " + Y + ";";
+                            break;
+                        case 0x1:
+                            line = X + " |= " + Y + ";";
+                            break;
+                        case 0x2:
+                            line = X + " &= " + Y + ";";
+                            break;
+                        case 0x3:
+                            line = X + " ^= " + Y + ";";
+                            break;
+                        case 0x4:
+                            line = ab + X + " = a + b; vF = a + b > 0xFF; }";
+                            break;
+                        case 0x5:
+                            line = ab + X + " = a - b; vF = a >= b; }";
+                            break;
+                        case 0x6:
+                            line = ab + X + " = s >> 1; vF = s & 1; }";
+                            break;
+                        case 0x7:
+                            line = ab + X + " = b - a; vF = b >= a; }";
+                            break;
+                        case 0xE:
+                            line = ab + X + " = s << 1; vF = s >> 7; }";
+                            break;
+                    }
+                    break;
+                }
+                case 0xA:
+                    line = "I = " + NNN + ";";
+                    break;
+                case 0xB:
+                    line = writeback + "c.SetPC(v0 + " + NNN +
+                           "); return n + " + std::to_string(count) + ";";
+                    ended = true;
+                    break;
+                case 0xC:
+                    line = X + " = c.InternalRand() & " + NN + ";";
+                    break;
+                case 0xD:
+                    line = "V[" + std::to_string(x) + "] = " + X + "; V[" +
+                           std::to_string(op >> 4 & 0xF) + "] = " + Y +
+                           "; c.SetIndexRegister(I); Instructions::draw(" +
+                           Hex(op, 4) + ", c); vF = V[15];";
+                    break;
+                case 0xF:
+                    switch (low) {
+                        case 0x07:
+                            line = X + " = c.GetDT();";
+                            break;
+                        case 0x15:
+                            line = "c.SetDT(" + X + ");";
+                            break;
+                        case 0x18:
+                            line = "c.SetST(" + X + ");";
+                            break;
+                        case 0x1E:
+                            line = "I += " + X + ";";
+                            break;
+                        case 0x29:
+                            line = "I = (" + X + " & 0xF) * 5;";
+                            break;
+                        case 0x33:
+                            line = "c.SetMemory(I, " + X +
+                                   " / 100); c.SetMemory(I + 1, " + X +
+                                   " / 10 % 10); c.SetMemory(I + 2, " + X +
+                                   " % 10);";
+                            break;
+                        case 0x55:
+                        case 0x65:
+                            for (unsigned r = 0; r <= x; r++)
+                                line += low == 0x55
+                                          ? "c.SetMemory(I + " +
+                                              std::to_string(r) + ", " +
+                                              Reg(r) + "); "
+                                          : Reg(r) + " = c.GetMemory(I + " +
+                                              std::to_string(r) + "); ";
+                            if (mode == Quirks::MATT)
+                                line += "I += " + std::to_string(x + 1) + ";";
+                            break;
+                    }
+                    break;
+            }
+            if (line.empty() == false)
+                body += "/* " + Hex(pc, 3) + ": " + Hex(op, 4) + " */ " + line +
+                        "\n";
+            pc += 2;
+        }
+        if (ended == false)
+            body += leave(pc, count) + "\n";
+
+        std::string indent = loops ? "        " : "    ";
+        for (size_t at = 0; at < body.size(); at = body.find('\n', at) + 1)
+            body.insert(at, indent);
+
+        std::string out =
+          "unsigned\n" + Name(block.addr) + SIGNATURE + "\n{\n";
+        out += "    static constexpr uint8_t code[] = {";
+        for (size_t i = 0; i < block.ops.size() * 2; i++)
+            out += (i ? ", " : " ") + Hex(image[block.addr + i], 2);
+        out += " };\n";
+        out += "    if (std::memcmp(&c.RefMemory()[" + Hex(block.addr, 3) +
+               "], code, sizeof code) != 0) return n;\n";
+        for (uint16_t jump : checked)
+            out += "    if (c.GetMemory(" + Hex(jump, 3) + ") != " +
+                   Hex(image[jump], 2) + " || c.GetMemory(" +
+                   Hex(jump + 1, 3) + ") != " + Hex(image[jump + 1], 2) +
+                   ") return n;\n";
+        out += "    auto& V = c.RefRegisterArray();\n";
+        for (unsigned r = 0; r < Constants::REGCNT; r++)
+            if (used[r])
+                out += "    uint8_t " + Reg(r) + " = V[" + std::to_string(r) +
+                       "];\n";
+        if (index_used) out += "    uint16_t I = c.GetIndexRegister();\n";
+        if (loops)
+            out += "    for (;;) {\n" + body + "    }\n";
+        else
+            out += body;
+        return out + "}\n\n";
+    }
+
+  public:
+    /**
+     * Constructs the AotTranslator and recovers the control flow of a ROM.
+     * @param image the boot image holding the ROM
+     * @param mode the quirks to translate for
+     */
+    AotTranslator(const BootImage& image, Quirks mode)
+      : image{ image }
+      , mode{ mode }
+    {
+        Recover();
+        Split();
+    }
+
+    /**
+     * Returns the number of basic blocks found.
+     */
+    size_t Blocks() const noexcept
+    {
+        return blocks.size();
+    }
+
+    /**
+     * Generates the translation unit, which needs the core headers on its
+     * include path and exports an AotModule as chip8_aot_module.
+     * @return the C++ source
+     */
+    std::string Source() const
+    {
+        std::string out =
+          "/* generated by the chip8 AOT translator, do not edit */\n"
+          "#include \"libchip8++.hpp\"\n"
+          "#include \"libchip8++_aot.hpp\"\n\n"
+          "#include <cstring>\n\n"
+          "using namespace Chip8_core;\n\n"
+          "namespace {\n\n";
+        for (const Block& block : blocks)
+            out += "unsigned\n" + Name(block.addr) + SIGNATURE + ";\n";
+        out += "\n";
+        for (const Block& block : blocks)
+            out += Emit(block);
+
+        out += "constexpr AotBlock BLOCKS[] = {\n";
+        for (const Block& block : blocks)
+            out += "    { " + Hex(block.addr, 3) + ", " + Name(block.addr) +
+                   " },\n";
+        if (blocks.empty()) out += "    { 0, nullptr },\n";
+        out += "};\n\n} // namespace\n\n";
+
+        char buf[64];
+        snprintf(buf,
+                 sizeof buf,
+                 "0x%016llXULL",
+                 static_cast<unsigned long long>(HashImage(image)));
+        out += "extern \"C\" const Chip8_core::AotModule chip8_aot_module{\n"
+               "    Chip8_core::AOT_ENGINE_VERSION,\n"
+               "    sizeof(Chip8_core::system),\n"
+               "    " +
+               std::string{ buf } + ",\n    Chip8_core::Quirks::" +
+               (mode == Quirks::MATT ? "MATT" : "COWGOD") + ",\n    " +
+               std::to_string(blocks.size()) + ",\n    BLOCKS,\n};\n";
+        return out;
+    }
+};
+
+/**
+ * Returns the directory holding the core headers plugins are compiled
+ * against: the CHIP8_AOT_INCLUDE_DIR environment variable when set, which
+ * lets an installed or moved binary find them, otherwise a fallback.
+ * @param fallback usually the CHIP8_AOT_INCLUDE_DIR the build was
+ * configured with
+ */
+inline std::filesystem::path
+AotIncludeDir(const std::filesystem::path& fallback)
+{
+    const char* dir = std::getenv("CHIP8_AOT_INCLUDE_DIR");
+    return dir != nullptr && *dir != '\0' ? std::filesystem::path{ dir }
+                                           : fallback;
+}
+
+/**
+ * Compiles a translated ROM into a plugin with the host compiler. The
+ * compiler is run directly, no shell sees the paths.
+ * @param source the file holding AotTranslator::Source()
+ * @param plugin the shared object to write
+ * @param compiler the C++ compiler to run, looked up in PATH unless it
+ * holds a '/'
+ * @param include_dir the directory holding the core headers, see
+ * AotIncludeDir()
+ * @return whether the compiler succeeded
+ */
+inline bool
+AotCompile(const std::filesystem::path& source,
+           const std::filesystem::path& plugin,
+           const std::string& compiler,
+           const std::filesystem::path& include_dir)
+{
+    std::string args[] = { compiler, "-std=c++20", "-O2", "-shared",
+                           "-fPIC",  "-w",         "-I",  include_dir,
+                           source,   "-o",         plugin };
+    std::vector<char*> argv;
+    for (std::string& arg : args)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawnp(
+          &pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+        return false;
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Runs ROMs through a plugin built from AotTranslator output, falling back
+ * to the interpreter wherever the plugin has no block or a block's code was
+ * overwritten.
+ */
+class AotEngine {
+  private:
+    struct Closer {
+        void operator()(void* handle) const noexcept
+        {
+            dlclose(handle);
+        }
+    };
+
+    /* blocks chain through calls, which the compiler usually but not always
+     * turns into jumps, so the depth of a chain is bounded */
+    static constexpr unsigned MAX_CHAIN = 1024;
+
+    std::unique_ptr<void, Closer> handle;
+    Quirks mode;
+    std::array<AotBlockFn, Constants::MEMSIZE> table{};
+
+    AotEngine(void* handle, const AotModule& module)
+      : handle{ handle }
+      , mode{ module.mode }
+    {
+        for (uint32_t i = 0; i < module.block_count; i++)
+            if (module.blocks[i].run)
+                table[module.blocks[i].addr] = module.blocks[i].run;
+    }
+
+  public:
+    /**
+     * Loads a plugin.
+     * @param plugin path to the shared object
+     * @param image_hash HashImage() of the image the plugin must have been
+     * translated from
+     * @param mode the quirks it must have been translated for
+     * @param error set to the reason on failure
+     * @return the engine, or nullptr if the plugin does not load or does
+     * not match
+     */
+    static std::unique_ptr<AotEngine> Open(const std::filesystem::path& plugin,
+                                           uint64_t image_hash,
+                                           Quirks mode,
+                                           std::string& error)
+    {
+        void* handle = dlopen(plugin.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr) {
+            error = dlerror();
+            return nullptr;
+        }
+        auto* module =
+          static_cast<const AotModule*>(dlsym(handle, "chip8_aot_module"));
+        if (module == nullptr)
+            error = "no chip8_aot_module symbol";
+        else if (module->engine_version != AOT_ENGINE_VERSION ||
+                 module->system_size != sizeof(system))
+            error = "built for another engine version";
+        else if (module->image_hash != image_hash || module->mode != mode)
+            error = "built for another ROM or quirk profile";
+        else
+            return std::unique_ptr<AotEngine>{ new AotEngine{ handle,
+                                                              *module } };
+        dlclose(handle);
+        return nullptr;
+    }
+
+    /**
+     * Runs at least one cycle: the block at PC along with the blocks it
+     * chains into, or a single interpreted cycle.
+     * @param Chip8 the system to run
+     * @param budget the cycle count to stop chaining blocks at
+     * @return the number of cycles run
+     */
+    unsigned Step(system& Chip8, unsigned budget = 1)
+    {
+        AotBlockFn block = table[Chip8.GetPC() & (Constants::MEMSIZE - 1)];
+        if (block != nullptr && Chip8.GetPC() < Constants::MEMSIZE) {
+            unsigned n = block(Chip8, std::min(budget, MAX_CHAIN), 0);
+            if (n != 0) return n;
+        }
+        cycle(Chip8, mode);
+        return 1;
+    }
+
+    /**
+     * Runs a number of cycles, possibly a few more as blocks run whole.
+     * @param Chip8 the system to run
+     * @param cycles the number of cycles to run
+     * @return the number of cycles run
+     */
+    unsigned Run(system& Chip8, unsigned cycles)
+    {
+        unsigned ran = 0;
+        while (ran < cycles)
+            ran += Step(Chip8, cycles - ran);
+        return ran;
+    }
+
+    /**
+     * Returns the quirks the plugin was translated for.
+     */
+    Quirks Mode() const noexcept
+    {
+        return mode;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,260 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_AOTCACHE
+#define BASED_CHIP8_AOTCACHE
+
+#include "libchip8++.hpp"
+#include "libchip8++_aot.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Chip8_core {
+
+/**
+ * An on-disk cache of AOT plugins shared by every process pointed at the same
+ * directory. Entries are named after the ROM image hash, the quirk profile
+ * and AOT_ENGINE_VERSION:
+ *
+ *     <image hash>-<quirks>-v<version>.so    the plugin
+ *     <image hash>-<quirks>-v<version>.sum   its size and checksum
+ *     <image hash>-<quirks>-v<version>.lock  serialises builds
+ *
+ * A plugin is used only after it is mapped read-only and its checksum is
+ * checked against the .sum file, and then only if AotEngine::Open() accepts
+ * it. Builds run under an exclusive flock() on the .lock file. A process
+ * that finds no usable entry takes the lock and checks again before it
+ * builds, so a farm of processes starting on the same ROM compiles it once.
+ * Finished files are written under temporary names and renamed into place,
+ * the plugin first and the .sum last. A reader therefore sees either a
+ * complete entry, or a mismatch it settles by waiting on the lock. Stale and
+ * corrupt entries are never deleted, the rebuild is renamed over them.
+ */
+class AotCache {
+  private:
+    std::filesystem::path dir;
+    std::string compiler;
+    std::filesystem::path include_dir;
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> builds{ 0 };
+    std::atomic<uint64_t> rejected{ 0 };
+
+    /* FNV-1a a byte at a time, plugins are small and checked once per load */
+    static uint64_t Checksum(const uint8_t* data, size_t size) noexcept
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ data[i]) * 0x100000001b3ULL;
+        return hash ^ (hash >> 33);
+    }
+
+    /* size and checksum of a file mapped read-only, false if unreadable */
+    static bool Measure(const std::filesystem::path& file,
+                        size_t& size,
+                        uint64_t& checksum) noexcept
+    {
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+        void* map = MAP_FAILED;
+        if (ok) map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return false;
+
+        size = st.st_size;
+        checksum = Checksum(static_cast<const uint8_t*>(map), size);
+        munmap(map, size);
+        return true;
+    }
+
+    std::filesystem::path Stem(uint64_t image_hash, Quirks mode) const
+    {
+        char name[64];
+        snprintf(name,
+                 sizeof name,
+                 "%016llX-%s-v%u",
+                 static_cast<unsigned long long>(image_hash),
+                 mode == Quirks::MATT ? "matt" : "cowgod",
+                 AOT_ENGINE_VERSION);
+        return dir / name;
+    }
+
+    static std::filesystem::path With(std::filesystem::path stem,
+                                      const char* ext)
+    {
+        return stem += ext;
+    }
+
+    /* opens an entry if its checksum and module header check out */
+    static std::unique_ptr<AotEngine> Open(const std::filesystem::path& stem,
+                                           uint64_t image_hash,
+                                           Quirks mode,
+                                           std::string& error)
+    {
+        size_t want_size = 0;
+        unsigned long long want_sum = 0;
+        std::ifstream sum{ With(stem, ".sum") };
+        if (!(sum >> want_size >> std::hex >> want_sum)) {
+            error = "no checksum";
+            return nullptr;
+        }
+
+        size_t size;
+        uint64_t checksum;
+        if (Measure(With(stem, ".so"), size, checksum) == false) {
+            error = "plugin unreadable";
+            return nullptr;
+        }
+        if (size != want_size || checksum != want_sum) {
+            error = "checksum mismatch";
+            return nullptr;
+        }
+        return AotEngine::Open(With(stem, ".so"), image_hash, mode, error);
+    }
+
+    bool Build(const std::filesystem::path& stem,
+               const BootImage& image,
+               Quirks mode,
+               std::string& error)
+    {
+        std::string tmp = ".tmp" + std::to_string(getpid());
+        std::filesystem::path source = With(stem, (tmp + ".cpp").c_str());
+        std::filesystem::path plugin = With(stem, (tmp + ".so").c_str());
+        std::filesystem::path sum = With(stem, (tmp + ".sum").c_str());
+        std::error_code ignored;
+
+        std::ofstream{ source } << AotTranslator{ image, mode }.Source();
+        bool built = AotCompile(source, plugin, compiler, include_dir);
+        std::filesystem::remove(source, ignored);
+
+        size_t size;
+        uint64_t checksum;
+        if (built == false || Measure(plugin, size, checksum) == false) {
+            std::filesystem::remove(plugin, ignored);
+            error = "compiling the translation failed";
+            return false;
+        }
+
+        std::ofstream{ sum } << size << ' ' << std::hex << checksum << '\n';
+        std::filesystem::rename(plugin, With(stem, ".so"), ignored);
+        std::filesystem::rename(sum, With(stem, ".sum"), ignored);
+        builds++;
+        return true;
+    }
+
+  public:
+    /**
+     * Constructs the AotCache, creating the directory if needed.
+     * @param dir the cache directory
+     * @param compiler the C++ compiler to build missing entries with
+     * @param include_dir the directory holding the core headers, see
+     * AotIncludeDir()
+     */
+    AotCache(std::filesystem::path dir,
+             std::string compiler,
+             std::filesystem::path include_dir)
+      : dir{ std::move(dir) }
+      , compiler{ std::move(compiler) }
+      , include_dir{ std::move(include_dir) }
+    {
+        std::error_code ignored;
+        std::filesystem::create_directories(this->dir, ignored);
+    }
+
+    /**
+     * Returns an engine for a ROM, translating and compiling it first unless
+     * this or another process already did.
+     * @param image the boot image holding the ROM
+     * @param mode the quirks to run under
+     * @param error set to the reason on failure
+     * @return the engine, or nullptr if it could not be built or loaded
+     */
+    std::unique_ptr<AotEngine> Get(const BootImage& image,
+                                   Quirks mode,
+                                   std::string& error)
+    {
+        uint64_t image_hash = HashImage(image);
+        std::filesystem::path stem = Stem(image_hash, mode);
+
+        if (auto engine = Open(stem, image_hash, mode, error)) {
+            hits++;
+            return engine;
+        }
+
+        int lock = open(With(stem, ".lock").c_str(),
+                        O_RDWR | O_CREAT | O_CLOEXEC,
+                        0644);
+        if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+            if (lock >= 0) close(lock);
+            error = "cannot lock cache entry";
+            return nullptr;
+        }
+
+        /* someone may have finished building while we waited */
+        auto engine = Open(stem, image_hash, mode, error);
+        if (engine)
+            hits++;
+        else {
+            std::error_code ignored;
+            if (std::filesystem::exists(With(stem, ".sum"), ignored))
+                rejected++;
+            if (Build(stem, image, mode, error))
+                engine = Open(stem, image_hash, mode, error);
+        }
+        close(lock);
+        return engine;
+    }
+
+    /**
+     * Returns the number of Get() calls served from disk.
+     */
+    uint64_t Hits() const noexcept
+    {
+        return hits;
+    }
+
+    /**
+     * Returns the number of plugins this instance compiled.
+     */
+    uint64_t Builds() const noexcept
+    {
+        return builds;
+    }
+
+    /**
+     * Returns the number of stale or corrupt entries that were rebuilt.
+     */
+    uint64_t Rejected() const noexcept
+    {
+        return rejected;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,187 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_BATCH
+#define BASED_CHIP8_BATCH
+
+#include "libchip8++.hpp"
+
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * Steps many independent instances. Instances are run in groups of up to 8
+ * that take turns one instruction at a time, so the out-of-order core can
+ * overlap the dependency chains of several machines instead of waiting on
+ * one. Before a group starts, the registers, stack and PC of the group after
+ * next and the code at PC of the next group are prefetched. That hides most
+ * of the cache misses once there are too many instances for them to stay in
+ * L2, and the code prefetch reads a PC that is already in cache.
+ */
+class Batch {
+  private:
+    std::vector<system*> machines;
+    Quirks mode;
+    unsigned group;
+    bool prefetch;
+
+    /* the registers, stack and scalars sit next to each other */
+    static void PrefetchState(system& Chip8) noexcept
+    {
+        __builtin_prefetch(Chip8.RefStack().data(), 1, 3);
+        __builtin_prefetch(Chip8.RefRegisterArray().data(), 1, 3);
+    }
+
+    static void PrefetchCode(system& Chip8) noexcept
+    {
+        uint16_t pc = Chip8.GetPC() & (Constants::MEMSIZE - 1);
+        __builtin_prefetch(Chip8.RefMemory().data() + pc, 0, 3);
+    }
+
+    template<unsigned G>
+    void RunGroups(unsigned cycles, bool tick)
+    {
+        size_t n = machines.size();
+        for (size_t base = 0; base < n; base += G) {
+            unsigned size = n - base < G ? n - base : G;
+            if (prefetch) {
+                for (size_t i = base + G; i < base + 2 * G && i < n; i++)
+                    PrefetchCode(*machines[i]);
+                for (size_t i = base + 2 * G; i < base + 3 * G && i < n; i++)
+                    PrefetchState(*machines[i]);
+            }
+
+            system* live[G];
+            for (unsigned j = 0; j < size; j++)
+                live[j] = machines[base + j];
+            if (tick)
+                for (unsigned j = 0; j < size; j++)
+                    live[j]->ClearInputPolls();
+            if (size == G)
+                for (unsigned c = 0; c < cycles; c++)
+                    for (unsigned j = 0; j < G; j++)
+                        cycle(*live[j], mode);
+            else
+                for (unsigned c = 0; c < cycles; c++)
+                    for (unsigned j = 0; j < size; j++)
+                        cycle(*live[j], mode);
+            if (tick)
+                for (unsigned j = 0; j < size; j++)
+                    tick_timers(*live[j]);
+        }
+    }
+
+    void Dispatch(unsigned cycles, bool tick)
+    {
+        switch (group) {
+            case 1:
+                RunGroups<1>(cycles, tick);
+                break;
+            case 2:
+                RunGroups<2>(cycles, tick);
+                break;
+            case 4:
+                RunGroups<4>(cycles, tick);
+                break;
+            default:
+                RunGroups<8>(cycles, tick);
+                break;
+        }
+    }
+
+  public:
+    /**
+     * Constructs the Batch.
+     * @param mode the quirks every instance follows
+     * @param group instances interleaved at a time, rounded down to 1, 2, 4
+     * or 8. 1 steps instances one after the other.
+     * @param prefetch whether to prefetch the next group
+     */
+    Batch(Quirks mode, unsigned group = 4, bool prefetch = true)
+      : mode{ mode }
+      , group{ group >= 8 ? 8u : group >= 4 ? 4u : group >= 2 ? 2u : 1u }
+      , prefetch{ prefetch }
+    {
+    }
+
+    /**
+     * Adds an instance, which must outlive the Batch or be removed first.
+     * @param Chip8 the instance to add
+     */
+    void Add(system& Chip8)
+    {
+        machines.push_back(&Chip8);
+    }
+
+    /**
+     * Removes every instance.
+     */
+    void Clear() noexcept
+    {
+        machines.clear();
+    }
+
+    /**
+     * Returns the number of instances.
+     */
+    size_t Size() const noexcept
+    {
+        return machines.size();
+    }
+
+    /**
+     * Returns an instance in the order it was added.
+     * @param idx index of the instance
+     */
+    system& operator[](size_t idx) noexcept
+    {
+        return *machines[idx];
+    }
+
+    /**
+     * Runs every instance for a number of cycles.
+     * @param cycles the number of cycles each instance runs
+     */
+    void Run(unsigned cycles)
+    {
+        Dispatch(cycles, false);
+    }
+
+    /**
+     * Runs one frame on every instance, see Chip8_core::frame().
+     * @param cycles_per_frame the number of cycles per frame
+     */
+    void Frame(unsigned cycles_per_frame)
+    {
+        Dispatch(cycles_per_frame, true);
+    }
+
+    /**
+     * Tells whether an instance read the keypad during the last Frame().
+     * Frames that did not are lag frames, any input would have given the
+     * same result.
+     * @param idx index of the instance
+     */
+    bool InputRead(size_t idx) const noexcept
+    {
+        return machines[idx]->InputPolled();
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
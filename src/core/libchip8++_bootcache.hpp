@@ -0,0 +1,247 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_BOOTCACHE
+#define BASED_CHIP8_BOOTCACHE
+
+#include "libchip8++.hpp"
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace Chip8_core {
+
+/**
+ * The state a ROM reaches right before its first impure instruction.
+ * @see Instructions::is_impure()
+ */
+struct BootState {
+    system state;    /**< The machine, ready to execute the impure instruction. */
+    unsigned cycles; /**< The number of cycles it took to get there. */
+    unsigned phase;  /**< The cycles already run of the current frame. */
+};
+
+/**
+ * Caches the deterministic warm-up of ROMs. Most ROMs spend their first
+ * thousands of cycles clearing the screen and setting up tables, identically
+ * on every start. The first start of a ROM runs it up to its first impure
+ * instruction and keeps that state, later starts copy it.
+ * A cache made for frame() driven instances ticks the timers once every
+ * cycles_per_frame cycles of the warm-up, like frame() would. The warm-up
+ * usually stops in the middle of a frame, so such instances have to run
+ * FinishFrame() before going on with frame(). A cache made with
+ * cycles_per_frame 0 never ticks the timers and suits cycle() driven
+ * instances only.
+ * States are keyed by ROM image hash, quirks and colors (drawing stores the
+ * colors in the display). The cache is safe to share between threads.
+ */
+class BootCache {
+  private:
+    struct Key {
+        uint64_t image_hash;
+        Quirks mode;
+        uint32_t foreground;
+        uint32_t background;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const noexcept
+        {
+            uint64_t h = k.image_hash ^ (uint64_t{ k.foreground } << 32 |
+                                         k.background);
+            return h * 0x9E3779B97F4A7C15ULL + k.mode;
+        }
+    };
+
+    unsigned budget;
+    unsigned cycles_per_frame;
+    mutable std::shared_mutex lock;
+    std::unordered_map<Key, std::unique_ptr<const BootState>, KeyHash> states;
+
+  public:
+    /**
+     * Constructs the BootCache.
+     * @param budget maximum number of cycles to warm a ROM up for, keeps
+     * ROMs that never touch input, like demos, from running forever
+     * @param cycles_per_frame the cycles per frame() of the instances
+     * started, 0 if they are driven through cycle() alone
+     */
+    explicit BootCache(unsigned budget = 1'000'000,
+                       unsigned cycles_per_frame = 0)
+      : budget{ budget }
+      , cycles_per_frame{ cycles_per_frame }
+    {
+    }
+
+    /**
+     * Runs a system until the next instruction is impure or the budget runs
+     * out, starting at the beginning of a frame.
+     * @param Chip8 the system to run
+     * @param mode the quirks to follow
+     * @param budget maximum number of cycles to run
+     * @param cycles_per_frame tick the timers after every this many cycles,
+     * 0 to never tick them
+     * @return the number of cycles run, the frame phase is this modulo
+     * cycles_per_frame
+     */
+    static constexpr unsigned WarmUp(system& Chip8,
+                                     Quirks mode,
+                                     unsigned budget,
+                                     unsigned cycles_per_frame = 0)
+    {
+        unsigned cycles = 0, phase = 0;
+        while (cycles < budget && !Instructions::is_impure(Chip8.Peek())) {
+            cycle(Chip8, mode);
+            cycles++;
+            if (cycles_per_frame != 0 && ++phase == cycles_per_frame) {
+                tick_timers(Chip8);
+                phase = 0;
+            }
+        }
+        return cycles;
+    }
+
+    /**
+     * Runs the rest of the frame a warm-up stopped in, after which frame()
+     * picks up where a frame() driven instance would be.
+     * @param Chip8 the system started from a BootState
+     * @param mode the quirks to follow
+     * @param phase BootState::phase
+     * @param cycles_per_frame the cycles per frame the state was warmed up
+     * with
+     */
+    static constexpr void FinishFrame(system& Chip8,
+                                      Quirks mode,
+                                      unsigned phase,
+                                      unsigned cycles_per_frame)
+    {
+        if (phase == 0) return;
+        Chip8.ClearInputPolls();
+        for (unsigned i = phase; i < cycles_per_frame; i++)
+            cycle(Chip8, mode);
+        tick_timers(Chip8);
+    }
+
+    /**
+     * Returns the cycles per frame states are warmed up with.
+     */
+    unsigned CyclesPerFrame() const noexcept
+    {
+        return cycles_per_frame;
+    }
+
+    /**
+     * Returns the warmed up state for a ROM, warming it up on first use.
+     * @param image the boot image holding the ROM
+     * @param image_hash HashImage(image), computed once by the caller
+     * @param mode the quirks to follow
+     * @param foreground foreground color to draw with
+     * @param background background color to draw with
+     * @return the cached state, valid for as long as the cache lives
+     */
+    const BootState& Get(const BootImage& image,
+                         uint64_t image_hash,
+                         Quirks mode,
+                         uint32_t foreground = 0xffffffff,
+                         uint32_t background = 0x0)
+    {
+        Key key{ image_hash, mode, foreground, background };
+        {
+            std::shared_lock reader{ lock };
+            auto it = states.find(key);
+            if (it != states.end()) return *it->second;
+        }
+
+        /* warm up outside the lock, racing threads may both do the work but
+         * only the first result is kept */
+        auto warm = std::make_unique<BootState>(
+          BootState{ system{ image, 0, foreground, background }, 0, 0 });
+        warm->cycles = WarmUp(warm->state, mode, budget, cycles_per_frame);
+        if (cycles_per_frame != 0)
+            warm->phase = warm->cycles % cycles_per_frame;
+
+        std::unique_lock writer{ lock };
+        return *states.try_emplace(key, std::move(warm)).first->second;
+    }
+
+    /**
+     * Starts a new instance of a ROM from its warmed up state.
+     * @param image the boot image holding the ROM
+     * @param image_hash HashImage(image), computed once by the caller
+     * @param mode the quirks to follow
+     * @param seed the value to seed the instance's random engine with
+     * @param foreground foreground color to draw with
+     * @param background background color to draw with
+     * @return a system equivalent to a fresh one run up to its first impure
+     * instruction, in the middle of a frame unless the cache was made with
+     * cycles_per_frame 0, see FinishFrame()
+     */
+    system Start(const BootImage& image,
+                 uint64_t image_hash,
+                 Quirks mode,
+                 uint32_t seed,
+                 uint32_t foreground = 0xffffffff,
+                 uint32_t background = 0x0)
+    {
+        system Chip8 =
+          Get(image, image_hash, mode, foreground, background).state;
+        Chip8.Seed(seed);
+        return Chip8;
+    }
+
+    /**
+     * Starts a new instance of a ROM from its warmed up state, hashing the
+     * image on every call.
+     * @see Start(const BootImage&, uint64_t, Quirks, uint32_t, uint32_t,
+     * uint32_t)
+     */
+    system Start(const BootImage& image,
+                 Quirks mode,
+                 uint32_t seed,
+                 uint32_t foreground = 0xffffffff,
+                 uint32_t background = 0x0)
+    {
+        return Start(
+          image, HashImage(image), mode, seed, foreground, background);
+    }
+
+    /**
+     * Returns the number of cached states.
+     */
+    size_t Size() const
+    {
+        std::shared_lock reader{ lock };
+        return states.size();
+    }
+
+    /**
+     * Drops every cached state, references returned by Get() dangle
+     * afterwards.
+     */
+    void Clear()
+    {
+        std::unique_lock writer{ lock };
+        states.clear();
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,405 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_CHECKPOINT
+#define BASED_CHIP8_CHECKPOINT
+
+#include "libchip8++.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Chip8_core {
+
+/**
+ * Keeps the state of a whole farm of instances in a memory mapped file, so
+ * resuming is a mmap() with nothing to parse.
+ *
+ * The file holds two header pages, two copy maps and two copies of every
+ * record, a record being a system laid out as in memory. A header names an
+ * epoch and the copy map next to it, one bit per record telling which copy
+ * holds the record's state as of that epoch. Instances run in the other
+ * copy. The first access to a record after a commit copies the committed
+ * state over. Sync() msync()s the records accessed since the last commit,
+ * then writes the next copy map, with their bits flipped, next to the header
+ * page the last commit did not use. Commit() syncs, then writes the next
+ * epoch into that header page and syncs it. Records nobody accessed are
+ * neither copied nor written, they stay where the previous map says. A crash
+ * at any point leaves one valid header whose map and copies were fully
+ * written before it was. Open() picks the valid header with the highest
+ * epoch. Records are refused if system was laid out differently when they
+ * were written, see SYSTEM_LAYOUT_VERSION.
+ */
+class Checkpoint {
+  private:
+    static constexpr uint64_t MAGIC = 0x54504b4338504843ULL; /* CHP8CKPT */
+    /* file format in the upper half, system layout in the lower */
+    static constexpr uint32_t VERSION = 2 << 16 | SYSTEM_LAYOUT_VERSION;
+
+    static_assert(std::is_trivially_copyable_v<system>);
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t count;
+        uint64_t epoch;
+        uint64_t map_check; /* HashMap() of the copy map */
+        uint64_t check;
+
+        uint64_t Check() const noexcept
+        {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (uint64_t v : { magic,
+                                uint64_t{ version } << 32 | record_size,
+                                count,
+                                epoch,
+                                map_check })
+                h = (h ^ v) * 0x100000001b3ULL;
+            return h;
+        }
+
+        bool Valid(size_t want_record) const noexcept
+        {
+            return magic == MAGIC && version == VERSION &&
+                   record_size == want_record && check == Check();
+        }
+    };
+
+    static constexpr size_t RECORD = (sizeof(system) + 63) / 64 * 64;
+
+    int fd;
+    std::byte* map;
+    size_t map_size;
+    size_t page;
+    size_t count;
+    size_t map_span;
+    uint64_t epoch;
+    /* copy holding the committed state of each record */
+    std::vector<uint64_t> home;
+    /* records of the working copy brought up to date since the last commit */
+    std::vector<uint64_t> fresh;
+
+    static size_t Words(size_t count) noexcept
+    {
+        return (count + 63) / 64;
+    }
+
+    static size_t MapSpan(size_t count) noexcept
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        return (Words(count) * sizeof(uint64_t) + page - 1) / page * page;
+    }
+
+    static size_t FileSize(size_t count) noexcept
+    {
+        return 2 * sysconf(_SC_PAGESIZE) + 2 * MapSpan(count) +
+               2 * count * RECORD;
+    }
+
+    std::byte* Record(size_t copy, size_t idx) const noexcept
+    {
+        return map + 2 * page + 2 * map_span + (copy * count + idx) * RECORD;
+    }
+
+    Header* HeaderPage(uint64_t of_epoch) const noexcept
+    {
+        return reinterpret_cast<Header*>(map + (of_epoch % 2) * page);
+    }
+
+    uint64_t* CopyMap(uint64_t of_epoch) const noexcept
+    {
+        return reinterpret_cast<uint64_t*>(map + 2 * page +
+                                           (of_epoch % 2) * map_span);
+    }
+
+    uint64_t HashMap(uint64_t of_epoch) const noexcept
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t w = 0; w < Words(count); w++)
+            h = (h ^ CopyMap(of_epoch)[w]) * 0x100000001b3ULL;
+        return h;
+    }
+
+    size_t Home(size_t idx) const noexcept
+    {
+        return home[idx / 64] >> (idx % 64) & 1;
+    }
+
+    bool Touched(size_t idx) const noexcept
+    {
+        return fresh[idx / 64] >> (idx % 64) & 1;
+    }
+
+    /* syncs the pages holding [first, last) */
+    bool SyncRange(const std::byte* first, const std::byte* last) const
+    {
+        auto from = reinterpret_cast<uintptr_t>(first) & ~uintptr_t(page - 1);
+        auto to = reinterpret_cast<uintptr_t>(last);
+        return msync(reinterpret_cast<void*>(from), to - from, MS_SYNC) == 0;
+    }
+
+    bool WriteHeader(uint64_t of_epoch)
+    {
+        Header header{
+            MAGIC, VERSION, RECORD, count, of_epoch, HashMap(of_epoch), 0
+        };
+        header.check = header.Check();
+        std::memcpy(HeaderPage(of_epoch), &header, sizeof header);
+        if (msync(HeaderPage(of_epoch), page, MS_SYNC) == 0) return true;
+        /* the records it names keep changing, so the page must not reach
+         * the disk as a valid header later on */
+        std::memset(HeaderPage(of_epoch), 0, sizeof header);
+        return false;
+    }
+
+    Checkpoint(int fd, std::byte* map, size_t map_size, size_t count)
+      : fd{ fd }
+      , map{ map }
+      , map_size{ map_size }
+      , page{ static_cast<size_t>(sysconf(_SC_PAGESIZE)) }
+      , count{ count }
+      , map_span{ MapSpan(count) }
+      , epoch{ 0 }
+      , home(Words(count), 0)
+      , fresh(Words(count), 0)
+    {
+    }
+
+    static std::byte* Map(int fd, size_t size)
+    {
+        void* map =
+          mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        return map == MAP_FAILED ? nullptr : static_cast<std::byte*>(map);
+    }
+
+  public:
+    /**
+     * Creates a checkpoint file, replacing any file at the path, with every
+     * instance starting from the same state as epoch 0.
+     * @param file path of the file
+     * @param count the number of instances
+     * @param initial the state every instance starts from
+     * @param error set to the reason on failure
+     * @return the checkpoint, or nullptr on failure
+     */
+    static std::unique_ptr<Checkpoint> Create(const std::filesystem::path& file,
+                                              size_t count,
+                                              const system& initial,
+                                              std::string& error)
+    {
+        int fd =
+          open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, FileSize(count)) != 0) {
+            error = "cannot create " + file.string();
+            if (fd >= 0) close(fd);
+            return nullptr;
+        }
+        std::byte* map = Map(fd, FileSize(count));
+        if (map == nullptr) {
+            error = "cannot map " + file.string();
+            close(fd);
+            return nullptr;
+        }
+
+        /* the file starts out zero, so both copy maps say copy 0 */
+        std::unique_ptr<Checkpoint> ckpt{
+            new Checkpoint{ fd, map, FileSize(count), count }
+        };
+        for (size_t i = 0; i < count; i++)
+            std::memcpy(ckpt->Record(0, i), &initial, sizeof(system));
+        if (msync(map, FileSize(count), MS_SYNC) != 0 ||
+            ckpt->WriteHeader(0) == false) {
+            error = "cannot write " + file.string();
+            return nullptr;
+        }
+        return ckpt;
+    }
+
+    /**
+     * Opens a checkpoint file at its last committed epoch.
+     * @param file path of the file
+     * @param error set to the reason on failure
+     * @return the checkpoint, or nullptr if the file is missing, was
+     * written by another build or has no valid header
+     */
+    static std::unique_ptr<Checkpoint> Open(const std::filesystem::path& file,
+                                            std::string& error)
+    {
+        int fd = open(file.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            error = "cannot open " + file.string();
+            if (fd >= 0) close(fd);
+            return nullptr;
+        }
+
+        /* read both headers first, the size comes from them */
+        Header headers[2];
+        size_t page = sysconf(_SC_PAGESIZE);
+        const Header* any = nullptr;
+        for (int h = 0; h < 2; h++) {
+            if (pread(fd, &headers[h], sizeof(Header), h * page) !=
+                  sizeof(Header) ||
+                headers[h].Valid(RECORD) == false ||
+                FileSize(headers[h].count) != size_t(st.st_size)) {
+                headers[h].magic = 0;
+                continue;
+            }
+            any = &headers[h];
+        }
+        if (any == nullptr) {
+            error = "no valid header in " + file.string();
+            close(fd);
+            return nullptr;
+        }
+
+        std::byte* map = Map(fd, st.st_size);
+        if (map == nullptr) {
+            error = "cannot map " + file.string();
+            close(fd);
+            return nullptr;
+        }
+        std::unique_ptr<Checkpoint> ckpt{
+            new Checkpoint{ fd, map, size_t(st.st_size), any->count }
+        };
+
+        /* a header only counts along with the copy map it names */
+        const Header* best = nullptr;
+        for (const Header& h : headers)
+            if (h.magic == MAGIC && h.map_check == ckpt->HashMap(h.epoch) &&
+                (best == nullptr || h.epoch > best->epoch))
+                best = &h;
+        if (best == nullptr) {
+            error = "no valid header in " + file.string();
+            return nullptr;
+        }
+        ckpt->epoch = best->epoch;
+        std::memcpy(ckpt->home.data(),
+                    ckpt->CopyMap(best->epoch),
+                    Words(ckpt->count) * sizeof(uint64_t));
+        return ckpt;
+    }
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    ~Checkpoint()
+    {
+        munmap(map, map_size);
+        close(fd);
+    }
+
+    /**
+     * Returns an instance to run, living in the file. Uncommitted changes to
+     * it are lost if the process dies. The reference is good until the next
+     * Commit().
+     * @param idx index of the instance
+     */
+    system& operator[](size_t idx) noexcept
+    {
+        std::byte* working = Record(Home(idx) ^ 1, idx);
+        if (Touched(idx) == false) {
+            std::memcpy(working, Record(Home(idx), idx), sizeof(system));
+            fresh[idx / 64] |= uint64_t{ 1 } << (idx % 64);
+        }
+        return *std::launder(reinterpret_cast<system*>(working));
+    }
+
+    /**
+     * Writes the instances accessed since the last commit and the copy map
+     * naming them to the file, without committing them. The last committed
+     * epoch stays the one Open() finds until Commit(), which syncs again
+     * and only has the pages written since left to do.
+     * @return false if the file could not be written
+     */
+    bool Sync()
+    {
+        /* records next to each other in the same copy share pages, sync
+         * them as one run */
+        const std::byte* run_first = nullptr;
+        const std::byte* run_last = nullptr;
+        for (size_t i = 0; i < count; i++) {
+            if (Touched(i) == false) continue;
+            const std::byte* rec = Record(Home(i) ^ 1, i);
+            if (rec != run_last) {
+                if (run_first && SyncRange(run_first, run_last) == false)
+                    return false;
+                run_first = rec;
+            }
+            run_last = rec + sizeof(system);
+        }
+        if (run_first && SyncRange(run_first, run_last) == false) return false;
+
+        uint64_t* next = CopyMap(epoch + 1);
+        for (size_t w = 0; w < Words(count); w++)
+            next[w] = home[w] ^ fresh[w];
+        return Words(count) == 0 ||
+               SyncRange(reinterpret_cast<std::byte*>(next),
+                         reinterpret_cast<std::byte*>(next + Words(count)));
+    }
+
+    /**
+     * Makes the current state of every instance durable as the next epoch.
+     * Only the instances accessed since the previous commit are written,
+     * the others keep their state where it is.
+     * @return false if the file could not be written, the last committed
+     * epoch then stays the current one and the next Commit() tries again
+     */
+    bool Commit()
+    {
+        if (Sync() == false || WriteHeader(epoch + 1) == false) return false;
+
+        epoch++;
+        for (size_t w = 0; w < Words(count); w++)
+            home[w] ^= fresh[w];
+        std::fill(fresh.begin(), fresh.end(), 0);
+        return true;
+    }
+
+    /**
+     * Returns the number of instances.
+     */
+    size_t Size() const noexcept
+    {
+        return count;
+    }
+
+    /**
+     * Returns the last committed epoch, 0 right after Create().
+     */
+    uint64_t Epoch() const noexcept
+    {
+        return epoch;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,234 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_CONFORMANCE
+#define BASED_CHIP8_CONFORMANCE
+
+#include "libchip8++.hpp"
+#include "libchip8++_aot.hpp"
+#include "libchip8++_aotcache.hpp"
+#include "libchip8++_batch.hpp"
+#include "libchip8++_memo.hpp"
+#include "libchip8++_reference.hpp"
+#include "libchip8++_workers.hpp"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * The display packed to one bit per pixel, row major with the leftmost
+ * pixel in the most significant bit. Compact enough to keep golden images
+ * of test ROMs in the tree.
+ */
+using PackedFrame =
+  std::array<uint8_t, Constants::DISPW * Constants::DISPH / 8>;
+
+/**
+ * Packs the display of a system, see system::IsLit().
+ * @param Chip8 the system to read
+ * @return the packed display
+ */
+constexpr PackedFrame
+PackDisplay(system& Chip8)
+{
+    PackedFrame packed{};
+    /* branch free so the compiler can test eight pixels at once */
+    for (uint16_t i = 0; i < packed.size(); i++) {
+        uint8_t bits = 0;
+        for (uint16_t b = 0; b < 8; b++)
+            bits = bits << 1 | Chip8.IsLit(i * 8 + b);
+        packed[i] = bits;
+    }
+    return packed;
+}
+
+/**
+ * Contains named constants for the ways a ROM can be executed, which must
+ * all agree with each other.
+ */
+enum Engine {
+    INTERPRETER,       /**< cycle() one instruction at a time. */
+    SUBROUTINE_MEMO,   /**< SubroutineMemo::Step(). */
+    AOT_ENGINE,        /**< AotEngine::Step() on a plugin from an AotCache. */
+    INTERLEAVED_BATCH, /**< Copies of the case stepped by a Batch. */
+    REFERENCE_IMPL,    /**< Reference::execute(), the goldens come from it. */
+};
+
+/** Every quirk profile, conformance cases are usually run under each. */
+inline constexpr std::array<Quirks, 2> QUIRK_PROFILES{ Quirks::MATT,
+                                                       Quirks::COWGOD };
+
+/** Every engine, see Engine. */
+inline constexpr std::array<Engine, 5> ENGINES{ Engine::INTERPRETER,
+                                                Engine::SUBROUTINE_MEMO,
+                                                Engine::AOT_ENGINE,
+                                                Engine::INTERLEAVED_BATCH,
+                                                Engine::REFERENCE_IMPL };
+
+/**
+ * A key being pressed or released at the start of a frame.
+ */
+struct KeyEvent {
+    unsigned frame; /**< Frame number, counted from zero. */
+    KeyCode key;    /**< The key. */
+    uint8_t state;  /**< Key::UP or Key::DOWN. */
+};
+
+/**
+ * A test ROM run headlessly for a number of frames, along with the display
+ * it is expected to end on.
+ */
+struct ConformanceCase {
+    std::string name;          /**< Shown in reports. */
+    BootImage image;           /**< Font and ROM. */
+    Quirks mode;               /**< Quirks to run with. */
+    unsigned frames;           /**< Frames to run for. */
+    unsigned cycles_per_frame; /**< See frame(). */
+    /** Memory writes before the first cycle, test suites read some of
+     * these to skip their menus. */
+    std::vector<std::pair<uint16_t, uint8_t>> pokes;
+    std::vector<KeyEvent> input; /**< Keypad input. */
+    PackedFrame golden;          /**< Expected display. */
+};
+
+/* applies the key events of a frame */
+inline void
+PressKeys(const ConformanceCase& test, unsigned f, system& Chip8)
+{
+    for (const KeyEvent& event : test.input)
+        if (event.frame == f) Chip8.SetKey(event.key, event.state);
+}
+
+/* a full group of the batch and a partial one, both code paths run */
+inline constexpr size_t BATCH_COPIES = 7;
+
+/**
+ * Runs a conformance case on an engine.
+ * @param test the case to run
+ * @param engine the engine to run it on
+ * @param aot the plugin built for the case's image and quirks, needed by
+ * Engine::AOT_ENGINE only
+ * @return the display the ROM ended on
+ */
+inline PackedFrame
+RunCase(const ConformanceCase& test, Engine engine, AotEngine* aot = nullptr)
+{
+    system chip8{ test.image, 0 };
+    for (auto [addr, v] : test.pokes)
+        chip8.SetMemory(addr, v);
+
+    if (engine == Engine::INTERLEAVED_BATCH) {
+        std::vector<system> copies(BATCH_COPIES, chip8);
+        Batch batch{ test.mode, 4 };
+        for (system& copy : copies)
+            batch.Add(copy);
+        for (unsigned f = 0; f < test.frames; f++) {
+            for (system& copy : copies)
+                PressKeys(test, f, copy);
+            batch.Frame(test.cycles_per_frame);
+        }
+        /* a copy that went its own way fails the comparison */
+        PackedFrame first = PackDisplay(copies[0]);
+        for (system& copy : copies)
+            if (PackDisplay(copy) != first) return PackDisplay(copy);
+        return first;
+    }
+
+    SubroutineMemo memo{ test.mode };
+    /* the memo steps over whole calls and plugins run whole blocks, cycles
+     * run past the end of a frame are taken off the next one */
+    unsigned overrun = 0;
+
+    for (unsigned f = 0; f < test.frames; f++) {
+        PressKeys(test, f, chip8);
+
+        unsigned ran = overrun;
+        switch (engine) {
+            case Engine::INTERPRETER:
+                frame(chip8, test.mode, test.cycles_per_frame);
+                continue;
+            case Engine::REFERENCE_IMPL:
+                for (; ran < test.cycles_per_frame; ran++)
+                    Reference::execute(test.mode, chip8.Fetch(), chip8);
+                break;
+            case Engine::AOT_ENGINE:
+                while (ran < test.cycles_per_frame)
+                    ran += aot->Step(chip8, test.cycles_per_frame - ran);
+                break;
+            default:
+                while (ran < test.cycles_per_frame)
+                    ran += memo.Step(chip8);
+                break;
+        }
+        overrun = ran - test.cycles_per_frame;
+        tick_timers(chip8);
+    }
+    return PackDisplay(chip8);
+}
+
+/**
+ * The outcome of one case on one engine.
+ */
+struct ConformanceResult {
+    size_t test;       /**< Index of the case. */
+    Engine engine;     /**< The engine it ran on. */
+    bool passed;       /**< Whether the display matched the golden one. */
+    PackedFrame frame; /**< The display the ROM ended on. */
+    std::string error; /**< Why the engine could not run, empty if it ran. */
+};
+
+/**
+ * Runs every case on every engine in parallel. The plugins for
+ * Engine::AOT_ENGINE are built first, or taken from the cache.
+ * @param tests the cases
+ * @param workers the threads to run them on
+ * @param plugins the cache to build the plugins in
+ * @return one result per case and engine, ordered by case then engine
+ */
+inline std::vector<ConformanceResult>
+RunConformance(const std::vector<ConformanceCase>& tests,
+               WorkerPool& workers,
+               AotCache& plugins)
+{
+    std::vector<std::unique_ptr<AotEngine>> aot(tests.size());
+    std::vector<std::string> aot_errors(tests.size());
+    workers.ParallelFor(tests.size(), [&](size_t i, unsigned) {
+        aot[i] = plugins.Get(tests[i].image, tests[i].mode, aot_errors[i]);
+    });
+
+    std::vector<ConformanceResult> results(tests.size() * ENGINES.size());
+    workers.ParallelFor(results.size(), [&](size_t i, unsigned) {
+        size_t t = i / ENGINES.size();
+        Engine engine = ENGINES[i % ENGINES.size()];
+        if (engine == Engine::AOT_ENGINE && aot[t] == nullptr) {
+            results[i] = { t, engine, false, {}, aot_errors[t] };
+            return;
+        }
+        PackedFrame frame = RunCase(tests[t], engine, aot[t].get());
+        results[i] = { t, engine, frame == tests[t].golden, frame, {} };
+    });
+    return results;
+}
+
+} // namespace Chip8_core
+
+#endif
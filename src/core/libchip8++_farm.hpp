@@ -0,0 +1,439 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_FARM
+#define BASED_CHIP8_FARM
+
+#include "libchip8++.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <span>
+#include <vector>
+
+#include <csignal>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Chip8_core {
+
+/**
+ * A unit of work for a Farm: run an image for a number of frames.
+ */
+struct FarmJob {
+    uint64_t id;               /**< Handed back in the result. */
+    uint32_t image;            /**< Index into the images of the Farm. */
+    Quirks mode;               /**< The quirks to follow. */
+    uint32_t frames;           /**< Frames to run. */
+    uint32_t cycles_per_frame; /**< Cycles per frame, 10 gives 600Hz. */
+    uint32_t seed;             /**< Seed of the instance. */
+    uint16_t reward_addr;      /**< First byte of the reward. */
+    uint8_t reward_bytes;      /**< Big endian bytes in the reward, up to 8. */
+};
+
+/**
+ * Contains named constants for the outcome of a FarmJob.
+ */
+enum FarmStatus {
+    DONE,  /**< The job ran to completion. */
+    FAULT, /**< The worker died running the job, see FarmResult::signal. */
+};
+
+/**
+ * The outcome of a FarmJob.
+ */
+struct FarmResult {
+    uint64_t id;       /**< FarmJob::id. */
+    FarmStatus status; /**< Whether the job completed. */
+    int signal;        /**< Signal that killed the worker on FAULT. */
+    Hash128 hash;      /**< system::Hash() after the last frame. */
+    uint64_t reward;   /**< The reward bytes after the last frame. */
+};
+
+/**
+ * A pre-forked pool of worker processes, for running ROMs with the fault
+ * isolation threads cannot give. Workers inherit the booted images when
+ * forked. Everything they share lives in one MAP_SHARED mapping made before
+ * forking: for every worker a ring of slots holding a job and, once run, its
+ * result.
+ *
+ * Each ring has a single producer and a single consumer for both of its
+ * counters. The dispatcher publishes jobs by advancing head, the worker
+ * publishes a result by advancing done, so there are no locks and a job
+ * costs two cache line transfers. Idle workers spin briefly and then sleep
+ * on a futex, and so does the dispatcher in Wait().
+ *
+ * A worker marks a slot as started before running it. When a worker dies,
+ * the dispatcher turns a started slot into a FAULT result carrying the
+ * signal and forks a replacement, which carries on with the jobs still in
+ * the ring. Other workers never notice.
+ *
+ * Workers, replacements included, are forked from the dispatcher, which
+ * may have started threads. After such a fork only async-signal-safe calls
+ * are allowed, so a worker never allocates or takes a lock: everything it
+ * reads is built by the constructor, before the first fork.
+ */
+class Farm {
+  private:
+    static constexpr unsigned SPIN = 2000;
+
+    struct alignas(64) Slot {
+        FarmJob job;
+        FarmResult result;
+    };
+
+    struct alignas(64) Ring {
+        alignas(64) std::atomic<uint32_t> head;
+        alignas(64) std::atomic<uint32_t> done;
+        std::atomic<uint32_t> started;
+        std::atomic<uint32_t> sleeping;
+    };
+
+    struct alignas(64) Shared {
+        std::atomic<uint32_t> stop;
+        alignas(64) std::atomic<uint32_t> completions;
+        std::atomic<uint32_t> waiting;
+    };
+
+    struct Worker {
+        pid_t pid;
+        Ring* ring;
+        Slot* slots;
+        uint32_t collected; /* results handed out by Poll() */
+        uint32_t seen_done; /* done at the last liveness check */
+        std::chrono::steady_clock::time_point seen_at;
+    };
+
+    void* shm;
+    size_t shm_size;
+    Shared* shared;
+    size_t image_count;
+    /* jobs start from copies that already carry their hash, so the final
+     * Hash() only pays for what the job changed */
+    std::vector<system> pristine;
+    uint32_t ring_size;
+    std::vector<Worker> workers;
+    unsigned next_worker;
+    uint64_t respawns;
+
+    static void FutexWait(std::atomic<uint32_t>& word,
+                          uint32_t value,
+                          long timeout_ns) noexcept
+    {
+        timespec ts{ timeout_ns / 1'000'000'000, timeout_ns % 1'000'000'000 };
+        syscall(SYS_futex,
+                reinterpret_cast<uint32_t*>(&word),
+                FUTEX_WAIT,
+                value,
+                &ts,
+                nullptr,
+                0);
+    }
+
+    static void FutexWake(std::atomic<uint32_t>& word) noexcept
+    {
+        syscall(SYS_futex,
+                reinterpret_cast<uint32_t*>(&word),
+                FUTEX_WAKE,
+                INT32_MAX,
+                nullptr,
+                nullptr,
+                0);
+    }
+
+    static uint64_t Reward(system& Chip8, const FarmJob& job) noexcept
+    {
+        uint64_t reward = 0;
+        for (unsigned b = 0; b < job.reward_bytes && b < 8; b++)
+            reward = reward << 8 | Chip8.GetMemory(job.reward_addr + b);
+        return reward;
+    }
+
+    [[noreturn]] void Serve(Worker& w) noexcept
+    {
+        /* do not outlive the dispatcher */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        Ring& ring = *w.ring;
+        uint32_t pos = ring.done.load(std::memory_order_relaxed);
+
+        for (;;) {
+            unsigned spins = 0;
+            uint32_t head;
+            while ((head = ring.head.load(std::memory_order_acquire)) == pos) {
+                if (shared->stop.load(std::memory_order_relaxed)) _exit(0);
+                if (++spins < SPIN) continue;
+                ring.sleeping.store(1, std::memory_order_seq_cst);
+                if (ring.head.load(std::memory_order_seq_cst) == pos &&
+                    shared->stop.load(std::memory_order_relaxed) == 0)
+                    FutexWait(ring.head, pos, 10'000'000);
+                ring.sleeping.store(0, std::memory_order_relaxed);
+            }
+
+            Slot& slot = w.slots[pos & (ring_size - 1)];
+            ring.started.store(pos + 1, std::memory_order_relaxed);
+            const FarmJob& job = slot.job;
+            system Chip8{ pristine[job.image] };
+            Chip8.Seed(job.seed);
+            for (uint32_t f = 0; f < job.frames; f++)
+                frame(Chip8, job.mode, job.cycles_per_frame);
+            slot.result = { job.id, DONE, 0, Chip8.Hash(), Reward(Chip8, job) };
+            Publish(ring, ++pos);
+        }
+    }
+
+    void Publish(Ring& ring, uint32_t done) noexcept
+    {
+        ring.done.store(done, std::memory_order_release);
+        shared->completions.fetch_add(1, std::memory_order_seq_cst);
+        if (shared->waiting.load(std::memory_order_seq_cst))
+            FutexWake(shared->completions);
+    }
+
+    void Spawn(Worker& w)
+    {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            std::exit(1);
+        }
+        if (pid == 0) Serve(w);
+        w.pid = pid;
+    }
+
+    /* turns the job a dead worker was running into a FAULT and replaces
+     * the worker */
+    void Recover(Worker& w, int status)
+    {
+        Ring& ring = *w.ring;
+        uint32_t done = ring.done.load(std::memory_order_acquire);
+        if (ring.started.load(std::memory_order_relaxed) == done + 1) {
+            Slot& slot = w.slots[done & (ring_size - 1)];
+            slot.result = { slot.job.id,
+                            FAULT,
+                            WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+                            {},
+                            0 };
+            Publish(ring, done + 1);
+        }
+        ring.sleeping.store(0, std::memory_order_relaxed);
+        respawns++;
+        Spawn(w);
+    }
+
+    void CheckAlive(Worker& w)
+    {
+        int status;
+        if (waitpid(w.pid, &status, WNOHANG) == w.pid) Recover(w, status);
+    }
+
+  public:
+    /**
+     * Constructs the Farm and forks its workers.
+     * @param boot_images the images jobs can run
+     * @param worker_count the number of worker processes
+     * @param ring_size jobs each worker can have queued, rounded up to a
+     * power of two
+     */
+    Farm(std::span<const BootImage> boot_images,
+         unsigned worker_count,
+         uint32_t ring_size = 1024)
+      : image_count{ boot_images.size() }
+      , ring_size{ std::bit_ceil(std::max(ring_size, 2u)) }
+      , next_worker{ 0 }
+      , respawns{ 0 }
+    {
+        worker_count = std::max(worker_count, 1u);
+        size_t ring_bytes = sizeof(Ring) + sizeof(Slot) * this->ring_size;
+        shm_size = sizeof(Shared) + ring_bytes * worker_count;
+        shm = mmap(nullptr,
+                   shm_size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS,
+                   -1,
+                   0);
+        if (shm == MAP_FAILED) {
+            perror("mmap");
+            std::exit(1);
+        }
+
+        auto* base = static_cast<std::byte*>(shm);
+        shared = new (base) Shared{};
+        base += sizeof(Shared);
+
+        workers.resize(worker_count);
+        for (Worker& w : workers) {
+            w.ring = new (base) Ring{};
+            w.slots = reinterpret_cast<Slot*>(base + sizeof(Ring));
+            w.collected = 0;
+            w.seen_done = 0;
+            base += ring_bytes;
+        }
+
+        pristine.reserve(image_count);
+        for (const BootImage& image : boot_images) {
+            pristine.emplace_back(image, 0);
+            pristine.back().Hash();
+        }
+        for (Worker& w : workers)
+            Spawn(w);
+    }
+
+    Farm(const Farm&) = delete;
+    Farm& operator=(const Farm&) = delete;
+
+    /**
+     * Stops the workers, jobs still queued are dropped.
+     */
+    ~Farm()
+    {
+        shared->stop.store(1, std::memory_order_seq_cst);
+        for (Worker& w : workers)
+            FutexWake(w.ring->head);
+        for (Worker& w : workers) {
+            int status;
+            waitpid(w.pid, &status, 0);
+        }
+        munmap(shm, shm_size);
+    }
+
+    /**
+     * Queues a job on the least busy worker. Workers are looked at round
+     * robin from where the last call stopped, the first idle one ends the
+     * search.
+     * @param job the job, its image must be below the number of images
+     * @return false if the image is out of range or every worker's ring is
+     * full
+     */
+    bool Submit(const FarmJob& job)
+    {
+        if (job.image >= image_count) return false;
+        Worker* best = nullptr;
+        uint32_t best_load = ring_size;
+        for (size_t tries = 0; tries < workers.size() && best_load != 0;
+             tries++) {
+            Worker& w = workers[next_worker++ % workers.size()];
+            uint32_t load =
+              w.ring->head.load(std::memory_order_relaxed) - w.collected;
+            if (load < best_load) {
+                best = &w;
+                best_load = load;
+            }
+        }
+        if (best == nullptr) return false;
+
+        Ring& ring = *best->ring;
+        uint32_t head = ring.head.load(std::memory_order_relaxed);
+        best->slots[head & (ring_size - 1)].job = job;
+        ring.head.store(head + 1, std::memory_order_seq_cst);
+        if (ring.sleeping.load(std::memory_order_seq_cst))
+            FutexWake(ring.head);
+        return true;
+    }
+
+    /**
+     * Collects finished results without blocking. Workers that stopped
+     * making progress are checked for having died and replaced.
+     * @param out results are appended here
+     * @return the number of results appended
+     */
+    size_t Poll(std::vector<FarmResult>& out)
+    {
+        size_t got = 0;
+        auto now = std::chrono::steady_clock::now();
+        for (Worker& w : workers) {
+            uint32_t done = w.ring->done.load(std::memory_order_acquire);
+            for (; w.collected != done; w.collected++, got++)
+                out.push_back(w.slots[w.collected & (ring_size - 1)].result);
+
+            uint32_t head = w.ring->head.load(std::memory_order_relaxed);
+            if (done != w.seen_done || head == done) {
+                w.seen_done = done;
+                w.seen_at = now;
+            } else if (now - w.seen_at > std::chrono::milliseconds{ 1 }) {
+                w.seen_at = now;
+                CheckAlive(w);
+            }
+        }
+        return got;
+    }
+
+    /**
+     * Collects finished results, sleeping until at least one is available
+     * or a timeout passes.
+     * @param out results are appended here
+     * @param timeout the longest to wait
+     * @return the number of results appended
+     */
+    size_t Wait(std::vector<FarmResult>& out,
+                std::chrono::nanoseconds timeout = std::chrono::milliseconds{
+                  1 })
+    {
+        uint32_t seen = shared->completions.load(std::memory_order_seq_cst);
+        if (size_t got = Poll(out)) return got;
+        shared->waiting.store(1, std::memory_order_seq_cst);
+        if (shared->completions.load(std::memory_order_seq_cst) == seen)
+            FutexWait(shared->completions, seen, timeout.count());
+        shared->waiting.store(0, std::memory_order_relaxed);
+        return Poll(out);
+    }
+
+    /**
+     * Returns the number of jobs submitted whose results were not yet
+     * collected.
+     */
+    size_t Pending() const noexcept
+    {
+        size_t pending = 0;
+        for (const Worker& w : workers)
+            pending += w.ring->head.load(std::memory_order_relaxed) -
+                       w.collected;
+        return pending;
+    }
+
+    /**
+     * Returns the number of workers replaced after dying.
+     */
+    uint64_t Respawns() const noexcept
+    {
+        return respawns;
+    }
+
+    /**
+     * Returns the process ids of the workers, in order.
+     */
+    std::vector<pid_t> Pids() const
+    {
+        std::vector<pid_t> pids;
+        for (const Worker& w : workers)
+            pids.push_back(w.pid);
+        return pids;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
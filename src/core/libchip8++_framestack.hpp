@@ -0,0 +1,178 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_FRAMESTACK
+#define BASED_CHIP8_FRAMESTACK
+
+#include "libchip8++.hpp"
+#include "libchip8++_conformance.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * The last frames of one environment, oldest first, read in place from a
+ * FrameStack.
+ */
+struct StackView {
+    const PackedFrame* ring; /**< The frames of the environment. */
+    unsigned oldest;         /**< Index of the oldest frame in ring. */
+    unsigned depth;          /**< The number of frames. */
+
+    /**
+     * Returns a frame, 0 being the oldest and depth - 1 the newest.
+     * @param i the position in the stack
+     */
+    const PackedFrame& operator[](unsigned i) const noexcept
+    {
+        unsigned at = oldest + i;
+        return ring[at < depth ? at : at - depth];
+    }
+};
+
+/**
+ * Keeps the last few packed frames of every environment of a batch for
+ * agents that observe a stack of frames.
+ *
+ * Every environment owns a ring of depth frames in one flat array. A step
+ * packs the display once into the slot of the oldest frame and moves the
+ * ring head, so a stacked observation is never copied: it is read through
+ * a StackView, or gathered by index from Frames() by whoever assembles
+ * the training batch.
+ *
+ * With max pooling a stored frame is the union of the last two displays,
+ * which keeps sprites that the ROM draws on every other frame visible.
+ */
+class FrameStack {
+  private:
+    std::vector<PackedFrame> frames;
+    std::vector<PackedFrame> last; /* unpooled previous display */
+    std::vector<unsigned> heads;   /* slot the next frame goes to */
+    unsigned depth;
+    bool max_pool;
+
+  public:
+    /**
+     * Constructs the FrameStack, all frames blank.
+     * @param envs the number of environments
+     * @param depth the frames kept per environment, at least 1
+     * @param max_pool whether a frame is pooled with the one before it
+     */
+    FrameStack(size_t envs, unsigned depth, bool max_pool = false)
+      : frames(envs * std::max(depth, 1u), PackedFrame{})
+      , last(max_pool ? envs : 0, PackedFrame{})
+      , heads(envs, 0)
+      , depth{ std::max(depth, 1u) }
+      , max_pool{ max_pool }
+    {
+    }
+
+    /**
+     * Adds the display of an environment after a step, dropping its oldest
+     * frame.
+     * @param env the environment
+     * @param chip8 its instance
+     */
+    void Push(size_t env, system& chip8) noexcept
+    {
+        unsigned& head = heads[env];
+        PackedFrame& slot = frames[env * depth + head];
+        slot = PackDisplay(chip8);
+        if (max_pool) {
+            PackedFrame& prev = last[env];
+            for (size_t i = 0; i < slot.size(); i++) {
+                uint8_t now = slot[i];
+                slot[i] |= prev[i];
+                prev[i] = now;
+            }
+        }
+        head = head + 1 == depth ? 0 : head + 1;
+    }
+
+    /**
+     * Starts a new episode of an environment: every frame of its stack
+     * becomes its current display.
+     * @param env the environment
+     * @param chip8 its instance
+     */
+    void Reset(size_t env, system& chip8) noexcept
+    {
+        PackedFrame frame = PackDisplay(chip8);
+        for (unsigned i = 0; i < depth; i++)
+            frames[env * depth + i] = frame;
+        if (max_pool) last[env] = frame;
+        heads[env] = 0;
+    }
+
+    /**
+     * Returns the stack of an environment.
+     * @param env the environment
+     */
+    StackView View(size_t env) const noexcept
+    {
+        return { &frames[env * depth], heads[env], depth };
+    }
+
+    /**
+     * Fills the indices into Frames() of every stack, environment after
+     * environment and each stack oldest first.
+     * @param out room for Size() * Depth() indices
+     */
+    void Gather(std::span<uint32_t> out) const noexcept
+    {
+        for (size_t env = 0; env < heads.size(); env++) {
+            uint32_t base = env * depth;
+            unsigned at = heads[env];
+            for (unsigned i = 0; i < depth; i++) {
+                out[base + i] = base + at;
+                at = at + 1 == depth ? 0 : at + 1;
+            }
+        }
+    }
+
+    /**
+     * Returns every frame, the ring of environment e at e * Depth().
+     */
+    std::span<const PackedFrame> Frames() const noexcept
+    {
+        return frames;
+    }
+
+    /**
+     * Returns the frames kept per environment.
+     */
+    unsigned Depth() const noexcept
+    {
+        return depth;
+    }
+
+    /**
+     * Returns the number of environments.
+     */
+    size_t Size() const noexcept
+    {
+        return heads.size();
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,471 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_MEMO
+#define BASED_CHIP8_MEMO
+
+#include "libchip8++.hpp"
+
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * Memoizes subroutine calls (2NNN up to the matching 00EE) that only depend
+ * on machine state. The first call of a subroutine is executed normally while
+ * every location it reads before writing (registers, I, timers, stack,
+ * memory including its own code, display pixels) and every location it writes
+ * is recorded. A later call finding the same values in all of the recorded
+ * inputs skips execution and stores the recorded outputs directly. Drawing
+ * stores the colors in the display, so calls that draw also take the colors
+ * as inputs.
+ * Subroutines that clear the screen or execute an impure instruction are
+ * never memoized, see Instructions::is_impure().
+ *
+ * Drive a system through Step() instead of cycle(). One memo serves any
+ * number of instances of the same ROM as long as they follow the same quirks,
+ * whatever their colors.
+ */
+class SubroutineMemo {
+  public:
+    /**
+     * Counters describing how well memoization is doing.
+     */
+    struct Stats {
+        uint64_t hits;   /**< Calls answered from the memo. */
+        uint64_t misses; /**< Calls executed and recorded. */
+        uint64_t impure; /**< Calls that could not be memoized. */
+        uint64_t cycles_skipped; /**< Cycles hits did not have to run. */
+    };
+
+  private:
+    /* every piece of state a subroutine can touch gets a location number */
+    enum Location : uint16_t {
+        LOC_REG = 0x0000,    /* V0 to VF */
+        LOC_INDEX = 0x0010,  /* I */
+        LOC_DT = 0x0011,     /* delay timer */
+        LOC_ST = 0x0012,     /* sound timer */
+        LOC_SP = 0x0013,     /* stack top */
+        LOC_PC = 0x0014,     /* program counter, only ever an input */
+        LOC_FG = 0x0015,     /* display_fg, only ever an input */
+        LOC_BG = 0x0016,     /* display_bg, only ever an input */
+        LOC_STACK = 0x0020,  /* stack slots */
+        LOC_MEMORY = 0x1000, /* memory bytes */
+        LOC_PIXEL = 0x2000,  /* display pixels */
+        LOC_COUNT = LOC_PIXEL + Constants::DISPW * Constants::DISPH
+    };
+
+    struct Cell {
+        uint16_t loc;
+        uint32_t value;
+    };
+
+    struct Entry {
+        std::vector<Cell> inputs;
+        std::vector<Cell> outputs;
+        uint16_t return_addr;
+        unsigned cycles;
+    };
+
+    struct Slot {
+        std::vector<Entry> entries;
+        unsigned next_victim = 0;
+    };
+
+    Quirks mode;
+    unsigned max_entries;
+    unsigned max_cycles;
+    unsigned max_cells;
+    std::vector<Slot> table;
+    Stats stats{};
+
+    /* recording state, a location is seen/written during the current
+     * recording when its stamp equals epoch */
+    uint32_t epoch = 0;
+    std::vector<uint32_t> seen;
+    std::vector<uint32_t> written;
+    std::vector<Cell> inputs;
+    std::vector<uint16_t> writes;
+
+    static uint32_t Load(system& Chip8, uint16_t loc)
+    {
+        if (loc >= LOC_PIXEL) return Chip8.GetPixel(loc - LOC_PIXEL);
+        if (loc >= LOC_MEMORY) return Chip8.GetMemory(loc - LOC_MEMORY);
+        if (loc >= LOC_STACK) return Chip8.RefStack()[loc - LOC_STACK];
+        switch (loc) {
+            case LOC_INDEX:
+                return Chip8.GetIndexRegister();
+            case LOC_DT:
+                return Chip8.GetDT();
+            case LOC_ST:
+                return Chip8.GetST();
+            case LOC_SP:
+                return static_cast<uint8_t>(Chip8.GetStackTop());
+            case LOC_PC:
+                return Chip8.GetPC();
+            case LOC_FG:
+                return Chip8.display_fg;
+            case LOC_BG:
+                return Chip8.display_bg;
+            default:
+                return Chip8.GetRegister(static_cast<Registers>(loc));
+        }
+    }
+
+    static void Store(system& Chip8, uint16_t loc, uint32_t v)
+    {
+        if (loc >= LOC_PIXEL) return Chip8.SetPixel(loc - LOC_PIXEL, v);
+        if (loc >= LOC_MEMORY) return Chip8.SetMemory(loc - LOC_MEMORY, v);
+        if (loc >= LOC_STACK) {
+            Chip8.RefStack()[loc - LOC_STACK] = v;
+            return;
+        }
+        switch (loc) {
+            case LOC_INDEX:
+                return Chip8.SetIndexRegister(v);
+            case LOC_DT:
+                return Chip8.SetDT(v);
+            case LOC_ST:
+                return Chip8.SetST(v);
+            case LOC_SP:
+                return Chip8.SetStackTop(static_cast<int8_t>(v));
+            default:
+                return Chip8.SetRegister(static_cast<Registers>(loc), v);
+        }
+    }
+
+    /* first touch of a location that is read records it as an input */
+    void Read(system& Chip8, uint16_t loc)
+    {
+        if (seen[loc] == epoch) return;
+        seen[loc] = epoch;
+        inputs.push_back({ loc, Load(Chip8, loc) });
+    }
+
+    void Write(uint16_t loc)
+    {
+        seen[loc] = epoch;
+        if (written[loc] == epoch) return;
+        written[loc] = epoch;
+        writes.push_back(loc);
+    }
+
+    static uint16_t Reg(uint8_t r)
+    {
+        return LOC_REG + r;
+    }
+
+    static uint16_t Mem(uint16_t addr)
+    {
+        return LOC_MEMORY + (addr & (Constants::MEMSIZE - 1));
+    }
+
+    /* records what the instruction about to execute reads and writes,
+     * returns false for instructions that cannot be memoized */
+    bool Trace(system& Chip8, uint16_t opcode)
+    {
+        using namespace Instructions;
+        uint8_t x = fetch_nib2(opcode);
+        uint8_t y = fetch_nib3(opcode);
+        uint8_t low = nibble2byte(y, fetch_nib4(opcode));
+        uint16_t index = Chip8.GetIndexRegister();
+
+        Read(Chip8, Mem(Chip8.GetPC()));
+        Read(Chip8, Mem(Chip8.GetPC() + 1));
+        if (is_impure(opcode)) return false;
+
+        switch (fetch_nib1(opcode)) {
+            case 0x0:
+                if (opcode == 0x00E0) return false;
+                if (opcode == 0x00EE) {
+                    int8_t sp = Chip8.GetStackTop();
+                    if (sp < 0) return false;
+                    Read(Chip8, LOC_SP);
+                    Read(Chip8, LOC_STACK + sp);
+                    Write(LOC_SP);
+                }
+                return true;
+
+            case 0x2: {
+                int8_t sp = Chip8.GetStackTop() + 1;
+                if (sp >= Constants::STACKSIZE) return false;
+                Read(Chip8, LOC_SP);
+                Write(LOC_SP);
+                Write(LOC_STACK + sp);
+                return true;
+            }
+
+            case 0x3:
+            case 0x4:
+                Read(Chip8, Reg(x));
+                return true;
+
+            case 0x5:
+            case 0x9:
+                Read(Chip8, Reg(x));
+                Read(Chip8, Reg(y));
+                return true;
+
+            case 0x6:
+                Write(Reg(x));
+                return true;
+
+            case 0x7:
+                Read(Chip8, Reg(x));
+                Write(Reg(x));
+                return true;
+
+            case 0x8:
+                if (fetch_nib4(opcode) > 0x7 && fetch_nib4(opcode) != 0xE)
+                    return true;
+                Read(Chip8, Reg(x));
+                Read(Chip8, Reg(y));
+                Write(Reg(x));
+                if (fetch_nib4(opcode) >= 0x4) Write(Reg(RF));
+                return true;
+
+            case 0xA:
+                Write(LOC_INDEX);
+                return true;
+
+            case 0xB:
+                Read(Chip8, Reg(R0));
+                return true;
+
+            case 0xD: {
+                Read(Chip8, Reg(x));
+                Read(Chip8, Reg(y));
+                Read(Chip8, LOC_INDEX);
+                Read(Chip8, LOC_FG);
+                Read(Chip8, LOC_BG);
+                uint8_t px = Chip8.GetRegister(static_cast<Registers>(x)) & 63;
+                uint8_t py = Chip8.GetRegister(static_cast<Registers>(y)) & 31;
+                for (int row = 0; row < fetch_nib4(opcode); row++) {
+                    Read(Chip8, Mem(index + row));
+                    if (py + row >= Constants::DISPH) break;
+                    uint8_t sprite = Chip8.GetMemory(index + row);
+                    for (int col = 0; col < 8; col++) {
+                        if (px + col >= Constants::DISPW) break;
+                        if ((sprite & (0b1000'0000 >> col)) == 0) continue;
+                        uint16_t loc =
+                          LOC_PIXEL + px + col + (py + row) * Constants::DISPW;
+                        Read(Chip8, loc);
+                        Write(loc);
+                    }
+                }
+                Write(Reg(RF));
+                return true;
+            }
+
+            case 0xF:
+                switch (low) {
+                    case 0x15:
+                        Read(Chip8, Reg(x));
+                        Write(LOC_DT);
+                        return true;
+
+                    case 0x18:
+                        Read(Chip8, Reg(x));
+                        Write(LOC_ST);
+                        return true;
+
+                    case 0x1E:
+                        Read(Chip8, Reg(x));
+                        Read(Chip8, LOC_INDEX);
+                        Write(LOC_INDEX);
+                        return true;
+
+                    case 0x29:
+                        Read(Chip8, Reg(x));
+                        Write(LOC_INDEX);
+                        return true;
+
+                    case 0x33:
+                        Read(Chip8, Reg(x));
+                        Read(Chip8, LOC_INDEX);
+                        for (int i = 0; i < 3; i++)
+                            Write(Mem(index + i));
+                        return true;
+
+                    case 0x55:
+                        Read(Chip8, LOC_INDEX);
+                        for (int i = 0; i <= x; i++) {
+                            Read(Chip8, Reg(i));
+                            Write(Mem(index + i));
+                        }
+                        if (mode == Quirks::MATT) Write(LOC_INDEX);
+                        return true;
+
+                    case 0x65:
+                        Read(Chip8, LOC_INDEX);
+                        for (int i = 0; i <= x; i++) {
+                            Read(Chip8, Mem(index + i));
+                            Write(Reg(i));
+                        }
+                        if (mode == Quirks::MATT) Write(LOC_INDEX);
+                        return true;
+
+                    default:
+                        return true;
+                }
+
+            default:
+                return true;
+        }
+    }
+
+    /* looks for an entry whose inputs all match the current state */
+    const Entry* Find(system& Chip8, uint16_t target)
+    {
+        for (const Entry& e : table[target].entries) {
+            bool match = true;
+            for (const Cell& c : e.inputs) {
+                if (Load(Chip8, c.loc) != c.value) {
+                    match = false;
+                    break;
+                }
+            }
+            if (match) return &e;
+        }
+        return nullptr;
+    }
+
+    /* executes the call at PC while recording it, returns the cycles run,
+     * 0 when the call itself could not be traced */
+    unsigned Record(system& Chip8, uint16_t target)
+    {
+        epoch++;
+        inputs.clear();
+        writes.clear();
+        Read(Chip8, LOC_PC);
+
+        uint16_t return_addr = Chip8.GetPC() + 2;
+        unsigned cycles = 0;
+        int depth = 0;
+        bool pure = true;
+        do {
+            uint16_t opcode = Chip8.Peek();
+            if (cycles == max_cycles ||
+                inputs.size() + writes.size() > max_cells ||
+                Trace(Chip8, opcode) == false) {
+                pure = false;
+                break;
+            }
+            if (Instructions::fetch_nib1(opcode) == 0x2) depth++;
+            if (opcode == 0x00EE) depth--;
+            cycle(Chip8, mode);
+            cycles++;
+        } while (depth > 0);
+
+        if (pure == false || Chip8.GetPC() != return_addr) {
+            stats.impure++;
+            return cycles;
+        }
+
+        Entry entry{ inputs, {}, return_addr, cycles };
+        entry.outputs.reserve(writes.size());
+        for (uint16_t loc : writes)
+            entry.outputs.push_back({ loc, Load(Chip8, loc) });
+
+        Slot& slot = table[target];
+        if (slot.entries.size() < max_entries) {
+            slot.entries.push_back(std::move(entry));
+        } else {
+            slot.entries[slot.next_victim] = std::move(entry);
+            slot.next_victim = (slot.next_victim + 1) % max_entries;
+        }
+        stats.misses++;
+        return cycles;
+    }
+
+  public:
+    /**
+     * Constructs the SubroutineMemo.
+     * @param mode the quirks the memoized systems follow
+     * @param max_entries recorded calls kept per subroutine, the oldest is
+     * replaced once full
+     * @param max_cycles calls running longer than this are not memoized
+     * @param max_cells calls touching more locations than this are not
+     * memoized
+     */
+    explicit SubroutineMemo(Quirks mode,
+                            unsigned max_entries = 8,
+                            unsigned max_cycles = 4096,
+                            unsigned max_cells = 1024)
+      : mode{ mode }
+      , max_entries{ max_entries }
+      , max_cycles{ max_cycles }
+      , max_cells{ max_cells }
+      , table(Constants::MEMSIZE)
+      , seen(LOC_COUNT, 0)
+      , written(LOC_COUNT, 0)
+    {
+    }
+
+    /**
+     * Runs the next instruction. Calls are answered from the memo when
+     * possible and executed to their return otherwise, so a single Step() can
+     * stand for many cycles.
+     * @param Chip8 the system to run
+     * @return the number of cycles the step stands for, count these against
+     * the frame budget to keep timing identical to plain cycle()
+     */
+    unsigned Step(system& Chip8)
+    {
+        uint16_t opcode = Chip8.Peek();
+        if (Instructions::fetch_nib1(opcode) != 0x2) {
+            cycle(Chip8, mode);
+            return 1;
+        }
+
+        uint16_t target = opcode & 0x0FFF;
+        if (const Entry* e = Find(Chip8, target)) {
+            for (const Cell& c : e->outputs)
+                Store(Chip8, c.loc, c.value);
+            Chip8.SetPC(e->return_addr);
+            stats.hits++;
+            stats.cycles_skipped += e->cycles;
+            return e->cycles;
+        }
+        if (unsigned cycles = Record(Chip8, target)) return cycles;
+
+        /* the 2NNN itself was rejected, like a call with a full stack */
+        cycle(Chip8, mode);
+        return 1;
+    }
+
+    /**
+     * Returns the hit, miss and impure counters.
+     */
+    const Stats& GetStats() const
+    {
+        return stats;
+    }
+
+    /**
+     * Forgets every recorded call and resets the counters.
+     */
+    void Clear()
+    {
+        for (Slot& slot : table)
+            slot = Slot{};
+        stats = Stats{};
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,404 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_NUMA
+#define BASED_CHIP8_NUMA
+
+#include "libchip8++.hpp"
+#include "libchip8++_batch.hpp"
+#include "libchip8++_pool.hpp"
+#include "libchip8++_workers.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Chip8_core {
+
+/**
+ * Pins the calling thread to a CPU.
+ * @param cpu the CPU to run on
+ * @return whether the kernel accepted it
+ */
+inline bool
+pin_thread(unsigned cpu) noexcept
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof set, &set) == 0;
+}
+
+/**
+ * Returns the NUMA node the calling thread is running on.
+ */
+inline unsigned
+current_node() noexcept
+{
+    unsigned cpu = 0, node = 0;
+    syscall(SYS_getcpu, &cpu, &node, nullptr);
+    return node;
+}
+
+/**
+ * Returns the NUMA node the page holding an address lives on, the page must
+ * have been touched.
+ * @param addr the address
+ * @return the node, -1 if the kernel does not say
+ */
+inline int
+node_of(const void* addr) noexcept
+{
+    int node = -1;
+    if (syscall(SYS_get_mempolicy,
+                &node,
+                nullptr,
+                0,
+                const_cast<void*>(addr),
+                MPOL_F_NODE | MPOL_F_ADDR) != 0)
+        return -1;
+    return node;
+}
+
+/**
+ * Asks for the pages of a range to come from a NUMA node. The range must be
+ * page aligned and not yet touched.
+ * @param addr start of the range
+ * @param len length of the range
+ * @param node the node
+ * @return whether the kernel accepted the policy
+ */
+inline bool
+bind_memory(void* addr, size_t len, unsigned node) noexcept
+{
+    unsigned long mask[4]{};
+    if (node >= sizeof mask * 8) return false;
+    mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+    return syscall(SYS_mbind,
+                   addr,
+                   len,
+                   MPOL_PREFERRED,
+                   mask,
+                   sizeof mask * 8,
+                   0) == 0;
+}
+
+/**
+ * Which CPUs belong to which NUMA node.
+ */
+class Topology {
+  private:
+    std::vector<std::vector<unsigned>> nodes;
+
+    /* "0-3,8" style CPU list */
+    static std::vector<unsigned> ParseList(const std::string& list)
+    {
+        std::vector<unsigned> cpus;
+        std::stringstream in{ list };
+        for (std::string range; std::getline(in, range, ',');) {
+            if (range.empty()) continue;
+            size_t dash = range.find('-');
+            unsigned first = std::stoul(range.substr(0, dash));
+            unsigned last = dash == std::string::npos
+                              ? first
+                              : std::stoul(range.substr(dash + 1));
+            for (unsigned cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+  public:
+    /**
+     * Reads the topology of this machine from sysfs, falling back to a
+     * single node holding every CPU.
+     */
+    static Topology Detect()
+    {
+        Topology topo;
+        namespace fs = std::filesystem;
+        for (unsigned node = 0;; node++) {
+            fs::path list = "/sys/devices/system/node/node" +
+                            std::to_string(node) + "/cpulist";
+            std::ifstream in{ list };
+            std::string text;
+            if (!std::getline(in, text)) break;
+            topo.nodes.push_back(ParseList(text));
+        }
+        if (topo.nodes.empty()) {
+            topo.nodes.emplace_back();
+            for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency();
+                 cpu++)
+                topo.nodes[0].push_back(cpu);
+        }
+        return topo;
+    }
+
+    /**
+     * Builds a topology from a description, CPU lists of the nodes in order
+     * separated by ';', like "0-3,8-11;4-7,12-15". Empty lists are skipped,
+     * a description without any CPU gives this machine's topology.
+     * @param spec the description
+     */
+    static Topology Parse(const std::string& spec)
+    {
+        Topology topo;
+        std::stringstream in{ spec };
+        for (std::string list; std::getline(in, list, ';');) {
+            std::vector<unsigned> cpus = ParseList(list);
+            if (cpus.empty() == false) topo.nodes.push_back(std::move(cpus));
+        }
+        if (topo.nodes.empty()) return Detect();
+        return topo;
+    }
+
+    /**
+     * Returns the number of nodes.
+     */
+    unsigned Nodes() const noexcept
+    {
+        return nodes.size();
+    }
+
+    /**
+     * Returns the CPUs of a node.
+     * @param node the node
+     */
+    const std::vector<unsigned>& Cpus(unsigned node) const
+    {
+        return nodes[node];
+    }
+
+    /**
+     * Picks the CPU for a worker, spreading workers over the nodes
+     * round-robin so every node gets its share.
+     * @param worker index of the worker
+     * @param node set to the node of the CPU
+     * @return the CPU
+     */
+    unsigned CpuFor(unsigned worker, unsigned& node) const
+    {
+        node = 0;
+        if (nodes.empty()) return 0;
+        node = worker % nodes.size();
+        const auto& cpus = nodes[node];
+        if (cpus.empty()) return 0;
+        return cpus[(worker / nodes.size()) % cpus.size()];
+    }
+};
+
+/**
+ * An Arena whose slab is mapped directly and bound to a NUMA node before
+ * anything touches it.
+ */
+class NumaArena : public Arena {
+  private:
+    static size_t MapSize(size_t size) noexcept
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        return (size + page - 1) / page * page;
+    }
+
+  public:
+    /**
+     * Constructs the NumaArena.
+     * @param slot_size size in bytes of a single slot, rounded up to a
+     * multiple of the cache line size
+     * @param capacity the number of slots the arena can hand out
+     * @param node the node to place the slab on, the policy is a preference
+     * so the kernel falls back to other nodes rather than failing
+     */
+    NumaArena(size_t slot_size, size_t capacity, unsigned node)
+      : Arena(
+          slot_size,
+          capacity,
+          [node](size_t size) -> void* {
+              void* map = mmap(nullptr,
+                               MapSize(size),
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS,
+                               -1,
+                               0);
+              if (map == MAP_FAILED) return nullptr;
+              bind_memory(map, MapSize(size), node);
+              return map;
+          },
+          [](void* slab, size_t size) { munmap(slab, MapSize(size)); })
+    {
+    }
+};
+
+/**
+ * Counts of instance frames by where the instance lived relative to the
+ * thread stepping it.
+ */
+struct NumaStats {
+    uint64_t local;  /**< Instance frames stepped on the instance's node. */
+    uint64_t remote; /**< Instance frames stepped from another node. */
+};
+
+/**
+ * Runs a batch of instances split over the workers of a WorkerPool, each
+ * worker always stepping the same instances. With placement on, every worker
+ * is pinned to a CPU picked from the topology and builds its own instances
+ * in a NumaArena bound to that CPU's node, so instance state never crosses
+ * the interconnect. With placement off, the thread constructing the
+ * PlacedBatch allocates every instance and workers run wherever the kernel
+ * puts them, which is the baseline to compare against.
+ * The calling thread takes part as worker 0 and stays pinned afterwards.
+ */
+class PlacedBatch {
+  private:
+    struct Share {
+        std::unique_ptr<NumaArena> arena;
+        std::vector<system*> machines;
+        std::unique_ptr<Batch> batch;
+        std::vector<size_t> homes; /* instances living on each node */
+        uint64_t local;
+        uint64_t remote;
+    };
+
+    WorkerPool& pool;
+    std::vector<Share> shares;
+
+    void Build(Share& share,
+               const system& pristine,
+               size_t count,
+               unsigned node,
+               Quirks mode)
+    {
+        share.arena = std::make_unique<NumaArena>(sizeof(system), count, node);
+        share.batch = std::make_unique<Batch>(mode, 4);
+        for (size_t i = 0; i < count; i++) {
+            auto* chip8 = new (share.arena->Allocate()) system{ pristine };
+            share.machines.push_back(chip8);
+            share.batch->Add(*chip8);
+            int home = node_of(chip8->RefRegisterArray().data());
+            if (home < 0) home = node;
+            if (share.homes.size() <= unsigned(home))
+                share.homes.resize(home + 1);
+            share.homes[home]++;
+        }
+        share.local = share.remote = 0;
+    }
+
+  public:
+    /**
+     * Constructs the PlacedBatch and its instances.
+     * @param pool the workers to step the instances on
+     * @param topology the nodes and CPUs to place workers on
+     * @param pristine the state every instance starts from
+     * @param count the number of instances, split evenly over the workers
+     * @param mode the quirks every instance follows
+     * @param placed whether to pin workers and place instances on their node
+     */
+    PlacedBatch(WorkerPool& pool,
+                const Topology& topology,
+                const system& pristine,
+                size_t count,
+                Quirks mode,
+                bool placed = true)
+      : pool{ pool }
+      , shares(pool.Size())
+    {
+        size_t each = (count + pool.Size() - 1) / pool.Size();
+        auto share_size = [&](unsigned w) {
+            size_t first = std::min(count, each * w);
+            return std::min(count, first + each) - first;
+        };
+
+        if (placed == false) {
+            unsigned node = current_node();
+            for (unsigned w = 0; w < shares.size(); w++)
+                Build(shares[w], pristine, share_size(w), node, mode);
+            return;
+        }
+        pool.Run([&](unsigned w) {
+            unsigned node;
+            pin_thread(topology.CpuFor(w, node));
+            Build(shares[w], pristine, share_size(w), node, mode);
+        });
+    }
+
+    PlacedBatch(const PlacedBatch&) = delete;
+    PlacedBatch& operator=(const PlacedBatch&) = delete;
+
+    ~PlacedBatch()
+    {
+        for (Share& share : shares)
+            for (system* chip8 : share.machines)
+                chip8->~system();
+    }
+
+    /**
+     * Runs one frame on every instance, see Chip8_core::frame().
+     * @param cycles_per_frame the number of cycles per frame
+     */
+    void Frame(unsigned cycles_per_frame)
+    {
+        pool.Run([&](unsigned w) {
+            Share& share = shares[w];
+            unsigned node = current_node();
+            size_t local = node < share.homes.size() ? share.homes[node] : 0;
+            share.local += local;
+            share.remote += share.machines.size() - local;
+            share.batch->Frame(cycles_per_frame);
+        });
+    }
+
+    /**
+     * Returns where instances were stepped from, summed over the workers.
+     */
+    NumaStats Stats() const noexcept
+    {
+        NumaStats stats{ 0, 0 };
+        for (const Share& share : shares) {
+            stats.local += share.local;
+            stats.remote += share.remote;
+        }
+        return stats;
+    }
+
+    /**
+     * Returns the number of instances.
+     */
+    size_t Size() const noexcept
+    {
+        size_t size = 0;
+        for (const Share& share : shares)
+            size += share.machines.size();
+        return size;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,428 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_OBSRING
+#define BASED_CHIP8_OBSRING
+
+#include "libchip8++.hpp"
+#include "libchip8++_conformance.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Chip8_core {
+
+/**
+ * Hands the observations of a batch of environments to a trainer running
+ * in another process, and its actions back, through a POSIX shared memory
+ * object. Nothing is serialised: the engine packs every display straight
+ * into the shared slot and the trainer reads the frames, rewards, done
+ * flags and input read flags in place as plain arrays, then writes one key
+ * bitset per environment next to them.
+ *
+ * The object holds depth slots used in turn, one per step. The engine
+ * fills slot step % depth and calls Publish(), the trainer sees it in
+ * Observe(), writes the actions of the same slot and calls Act(), which
+ * WaitActions() on the engine side returns from. Each direction is one
+ * counter with a single writer. A waiting side spins briefly, then sleeps
+ * on a futex on the counter, and the other side only makes the wake call
+ * when it has announced it is asleep.
+ *
+ * The engine creates the object with Create() and removes its name when
+ * destroyed, the trainer maps it with Attach().
+ */
+class ObservationRing {
+  private:
+    static constexpr uint64_t MAGIC = 0x474e5252534f4843ULL; /* CHOSRRNG */
+    static constexpr uint32_t VERSION = 2;
+    static constexpr unsigned SPIN = 2000;
+    static constexpr size_t ALIGN = 64;
+
+    struct Header {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t envs;
+        uint32_t depth;
+        uint32_t slot_size;
+        alignas(64) std::atomic<uint32_t> observed;
+        std::atomic<uint32_t> observed_waiting;
+        alignas(64) std::atomic<uint32_t> acted;
+        std::atomic<uint32_t> acted_waiting;
+        alignas(64) std::atomic<uint32_t> closed;
+    };
+
+    /* offsets of the arrays inside a slot, all cache line aligned */
+    struct Layout {
+        size_t frames, rewards, dones, polled, actions, size;
+
+        explicit Layout(size_t envs)
+        {
+            auto up = [](size_t n) { return (n + ALIGN - 1) & ~(ALIGN - 1); };
+            frames = 0;
+            rewards = up(frames + envs * sizeof(PackedFrame));
+            dones = up(rewards + envs * sizeof(float));
+            polled = up(dones + envs);
+            actions = up(polled + envs);
+            size = up(actions + envs * sizeof(uint16_t));
+        }
+    };
+
+    Header* header;
+    uint8_t* slots;
+    size_t map_size;
+    Layout layout;
+    std::string owned_name;
+    uint32_t seen; /* trainer side, the last step handed out by Observe() */
+
+    ObservationRing(void* map, size_t map_size, size_t envs)
+      : header{ static_cast<Header*>(map) }
+      , slots{ static_cast<uint8_t*>(map) + sizeof(Header) }
+      , map_size{ map_size }
+      , layout{ envs }
+      , seen{ 0 }
+    {
+    }
+
+    static void FutexWait(std::atomic<uint32_t>& word,
+                          uint32_t value,
+                          long timeout_ns) noexcept
+    {
+        timespec ts{ timeout_ns / 1'000'000'000, timeout_ns % 1'000'000'000 };
+        syscall(SYS_futex,
+                reinterpret_cast<uint32_t*>(&word),
+                FUTEX_WAIT,
+                value,
+                &ts,
+                nullptr,
+                0);
+    }
+
+    static void FutexWake(std::atomic<uint32_t>& word) noexcept
+    {
+        syscall(SYS_futex,
+                reinterpret_cast<uint32_t*>(&word),
+                FUTEX_WAKE,
+                INT32_MAX,
+                nullptr,
+                nullptr,
+                0);
+    }
+
+    static void Advance(std::atomic<uint32_t>& counter,
+                        std::atomic<uint32_t>& waiting,
+                        uint32_t value) noexcept
+    {
+        counter.store(value, std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_seq_cst)) FutexWake(counter);
+    }
+
+    /* waits for counter to move past value, false on timeout or close */
+    bool Await(std::atomic<uint32_t>& counter,
+               std::atomic<uint32_t>& waiting,
+               uint32_t value,
+               std::chrono::nanoseconds timeout) noexcept
+    {
+        for (unsigned spins = 0; spins < SPIN; spins++)
+            if (counter.load(std::memory_order_acquire) != value) return true;
+
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (counter.load(std::memory_order_acquire) == value) {
+            if (header->closed.load(std::memory_order_relaxed)) return false;
+            auto left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::nanoseconds{ 0 }) return false;
+            waiting.store(1, std::memory_order_seq_cst);
+            if (counter.load(std::memory_order_seq_cst) == value)
+                FutexWait(counter,
+                          value,
+                          std::chrono::nanoseconds{ left }.count());
+            waiting.store(0, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    uint8_t* Slot(uint32_t step) const noexcept
+    {
+        return slots + size_t(step % header->depth) * layout.size;
+    }
+
+  public:
+    /**
+     * Creates the shared memory object, replacing a stale one of the same
+     * name.
+     * @param name the object name, like "/chip8-obs"
+     * @param envs the number of environments
+     * @param depth the number of slots, two lets the engine fill the next
+     * step while the trainer still reads the actions of the last one
+     * @param error set to the reason on failure
+     * @return the engine side of the ring, or nullptr on failure
+     */
+    static std::unique_ptr<ObservationRing> Create(const std::string& name,
+                                                   size_t envs,
+                                                   unsigned depth,
+                                                   std::string& error)
+    {
+        Layout layout{ envs };
+        size_t size = sizeof(Header) + layout.size * std::max(depth, 1u);
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 || ftruncate(fd, size) != 0) {
+            if (fd >= 0) close(fd);
+            error = "cannot create shared memory " + name;
+            return nullptr;
+        }
+        void* map =
+          mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            error = "cannot map shared memory " + name;
+            return nullptr;
+        }
+
+        std::unique_ptr<ObservationRing> ring{ new ObservationRing{
+          map, size, envs } };
+        Header& h = *ring->header;
+        h.version = VERSION;
+        h.envs = envs;
+        h.depth = std::max(depth, 1u);
+        h.slot_size = layout.size;
+        /* the trainer only trusts the object once the magic is there */
+        h.magic.store(MAGIC, std::memory_order_release);
+        ring->owned_name = name;
+        return ring;
+    }
+
+    /**
+     * Maps an object made by Create() in another process.
+     * @param name the object name given to Create()
+     * @param error set to the reason on failure
+     * @return the trainer side of the ring, or nullptr if the object does
+     * not exist or is not set up yet
+     */
+    static std::unique_ptr<ObservationRing> Attach(const std::string& name,
+                                                   std::string& error)
+    {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 ||
+            size_t(st.st_size) < sizeof(Header)) {
+            if (fd >= 0) close(fd);
+            error = "cannot open shared memory " + name;
+            return nullptr;
+        }
+        void* map =
+          mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            error = "cannot map shared memory " + name;
+            return nullptr;
+        }
+
+        auto* h = static_cast<Header*>(map);
+        if (h->magic.load(std::memory_order_acquire) != MAGIC ||
+            h->version != VERSION || h->slot_size != Layout{ h->envs }.size ||
+            sizeof(Header) + size_t(h->slot_size) * h->depth >
+              size_t(st.st_size)) {
+            munmap(map, st.st_size);
+            error = name + " is not an observation ring of this build";
+            return nullptr;
+        }
+        std::unique_ptr<ObservationRing> ring{ new ObservationRing{
+          map, size_t(st.st_size), h->envs } };
+        ring->seen = h->acted.load(std::memory_order_acquire);
+        return ring;
+    }
+
+    ObservationRing(const ObservationRing&) = delete;
+    ObservationRing& operator=(const ObservationRing&) = delete;
+
+    ~ObservationRing()
+    {
+        if (owned_name.empty() == false) {
+            Close();
+            shm_unlink(owned_name.c_str());
+        }
+        munmap(header, map_size);
+    }
+
+    /**
+     * Returns the number of environments.
+     */
+    size_t Envs() const noexcept
+    {
+        return header->envs;
+    }
+
+    /**
+     * Engine side: writes the observation of an environment for the step
+     * being filled.
+     * @param env the environment
+     * @param chip8 its instance after the step, InputPolled() is passed on
+     * @param reward the reward of the step
+     * @param done whether the episode ended
+     */
+    void Write(size_t env, system& chip8, float reward, bool done) noexcept
+    {
+        uint8_t* slot = Slot(header->observed.load(std::memory_order_relaxed));
+        PackedFrame frame = PackDisplay(chip8);
+        std::memcpy(slot + layout.frames + env * sizeof(PackedFrame),
+                    frame.data(),
+                    sizeof(PackedFrame));
+        std::memcpy(slot + layout.rewards + env * sizeof(float),
+                    &reward,
+                    sizeof(float));
+        slot[layout.dones + env] = done;
+        slot[layout.polled + env] = chip8.InputPolled();
+    }
+
+    /**
+     * Engine side: hands the filled step to the trainer.
+     */
+    void Publish() noexcept
+    {
+        Advance(header->observed,
+                header->observed_waiting,
+                header->observed.load(std::memory_order_relaxed) + 1);
+    }
+
+    /**
+     * Engine side: waits for the trainer to Act() on the last published
+     * step.
+     * @param timeout the longest to wait
+     * @return false on timeout
+     */
+    bool WaitActions(std::chrono::nanoseconds timeout) noexcept
+    {
+        uint32_t want = header->observed.load(std::memory_order_relaxed);
+        uint32_t acted;
+        while ((acted = header->acted.load(std::memory_order_acquire)) !=
+               want)
+            if (Await(header->acted, header->acted_waiting, acted, timeout) ==
+                false)
+                return false;
+        return true;
+    }
+
+    /**
+     * Engine side: returns the keys the trainer chose for an environment,
+     * one bit per KeyCode, valid after WaitActions().
+     * @param env the environment
+     */
+    uint16_t Action(size_t env) const noexcept
+    {
+        const uint8_t* slot =
+          Slot(header->observed.load(std::memory_order_relaxed) - 1);
+        uint16_t keys;
+        std::memcpy(&keys,
+                    slot + layout.actions + env * sizeof(uint16_t),
+                    sizeof keys);
+        return keys;
+    }
+
+    /**
+     * Engine side: wakes the trainer and makes Observe() fail from now on.
+     */
+    void Close() noexcept
+    {
+        header->closed.store(1, std::memory_order_seq_cst);
+        FutexWake(header->observed);
+    }
+
+    /**
+     * Trainer side: waits for the next step.
+     * @param timeout the longest to wait
+     * @return false on timeout or once the engine closed the ring
+     */
+    bool Observe(std::chrono::nanoseconds timeout) noexcept
+    {
+        if (Await(header->observed, header->observed_waiting, seen, timeout) ==
+            false)
+            return false;
+        seen = header->observed.load(std::memory_order_acquire);
+        return true;
+    }
+
+    /**
+     * Trainer side: returns the packed frames of the step Observe() returned
+     * for, one per environment.
+     */
+    const PackedFrame* Frames() const noexcept
+    {
+        return reinterpret_cast<const PackedFrame*>(Slot(seen - 1) +
+                                                    layout.frames);
+    }
+
+    /**
+     * Trainer side: returns the rewards of the step, one per environment.
+     */
+    const float* Rewards() const noexcept
+    {
+        return reinterpret_cast<const float*>(Slot(seen - 1) +
+                                              layout.rewards);
+    }
+
+    /**
+     * Trainer side: returns the done flags of the step, one per environment.
+     */
+    const uint8_t* Dones() const noexcept
+    {
+        return Slot(seen - 1) + layout.dones;
+    }
+
+    /**
+     * Trainer side: returns whether each environment read the keypad during
+     * the step. Actions given to an environment that did not could not have
+     * changed its step.
+     */
+    const uint8_t* Polled() const noexcept
+    {
+        return Slot(seen - 1) + layout.polled;
+    }
+
+    /**
+     * Trainer side: returns the actions to fill in before Act(), one key
+     * bitset per environment.
+     */
+    uint16_t* Actions() noexcept
+    {
+        return reinterpret_cast<uint16_t*>(Slot(seen - 1) + layout.actions);
+    }
+
+    /**
+     * Trainer side: hands the actions to the engine.
+     */
+    void Act() noexcept
+    {
+        Advance(header->acted, header->acted_waiting, seen);
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,251 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_POOL
+#define BASED_CHIP8_POOL
+
+#include "libchip8++.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * A fixed capacity slab of memory handed out in equally sized, cache line
+ * aligned slots. The whole slab is requested once at construction, from the
+ * allocator or from hooks that decide where it lives, slots are only ever
+ * bump allocated and the memory is given back when the Arena itself is
+ * destroyed.
+ */
+class Arena {
+  public:
+    /**
+     * Returns a slab of the size asked for, or nullptr if there is none.
+     */
+    using SlabAllocator = std::function<void*(size_t size)>;
+
+    /**
+     * Gives back a slab, along with the size it was allocated with.
+     */
+    using SlabReleaser = std::function<void(void* slab, size_t size)>;
+
+  private:
+    static constexpr size_t ALIGN = 64;
+
+    std::byte* storage;
+    size_t storage_size;
+    SlabReleaser release;
+    std::byte* base;
+    size_t slot_size;
+    size_t capacity;
+    size_t used;
+
+  public:
+    /**
+     * Constructs the Arena on a slab from operator new.
+     * @param slot_size size in bytes of a single slot, rounded up to a
+     * multiple of the cache line size
+     * @param capacity the number of slots the arena can hand out
+     */
+    Arena(size_t slot_size, size_t capacity)
+      : Arena(
+          slot_size,
+          capacity,
+          [](size_t size) { return static_cast<void*>(new std::byte[size]); },
+          [](void* slab, size_t) { delete[] static_cast<std::byte*>(slab); })
+    {
+    }
+
+    /**
+     * Constructs the Arena on a slab from hooks.
+     * @param slot_size size in bytes of a single slot, rounded up to a
+     * multiple of the cache line size
+     * @param capacity the number of slots the arena can hand out
+     * @param allocate called once for the slab, which need not be aligned,
+     * std::bad_alloc is thrown if it returns nullptr
+     * @param release called with the slab when the Arena is destroyed
+     */
+    Arena(size_t slot_size,
+          size_t capacity,
+          const SlabAllocator& allocate,
+          SlabReleaser release)
+      : storage_size{ ((slot_size + ALIGN - 1) & ~(ALIGN - 1)) * capacity +
+                      ALIGN }
+      , release{ std::move(release) }
+      , slot_size{ (slot_size + ALIGN - 1) & ~(ALIGN - 1) }
+      , capacity{ capacity }
+      , used{ 0 }
+    {
+        storage = static_cast<std::byte*>(allocate(storage_size));
+        if (storage == nullptr) throw std::bad_alloc{};
+        auto addr = reinterpret_cast<uintptr_t>(storage);
+        base = storage + ((ALIGN - (addr & (ALIGN - 1))) & (ALIGN - 1));
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena()
+    {
+        release(storage, storage_size);
+    }
+
+    /**
+     * Hands out the next unused slot.
+     * @return pointer to uninitialised storage or nullptr if the arena is full
+     */
+    void* Allocate() noexcept
+    {
+        if (used == capacity) return nullptr;
+        return base + slot_size * used++;
+    }
+
+    /**
+     * Returns the slot at an index, the slot must have been allocated.
+     * @param idx index of the slot in allocation order
+     */
+    void* Slot(size_t idx) noexcept
+    {
+        return base + slot_size * idx;
+    }
+
+    /**
+     * Returns the number of slots handed out so far.
+     */
+    size_t Used() const noexcept
+    {
+        return used;
+    }
+
+    /**
+     * Returns the maximum number of slots this arena can hand out.
+     */
+    size_t Capacity() const noexcept
+    {
+        return capacity;
+    }
+};
+
+/**
+ * Recycles Chip8 instances for workloads that create and throw away machines
+ * at a high rate, like short search rollouts.
+ * Every instance starts as a copy of a pristine template system (font, ROM
+ * and colors already set up, possibly run past power-on) living in an Arena
+ * slot. Released instances go on a free list and are brought back to the
+ * template state on the next Acquire() through system::reset(), which only
+ * restores what the instance touched.
+ * Random engines are re-seeded from an internal counter so the steady state
+ * never touches std::random_device or the allocator.
+ */
+class Pool {
+  private:
+    Arena arena;
+    system pristine;
+    BootImage image;
+    std::vector<system*> free_list;
+    uint64_t seed_state;
+
+    /* splitmix64, cheap and good enough to decorrelate instance seeds */
+    uint32_t NextSeed() noexcept
+    {
+        uint64_t z = (seed_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return static_cast<uint32_t>(z ^ (z >> 31));
+    }
+
+  public:
+    /**
+     * Constructs the Pool.
+     * @param pristine the state every acquired instance starts from
+     * @param capacity maximum number of live instances
+     * @param seed base seed for the per-instance random engines
+     */
+    Pool(const system& pristine, size_t capacity, uint64_t seed = 0)
+      : arena{ sizeof(system), capacity }
+      , pristine{ pristine }
+      , image{ this->pristine.RefMemory() }
+      , seed_state{ seed }
+    {
+        free_list.reserve(capacity);
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    ~Pool()
+    {
+        for (size_t i = 0; i < arena.Used(); i++)
+            static_cast<system*>(arena.Slot(i))->~system();
+    }
+
+    /**
+     * Hands out an instance in the pristine state.
+     * @return pointer to the instance or nullptr if all slots are live
+     */
+    system* Acquire() noexcept
+    {
+        system* chip8;
+        if (free_list.empty() == false) {
+            chip8 = free_list.back();
+            free_list.pop_back();
+            chip8->reset(pristine, image);
+            chip8->display_fg = pristine.display_fg;
+            chip8->display_bg = pristine.display_bg;
+        } else {
+            void* slot = arena.Allocate();
+            if (slot == nullptr) return nullptr;
+            chip8 = new (slot) system{ pristine };
+        }
+        chip8->Seed(NextSeed());
+        return chip8;
+    }
+
+    /**
+     * Gives an instance back to the pool. The instance must not be used
+     * afterwards.
+     * @param chip8 an instance previously returned by Acquire()
+     */
+    void Release(system* chip8) noexcept
+    {
+        free_list.push_back(chip8);
+    }
+
+    /**
+     * Returns the number of instances currently handed out.
+     */
+    size_t Live() const noexcept
+    {
+        return arena.Used() - free_list.size();
+    }
+
+    /**
+     * Returns the maximum number of live instances.
+     */
+    size_t Capacity() const noexcept
+    {
+        return arena.Capacity();
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
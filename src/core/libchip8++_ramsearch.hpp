@@ -0,0 +1,477 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_RAMSEARCH
+#define BASED_CHIP8_RAMSEARCH
+
+#include "libchip8++.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace Chip8_core {
+
+/**
+ * Contains named constants for the tests RamSearch::Filter() can apply to
+ * an address.
+ */
+enum RamPredicate {
+    INCREASED, /**< Went up from each snapshot to the next. */
+    DECREASED, /**< Went down from each snapshot to the next. */
+    CHANGED,   /**< Differed from each snapshot to the next. */
+    UNCHANGED, /**< Stayed the same from each snapshot to the next. */
+    EQUALS,    /**< Held a given value in every snapshot. */
+};
+
+/**
+ * Contains named constants for what RamSearch::Rank() correlates with the
+ * signal.
+ */
+enum RamSeries {
+    VALUES, /**< The byte in each snapshot. */
+    DELTAS, /**< The change of the byte since the previous snapshot. */
+};
+
+/**
+ * An address ranked by RamSearch::Rank().
+ */
+struct RamCandidate {
+    uint16_t addr;      /**< The memory address. */
+    double correlation; /**< Pearson correlation with the signal. */
+};
+
+/**
+ * Finds the addresses a ROM keeps its score, lives or positions at, by
+ * narrowing down candidates over a series of memory snapshots the way
+ * cheat finders do, and by ranking them by correlation with a signal such
+ * as the reward or a held key.
+ *
+ * Snapshots are stored as 32 byte aligned rows of the whole memory, packed
+ * in blocks. Every address is a column, so the scans walk down the rows
+ * with 32 addresses to an AVX2 register, and the rows are read from
+ * memory once per scan. Machines without AVX2, and builds for other
+ * architectures, take a scalar path with the same results.
+ *
+ * Snapshots may come from several runs, pairs of snapshots are never
+ * compared across the start of a run.
+ */
+class RamSearch {
+  private:
+    static constexpr size_t ROW = Constants::MEMSIZE;
+    static constexpr size_t BLOCK_ROWS = 256;
+    /* float sums of this many rows stay exact before they are flushed */
+    static constexpr size_t FLUSH = 256;
+
+    struct alignas(32) Block {
+        uint8_t rows[BLOCK_ROWS][ROW];
+    };
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<uint8_t> run_start; /* per snapshot */
+    size_t size;
+    bool new_run;
+    bool simd;
+    alignas(32) std::array<uint8_t, ROW> mask; /* 0xFF for candidates */
+
+    const uint8_t* Row(size_t t) const noexcept
+    {
+        return blocks[t / BLOCK_ROWS]->rows[t % BLOCK_ROWS];
+    }
+
+    bool HasAvx2() const noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        static const bool avx2 = __builtin_cpu_supports("avx2") &&
+                                 __builtin_cpu_supports("fma");
+        return simd && avx2;
+#else
+        return false;
+#endif
+    }
+
+    template<RamPredicate P>
+    static uint8_t Test(uint8_t prev, uint8_t cur, uint8_t value) noexcept
+    {
+        switch (P) {
+            case INCREASED:
+                return cur > prev ? 0xFF : 0;
+            case DECREASED:
+                return cur < prev ? 0xFF : 0;
+            case CHANGED:
+                return cur != prev ? 0xFF : 0;
+            case UNCHANGED:
+                return cur == prev ? 0xFF : 0;
+            default:
+                return cur == value ? 0xFF : 0;
+        }
+    }
+
+    template<RamPredicate P>
+    void FilterScalar(size_t first, size_t last, uint8_t value) noexcept
+    {
+        for (size_t t = first; t < last; t++) {
+            if (P != EQUALS && run_start[t]) continue;
+            const uint8_t* cur = Row(t);
+            const uint8_t* prev = P != EQUALS ? Row(t - 1) : cur;
+            for (size_t a = 0; a < ROW; a++)
+                mask[a] &= Test<P>(prev[a], cur[a], value);
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    template<RamPredicate P>
+    [[gnu::target("avx2")]] void FilterAvx2(size_t first,
+                                            size_t last,
+                                            uint8_t value) noexcept
+    {
+        const __m256i v = _mm256_set1_epi8(static_cast<char>(value));
+        const __m256i ones = _mm256_set1_epi8(-1);
+        for (size_t t = first; t < last; t++) {
+            if (P != EQUALS && run_start[t]) continue;
+            const uint8_t* cur = Row(t);
+            const uint8_t* prev = P != EQUALS ? Row(t - 1) : cur;
+            for (size_t a = 0; a < ROW; a += 32) {
+                auto* m = reinterpret_cast<__m256i*>(&mask[a]);
+                __m256i c = _mm256_load_si256(
+                  reinterpret_cast<const __m256i*>(cur + a));
+                __m256i p = _mm256_load_si256(
+                  reinterpret_cast<const __m256i*>(prev + a));
+                __m256i same = _mm256_cmpeq_epi8(c, p);
+                __m256i keep;
+                switch (P) {
+                    case INCREASED: /* max(c, p) == c and c != p */
+                        keep = _mm256_andnot_si256(
+                          same, _mm256_cmpeq_epi8(_mm256_max_epu8(c, p), c));
+                        break;
+                    case DECREASED:
+                        keep = _mm256_andnot_si256(
+                          same, _mm256_cmpeq_epi8(_mm256_min_epu8(c, p), c));
+                        break;
+                    case CHANGED:
+                        keep = _mm256_xor_si256(same, ones);
+                        break;
+                    case UNCHANGED:
+                        keep = same;
+                        break;
+                    default:
+                        keep = _mm256_cmpeq_epi8(c, v);
+                        break;
+                }
+                _mm256_store_si256(
+                  m, _mm256_and_si256(_mm256_load_si256(m), keep));
+            }
+        }
+    }
+
+#endif
+
+    template<RamPredicate P>
+    void FilterRows(size_t first, size_t last, uint8_t value) noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (HasAvx2()) return FilterAvx2<P>(first, last, value);
+#endif
+        FilterScalar<P>(first, last, value);
+    }
+
+    /* per address sums over the snapshots paired with the signal */
+    struct Sums {
+        std::vector<double> x, xx, xy;
+        double y = 0, yy = 0, n = 0;
+    };
+
+    void SumScalar(std::span<const float> signal,
+                   RamSeries series,
+                   Sums& s) const noexcept
+    {
+        size_t rows = std::min(size, signal.size());
+        for (size_t t = 0; t < rows; t++) {
+            if (series == DELTAS && run_start[t]) continue;
+            const uint8_t* cur = Row(t);
+            const uint8_t* prev = series == DELTAS ? Row(t - 1) : nullptr;
+            double y = signal[t];
+            for (size_t a = 0; a < ROW; a++) {
+                double x = prev ? double(cur[a]) - prev[a] : double(cur[a]);
+                s.x[a] += x;
+                s.xx[a] += x * x;
+                s.xy[a] += x * y;
+            }
+            s.y += y;
+            s.yy += y * y;
+            s.n++;
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    /* eight addresses at a time in float, flushed to the double sums every
+     * FLUSH rows */
+    [[gnu::target("avx2,fma")]] void SumAvx2(std::span<const float> signal,
+                                             RamSeries series,
+                                             Sums& s) const noexcept
+    {
+        alignas(32) static thread_local float fx[ROW], fxx[ROW], fxy[ROW];
+        auto flush = [&] {
+            for (size_t a = 0; a < ROW; a++) {
+                s.x[a] += fx[a];
+                s.xx[a] += fxx[a];
+                s.xy[a] += fxy[a];
+                fx[a] = fxx[a] = fxy[a] = 0;
+            }
+        };
+        std::fill_n(fx, ROW, 0.0f);
+        std::fill_n(fxx, ROW, 0.0f);
+        std::fill_n(fxy, ROW, 0.0f);
+
+        size_t rows = std::min(size, signal.size()), pending = 0;
+        for (size_t t = 0; t < rows; t++) {
+            if (series == DELTAS && run_start[t]) continue;
+            const uint8_t* cur = Row(t);
+            const uint8_t* prev = series == DELTAS ? Row(t - 1) : nullptr;
+            const __m256 y = _mm256_set1_ps(signal[t]);
+            for (size_t a = 0; a < ROW; a += 8) {
+                __m256i c = _mm256_cvtepu8_epi32(
+                  _mm_loadl_epi64(reinterpret_cast<const __m128i*>(cur + a)));
+                if (prev)
+                    c = _mm256_sub_epi32(
+                      c,
+                      _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                        reinterpret_cast<const __m128i*>(prev + a))));
+                __m256 x = _mm256_cvtepi32_ps(c);
+                _mm256_store_ps(fx + a,
+                                _mm256_add_ps(_mm256_load_ps(fx + a), x));
+                _mm256_store_ps(fxx + a,
+                                _mm256_fmadd_ps(x, x, _mm256_load_ps(fxx + a)));
+                _mm256_store_ps(fxy + a,
+                                _mm256_fmadd_ps(x, y, _mm256_load_ps(fxy + a)));
+            }
+            s.y += signal[t];
+            s.yy += double(signal[t]) * signal[t];
+            s.n++;
+            if (++pending == FLUSH) {
+                flush();
+                pending = 0;
+            }
+        }
+        flush();
+    }
+#endif
+
+    Sums Sum(std::span<const float> signal, RamSeries series) const
+    {
+        Sums s;
+        s.x.assign(ROW, 0);
+        s.xx.assign(ROW, 0);
+        s.xy.assign(ROW, 0);
+#if defined(__x86_64__) || defined(__i386__)
+        if (HasAvx2()) {
+            SumAvx2(signal, series, s);
+            return s;
+        }
+#endif
+        SumScalar(signal, series, s);
+        return s;
+    }
+
+    static double Correlation(const Sums& s, size_t a) noexcept
+    {
+        double cov = s.n * s.xy[a] - s.x[a] * s.y;
+        double vx = s.n * s.xx[a] - s.x[a] * s.x[a];
+        double vy = s.n * s.yy - s.y * s.y;
+        return vx > 0 && vy > 0 ? cov / std::sqrt(vx * vy) : 0.0;
+    }
+
+  public:
+    /**
+     * Constructs an empty RamSearch with every address a candidate.
+     * @param simd whether to use AVX2 when the machine has it, the scalar
+     * path gives the same results
+     */
+    RamSearch(bool simd = true)
+      : size{ 0 }
+      , new_run{ true }
+      , simd{ simd }
+    {
+        mask.fill(0xFF);
+    }
+
+    /**
+     * Appends the memory of a system as the next snapshot.
+     * @param Chip8 the system
+     */
+    void Add(system& Chip8)
+    {
+        if (size % BLOCK_ROWS == 0) blocks.push_back(std::make_unique<Block>());
+        std::memcpy(blocks.back()->rows[size % BLOCK_ROWS],
+                    Chip8.RefMemory().data(),
+                    ROW);
+        run_start.push_back(new_run);
+        new_run = false;
+        size++;
+    }
+
+    /**
+     * Makes the next snapshot the first of a new run, it will not be
+     * compared with the one before it.
+     */
+    void NewRun() noexcept
+    {
+        new_run = true;
+    }
+
+    /**
+     * Returns the number of snapshots.
+     */
+    size_t Size() const noexcept
+    {
+        return size;
+    }
+
+    /**
+     * Makes every address a candidate again.
+     */
+    void Reset() noexcept
+    {
+        mask.fill(0xFF);
+    }
+
+    /**
+     * Keeps the candidates passing a test over a range of snapshots.
+     * @param pred the test, every pair of consecutive snapshots in the range
+     * must pass it, or for EQUALS every snapshot
+     * @param value the value EQUALS looks for
+     * @param first the first snapshot of the range
+     * @param last one past the last snapshot, clamped to Size()
+     * @return the number of candidates left
+     */
+    size_t Filter(RamPredicate pred,
+                  uint8_t value = 0,
+                  size_t first = 0,
+                  size_t last = SIZE_MAX) noexcept
+    {
+        last = std::min(last, size);
+        /* the first snapshot has nothing before it to compare with */
+        if (pred != EQUALS && first == 0) first = 1;
+        if (first < last) switch (pred) {
+                case INCREASED:
+                    FilterRows<INCREASED>(first, last, value);
+                    break;
+                case DECREASED:
+                    FilterRows<DECREASED>(first, last, value);
+                    break;
+                case CHANGED:
+                    FilterRows<CHANGED>(first, last, value);
+                    break;
+                case UNCHANGED:
+                    FilterRows<UNCHANGED>(first, last, value);
+                    break;
+                case EQUALS:
+                    FilterRows<EQUALS>(first, last, value);
+                    break;
+            }
+        return Candidates();
+    }
+
+    /**
+     * Ranks the candidates by how strongly they correlate with a signal,
+     * like the reward of each step or whether a key was held.
+     * @param signal one value per snapshot
+     * @param series whether the bytes or their changes are correlated, a
+     * change is paired with the signal of the snapshot it led to
+     * @param top the number of candidates to return
+     * @return the candidates with the largest absolute correlation first
+     */
+    std::vector<RamCandidate> Rank(std::span<const float> signal,
+                                   RamSeries series = VALUES,
+                                   size_t top = 16) const
+    {
+        Sums sums = Sum(signal, series);
+        std::vector<RamCandidate> ranked;
+        for (size_t a = 0; a < ROW; a++)
+            if (mask[a])
+                ranked.push_back({ uint16_t(a), Correlation(sums, a) });
+        top = std::min(top, ranked.size());
+        std::partial_sort(ranked.begin(),
+                          ranked.begin() + top,
+                          ranked.end(),
+                          [](const RamCandidate& l, const RamCandidate& r) {
+                              return std::abs(l.correlation) >
+                                     std::abs(r.correlation);
+                          });
+        ranked.resize(top);
+        return ranked;
+    }
+
+    /**
+     * Keeps the candidates correlating with a signal at least as strongly
+     * as a threshold, in either direction.
+     * @param signal one value per snapshot
+     * @param min_abs the smallest absolute correlation kept
+     * @param series whether the bytes or their changes are correlated
+     * @return the number of candidates left
+     */
+    size_t FilterCorrelated(std::span<const float> signal,
+                            double min_abs,
+                            RamSeries series = VALUES)
+    {
+        Sums sums = Sum(signal, series);
+        for (size_t a = 0; a < ROW; a++)
+            if (std::abs(Correlation(sums, a)) < min_abs) mask[a] = 0;
+        return Candidates();
+    }
+
+    /**
+     * Tells whether an address is still a candidate.
+     * @param addr the address
+     */
+    bool IsCandidate(uint16_t addr) const noexcept
+    {
+        return mask[addr & (ROW - 1)] != 0;
+    }
+
+    /**
+     * Returns the number of candidates.
+     */
+    size_t Candidates() const noexcept
+    {
+        return std::count(mask.begin(), mask.end(), 0xFF);
+    }
+
+    /**
+     * Returns the candidate addresses in increasing order.
+     */
+    std::vector<uint16_t> CandidateList() const
+    {
+        std::vector<uint16_t> list;
+        for (size_t a = 0; a < ROW; a++)
+            if (mask[a]) list.push_back(a);
+        return list;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,504 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_REFERENCE
+#define BASED_CHIP8_REFERENCE
+
+#include "libchip8++.hpp"
+#include "libchip8++_workers.hpp"
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Chip8_core {
+
+namespace Reference {
+
+/**
+ * Executes one opcode the plainest possible way, as a yardstick for
+ * Instructions::execute() and anything faster built later. Every case reads
+ * its operands first and writes its results after, VF last, straight from
+ * the instruction tables with nothing shared between cases. Keep it that
+ * way: speed does not matter here, being obviously right does.
+ * @param mode the quirks to follow
+ * @param op the opcode
+ * @param c the system to execute it on
+ */
+constexpr void
+execute(Quirks mode, uint16_t op, system& c)
+{
+    const auto X = static_cast<Registers>((op >> 8) & 0xF);
+    const auto Y = static_cast<Registers>((op >> 4) & 0xF);
+    const uint8_t N = op & 0xF;
+    const uint8_t NN = op & 0xFF;
+    const uint16_t NNN = op & 0xFFF;
+    const uint8_t vx = c.GetRegister(X);
+    const uint8_t vy = c.GetRegister(Y);
+    const uint16_t I = c.GetIndexRegister();
+    const uint16_t PC = c.GetPC();
+
+    switch (op >> 12) {
+        case 0x0:
+            if (op == 0x00E0) {
+                for (uint16_t i = 0; i < Constants::DISPW * Constants::DISPH;
+                     i++)
+                    c.SetPixel(i, 0);
+            } else if (op == 0x00EE) {
+                c.SetPC(c.RefStack()[c.GetStackTop()]);
+                c.SetStackTop(c.GetStackTop() - 1);
+            }
+            return;
+        case 0x1:
+            c.SetPC(NNN);
+            return;
+        case 0x2:
+            c.SetStackTop(c.GetStackTop() + 1);
+            c.RefStack()[c.GetStackTop()] = PC;
+            c.SetPC(NNN);
+            return;
+        case 0x3:
+            if (vx == NN) c.SetPC(PC + 2);
+            return;
+        case 0x4:
+            if (vx != NN) c.SetPC(PC + 2);
+            return;
+        case 0x5:
+            if (N == 0 && vx == vy) c.SetPC(PC + 2);
+            return;
+        case 0x6:
+            c.SetRegister(X, NN);
+            return;
+        case 0x7:
+            c.SetRegister(X, vx + NN);
+            return;
+        case 0x8: {
+            /* MATT shifts VY into VX, COWGOD shifts VX in place */
+            const uint8_t src = mode == Quirks::MATT ? vy : vx;
+            switch (N) {
+                case 0x0:
+                    c.SetRegister(X, vy);
+                    return;
+                case 0x1:
+                    c.SetRegister(X, vx | vy);
+                    return;
+                case 0x2:
+                    c.SetRegister(X, vx & vy);
+                    return;
+                case 0x3:
+                    c.SetRegister(X, vx ^ vy);
+                    return;
+                case 0x4:
+                    c.SetRegister(X, vx + vy);
+                    c.SetRegister(Registers::RF, vx + vy > 0xFF);
+                    return;
+                case 0x5:
+                    c.SetRegister(X, vx - vy);
+                    c.SetRegister(Registers::RF, vx >= vy);
+                    return;
+                case 0x6:
+                    c.SetRegister(X, src >> 1);
+                    c.SetRegister(Registers::RF, src & 1);
+                    return;
+                case 0x7:
+                    c.SetRegister(X, vy - vx);
+                    c.SetRegister(Registers::RF, vy >= vx);
+                    return;
+                case 0xE:
+                    c.SetRegister(X, src << 1);
+                    c.SetRegister(Registers::RF, src >> 7);
+                    return;
+            }
+            return;
+        }
+        case 0x9:
+            if (N == 0 && vx != vy) c.SetPC(PC + 2);
+            return;
+        case 0xA:
+            c.SetIndexRegister(NNN);
+            return;
+        case 0xB:
+            c.SetPC(c.GetRegister(Registers::R0) + NNN);
+            return;
+        case 0xC:
+            c.SetRegister(X, c.InternalRand() & NN);
+            return;
+        case 0xD: {
+            /* the origin wraps, the sprite is clipped at the edges */
+            bool collision = false;
+            for (int row = 0; row < N; row++) {
+                int y = vy % Constants::DISPH + row;
+                if (y >= Constants::DISPH) break;
+                uint8_t bits = c.GetMemory(I + row);
+                for (int col = 0; col < 8; col++) {
+                    int x = vx % Constants::DISPW + col;
+                    if (x >= Constants::DISPW) break;
+                    if ((bits >> (7 - col) & 1) == 0) continue;
+                    uint16_t idx = y * Constants::DISPW + x;
+                    bool was_lit = c.IsLit(idx);
+                    collision = collision || was_lit;
+                    c.SetPixel(idx, was_lit ? c.display_bg : c.display_fg);
+                }
+            }
+            c.SetRegister(Registers::RF, collision);
+            return;
+        }
+        case 0xE:
+            if (NN == 0x9E && c.GetKey(static_cast<KeyCode>(vx & 0xF)))
+                c.SetPC(PC + 2);
+            if (NN == 0xA1 && !c.GetKey(static_cast<KeyCode>(vx & 0xF)))
+                c.SetPC(PC + 2);
+            return;
+        case 0xF:
+            switch (NN) {
+                case 0x07:
+                    c.SetRegister(X, c.GetDT());
+                    return;
+                case 0x0A:
+                    /* latch the highest key held, then wait for its
+                     * release, repeating the instruction meanwhile */
+                    if (c.isHalted()) {
+                        if (c.GetKey(static_cast<KeyCode>(vx & 0xF))) {
+                            c.SetPC(PC - 2);
+                        } else {
+                            c.setHalt(false);
+                        }
+                        return;
+                    }
+                    c.SetPC(PC - 2);
+                    for (int k = 0xF; k >= 0; k--) {
+                        if (c.GetKey(static_cast<KeyCode>(k))) {
+                            c.SetRegister(X, k);
+                            c.setHalt(true);
+                            return;
+                        }
+                    }
+                    return;
+                case 0x15:
+                    c.SetDT(vx);
+                    return;
+                case 0x18:
+                    c.SetST(vx);
+                    return;
+                case 0x1E:
+                    c.SetIndexRegister(I + vx);
+                    return;
+                case 0x29:
+                    c.SetIndexRegister(Constants::FONT_ADDR + (vx & 0xF) * 5);
+                    return;
+                case 0x33:
+                    c.SetMemory(I, vx / 100);
+                    c.SetMemory(I + 1, vx / 10 % 10);
+                    c.SetMemory(I + 2, vx % 10);
+                    return;
+                case 0x55:
+                    /* V0 to VX inclusive, MATT leaves I past the last */
+                    for (int r = 0; r <= ((op >> 8) & 0xF); r++)
+                        c.SetMemory(I + r,
+                                    c.GetRegister(static_cast<Registers>(r)));
+                    if (mode == Quirks::MATT)
+                        c.SetIndexRegister(I + ((op >> 8) & 0xF) + 1);
+                    return;
+                case 0x65:
+                    for (int r = 0; r <= ((op >> 8) & 0xF); r++)
+                        c.SetRegister(static_cast<Registers>(r),
+                                      c.GetMemory(I + r));
+                    if (mode == Quirks::MATT)
+                        c.SetIndexRegister(I + ((op >> 8) & 0xF) + 1);
+                    return;
+            }
+            return;
+    }
+}
+
+} // namespace Reference
+
+/**
+ * A state on which Instructions::execute() and Reference::execute()
+ * disagreed.
+ */
+struct Mismatch {
+    uint16_t opcode;    /**< The opcode executed. */
+    Quirks mode;        /**< The quirks it was executed with. */
+    std::string before; /**< The registers and memory at I beforehand. */
+    std::string diff;   /**< What differed afterwards. */
+};
+
+/**
+ * The outcome of DiffChecker::Run().
+ */
+struct DiffReport {
+    uint64_t cases;                /**< Cases run. */
+    uint64_t mismatches;           /**< Cases on which the two disagreed. */
+    std::vector<Mismatch> samples; /**< The first few mismatches. */
+};
+
+/**
+ * Randomised differential testing of the instruction handlers. Every case
+ * picks an opcode, mostly from the instruction table with random operands,
+ * randomises the registers, I, PC, stack, timers, keypad and the memory
+ * around I, and executes it through both Instructions::execute() and
+ * Reference::execute(). Each worker keeps a pair of machines that are only
+ * ever changed in lockstep, so memory and display carry over between cases
+ * and comparing them costs no more than comparing system::Hash().
+ */
+class DiffChecker {
+  private:
+    /* instruction table, the opcode is value | (random & operands) */
+    struct Pattern {
+        uint16_t value;
+        uint16_t operands;
+    };
+    static constexpr Pattern PATTERNS[] = {
+        { 0x00E0, 0x0000 }, { 0x00EE, 0x0000 }, { 0x0000, 0x0FFF },
+        { 0x1000, 0x0FFF }, { 0x2000, 0x0FFF }, { 0x3000, 0x0FFF },
+        { 0x4000, 0x0FFF }, { 0x5000, 0x0FF0 }, { 0x6000, 0x0FFF },
+        { 0x7000, 0x0FFF }, { 0x8000, 0x0FF0 }, { 0x8001, 0x0FF0 },
+        { 0x8002, 0x0FF0 }, { 0x8003, 0x0FF0 }, { 0x8004, 0x0FF0 },
+        { 0x8005, 0x0FF0 }, { 0x8006, 0x0FF0 }, { 0x8007, 0x0FF0 },
+        { 0x800E, 0x0FF0 }, { 0x9000, 0x0FF0 }, { 0xA000, 0x0FFF },
+        { 0xB000, 0x0FFF }, { 0xC000, 0x0FFF }, { 0xD000, 0x0FFF },
+        { 0xE09E, 0x0F00 }, { 0xE0A1, 0x0F00 }, { 0xF007, 0x0F00 },
+        { 0xF00A, 0x0F00 }, { 0xF015, 0x0F00 }, { 0xF018, 0x0F00 },
+        { 0xF01E, 0x0F00 }, { 0xF029, 0x0F00 }, { 0xF033, 0x0F00 },
+        { 0xF055, 0x0F00 }, { 0xF065, 0x0F00 }, { 0x0000, 0xFFFF },
+    };
+
+    /* what the report shows of the state before a case */
+    struct Snapshot {
+        std::array<uint8_t, Constants::REGCNT> registers;
+        std::array<uint8_t, 16> at_index;
+        uint16_t index, pc, stack_top_value;
+        int8_t stack_top;
+        uint8_t dt, st;
+        uint16_t keys;
+        bool halt;
+    };
+
+    WorkerPool& workers;
+    uint64_t seed;
+
+    static uint64_t NextRandom(uint64_t& state) noexcept
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint16_t Keys(system& c)
+    {
+        uint16_t keys = 0;
+        for (int k = 0; k < 16; k++)
+            keys |= c.GetKey(static_cast<KeyCode>(k)) << k;
+        return keys;
+    }
+
+    /* applies the same random scalars and memory window to both machines */
+    static Snapshot Randomise(system& a, system& b, uint64_t& rng)
+    {
+        Snapshot s;
+        uint64_t r = NextRandom(rng);
+        /* mostly in range, now and then anywhere to exercise wrapping */
+        s.index = (r & 7) ? (r >> 3) & 0xFFF : (r >> 3) & 0xFFFF;
+        s.pc = (r >> 20) & 0xFFE;
+        s.stack_top = (r >> 32) % (Constants::STACKSIZE - 1);
+        s.dt = r >> 40;
+        s.st = r >> 48;
+        s.halt = (r >> 56) & 1;
+
+        r = NextRandom(rng);
+        s.keys = r;
+        s.stack_top_value = (r >> 16) & 0xFFF;
+
+        r = NextRandom(rng);
+        for (int i = 0; i < 8; i++)
+            s.registers[i] = r >> (8 * i);
+        r = NextRandom(rng);
+        for (int i = 0; i < 8; i++)
+            s.registers[8 + i] = r >> (8 * i);
+        /* small register values make the skips and flags interesting */
+        r = NextRandom(rng);
+        for (int i = 0; i < 16; i++)
+            if ((r >> (4 * i) & 0xF) == 0) s.registers[i] &= 0xF;
+
+        r = NextRandom(rng);
+        uint64_t r2 = NextRandom(rng);
+        for (int i = 0; i < 8; i++) {
+            s.at_index[i] = r >> (8 * i);
+            s.at_index[8 + i] = r2 >> (8 * i);
+        }
+
+        for (system* c : { &a, &b }) {
+            for (int i = 0; i < Constants::REGCNT; i++)
+                c->SetRegister(static_cast<Registers>(i), s.registers[i]);
+            c->SetIndexRegister(s.index);
+            c->SetPC(s.pc);
+            c->SetStackTop(s.stack_top);
+            c->RefStack()[s.stack_top] = s.stack_top_value;
+            c->SetDT(s.dt);
+            c->SetST(s.st);
+            for (int k = 0; k < 16; k++)
+                c->SetKey(static_cast<KeyCode>(k), s.keys >> k & 1);
+            c->setHalt(s.halt);
+            for (int i = 0; i < 16; i++)
+                c->SetMemory(s.index + i, s.at_index[i]);
+        }
+        return s;
+    }
+
+    static std::string Describe(const Snapshot& s)
+    {
+        char buf[256];
+        std::string out;
+        for (int i = 0; i < Constants::REGCNT; i++) {
+            snprintf(buf, sizeof buf, "V%X=%02x ", i, s.registers[i]);
+            out += buf;
+        }
+        snprintf(buf,
+                 sizeof buf,
+                 "I=%04x PC=%03x SP=%d [SP]=%03x DT=%02x ST=%02x keys=%04x "
+                 "halt=%d mem[I..]=",
+                 s.index,
+                 s.pc,
+                 s.stack_top,
+                 s.stack_top_value,
+                 s.dt,
+                 s.st,
+                 s.keys,
+                 s.halt);
+        out += buf;
+        for (uint8_t v : s.at_index) {
+            snprintf(buf, sizeof buf, "%02x", v);
+            out += buf;
+        }
+        return out;
+    }
+
+    /* lists the differences between the production and reference results */
+    static std::string Diff(system& got, system& want)
+    {
+        char buf[128];
+        std::string out;
+        auto field = [&](const char* name, unsigned a, unsigned b) {
+            if (a == b) return;
+            snprintf(buf, sizeof buf, "%s=%x (want %x) ", name, a, b);
+            out += buf;
+        };
+        const char* names[] = { "V0", "V1", "V2", "V3", "V4", "V5",
+                                "V6", "V7", "V8", "V9", "VA", "VB",
+                                "VC", "VD", "VE", "VF" };
+        for (int i = 0; i < Constants::REGCNT; i++)
+            field(names[i],
+                  got.GetRegister(static_cast<Registers>(i)),
+                  want.GetRegister(static_cast<Registers>(i)));
+        field("I", got.GetIndexRegister(), want.GetIndexRegister());
+        field("PC", got.GetPC(), want.GetPC());
+        field("SP",
+              static_cast<uint8_t>(got.GetStackTop()),
+              static_cast<uint8_t>(want.GetStackTop()));
+        field("DT", got.GetDT(), want.GetDT());
+        field("ST", got.GetST(), want.GetST());
+        field("keys", Keys(got), Keys(want));
+        field("halt", got.isHalted(), want.isHalted());
+        char name[16];
+        for (int i = 0; i < Constants::STACKSIZE; i++)
+            if (got.RefStack()[i] != want.RefStack()[i]) {
+                snprintf(name, sizeof name, "stack[%d]", i);
+                field(name, got.RefStack()[i], want.RefStack()[i]);
+            }
+        for (int i = 0; i < Constants::MEMSIZE; i++)
+            if (got.GetMemory(i) != want.GetMemory(i)) {
+                snprintf(name, sizeof name, "mem[%03x]", i);
+                field(name, got.GetMemory(i), want.GetMemory(i));
+            }
+        int pixels = 0;
+        for (uint16_t i = 0; i < Constants::DISPW * Constants::DISPH; i++)
+            pixels += got.GetPixel(i) != want.GetPixel(i);
+        if (pixels) {
+            snprintf(buf, sizeof buf, "%d pixels differ ", pixels);
+            out += buf;
+        }
+        return out.empty() ? "random engine differs" : out;
+    }
+
+  public:
+    /**
+     * Constructs the DiffChecker.
+     * @param workers the threads to check on
+     * @param seed seeds the generated cases, equal seeds and thread counts
+     * generate the same cases
+     */
+    DiffChecker(WorkerPool& workers, uint64_t seed = 0)
+      : workers{ workers }
+      , seed{ seed }
+    {
+    }
+
+    /**
+     * Runs a number of random cases.
+     * @param mode the quirks to execute with
+     * @param cases the number of cases, spread over the workers
+     * @param max_samples the maximum number of mismatches to describe
+     * @return the number of mismatches and the first few of them
+     */
+    DiffReport Run(Quirks mode, uint64_t cases, size_t max_samples = 16)
+    {
+        DiffReport report{ cases, 0, {} };
+        std::mutex report_lock;
+        const unsigned threads = workers.Size();
+
+        workers.Run([&](unsigned worker) {
+            uint64_t rng = seed ^ (worker + 1) * 0xD1B54A32D192ED03ULL;
+            system production{ static_cast<uint32_t>(NextRandom(rng)) };
+            production.display_fg = 0xFFFFFFFF;
+            production.display_bg = 0x202020FF;
+            production.Hash();
+            system reference = production;
+
+            uint64_t share = cases / threads + (worker < cases % threads);
+            for (uint64_t i = 0; i < share; i++) {
+                uint64_t r = NextRandom(rng);
+                const Pattern& p =
+                  PATTERNS[r % (sizeof PATTERNS / sizeof PATTERNS[0])];
+                uint16_t op = p.value | ((r >> 32) & p.operands);
+
+                Snapshot before = Randomise(production, reference, rng);
+                Instructions::execute(mode, op, production);
+                Reference::execute(mode, op, reference);
+                if (production.Hash() == reference.Hash()) continue;
+
+                {
+                    std::lock_guard guard{ report_lock };
+                    report.mismatches++;
+                    if (report.samples.size() < max_samples)
+                        report.samples.push_back(
+                          { op,
+                            mode,
+                            Describe(before),
+                            Diff(production, reference) });
+                }
+                reference = production;
+            }
+        });
+        return report;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
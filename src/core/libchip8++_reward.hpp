@@ -0,0 +1,633 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_REWARD
+#define BASED_CHIP8_REWARD
+
+#include "libchip8++.hpp"
+#include "libchip8++_batch.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * A reward or termination signal written as an expression over the
+ * machine state, compiled once to a stack bytecode and evaluated for every
+ * instance of a Batch at a time.
+ *
+ * The language has 64 bit integers and the C operators
+ * `|| && == != < <= > >= + - * / % ! -` with C precedence. Arithmetic wraps
+ * around on overflow, and division or modulo by zero gives 0. Operands are:
+ *  - numbers, decimal or 0x hexadecimal,
+ *  - `mem[e]`, the byte at address e,
+ *  - `V0` to `VF`, `I`, `pc`, `dt` and `st`,
+ *  - `bcd(mem[a..b])`, the decimal number whose digits are the bytes a to
+ *    b, one digit per byte as FX33 stores them, up to 18 digits, and
+ *    `be(mem[a..b])` and `le(mem[a..b])`, the bytes read as a big or little
+ *    endian number, up to 8 bytes,
+ *  - `min(x, y)`, `max(x, y)` and `abs(x)`,
+ *  - `prev(x)`, the value x had at the previous Evaluate() of the same
+ *    instance, or its current value on the first one. A bare `prev` on the
+ *    right of an operator stands for prev() of the left operand, so
+ *    `bcd(mem[0x2F0..0x2F2]) - prev` is the score gained since the last
+ *    frame.
+ *
+ * Evaluate() first reads every distinct operand of an instance in one
+ * pass over the batch, prefetching ahead, since those reads miss the
+ * cache and are most of the cost. It then runs every instruction over a
+ * block of instances before moving to the next, so decoding is paid once
+ * per block and the arithmetic runs over plain arrays in L1 the compiler
+ * vectorises.
+ */
+class RewardExpr {
+  private:
+    enum Op : uint8_t {
+        CONST,
+        LOADED,
+        MEM,
+        REG,
+        INDEX,
+        PC,
+        DT,
+        ST,
+        BCD,
+        BIG,
+        LITTLE,
+        MEM_AT,
+        PREV,
+        NEG,
+        NOT,
+        ABS,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE,
+        AND,
+        OR,
+        MIN,
+        MAX,
+    };
+
+    struct Insn {
+        Op op;
+        uint16_t a = 0; /* address, register or prev slot */
+        uint16_t b = 0; /* last address of a range */
+        int64_t k = 0;  /* constant */
+    };
+
+    /* a recursive descent parser emitting postfix code as it goes */
+    struct Parser {
+        const std::string& src;
+        size_t pos;
+        std::vector<Insn> code;
+        unsigned slots;
+        size_t lhs_start; /* code of the left operand a bare prev copies */
+        size_t lhs_end;
+        std::string error;
+
+        bool Fail(const std::string& what)
+        {
+            if (error.empty())
+                error = what + " at column " + std::to_string(pos + 1);
+            return false;
+        }
+
+        void Skip()
+        {
+            while (pos < src.size() && std::isspace(uint8_t(src[pos])))
+                pos++;
+        }
+
+        bool Eat(const char* token)
+        {
+            Skip();
+            size_t len = std::char_traits<char>::length(token);
+            if (src.compare(pos, len, token) != 0) return false;
+            /* keep < from eating the start of <= and = from == */
+            if (len == 1 && pos + 1 < src.size() && src[pos + 1] == '=' &&
+                std::string{ "<>=!" }.find(token[0]) != std::string::npos)
+                return false;
+            pos += len;
+            return true;
+        }
+
+        bool Expect(const char* token)
+        {
+            return Eat(token) || Fail(std::string{ "expected " } + token);
+        }
+
+        std::string Word()
+        {
+            Skip();
+            size_t start = pos;
+            while (pos < src.size() &&
+                   (std::isalnum(uint8_t(src[pos])) || src[pos] == '_'))
+                pos++;
+            return src.substr(start, pos - start);
+        }
+
+        bool Number(int64_t& value)
+        {
+            Skip();
+            bool hex = src.compare(pos, 2, "0x") == 0 ||
+                       src.compare(pos, 2, "0X") == 0;
+            size_t start = pos + (hex ? 2 : 0), end = start;
+            while (end < src.size() &&
+                   (hex ? std::isxdigit(uint8_t(src[end]))
+                        : std::isdigit(uint8_t(src[end]))))
+                end++;
+            if (end == start || end - start > (hex ? 15 : 18))
+                return Fail("expected a number");
+            value = std::stoll(src.substr(start, end - start), nullptr,
+                               hex ? 16 : 10);
+            pos = end;
+            return true;
+        }
+
+        /* mem[a..b] as the argument of bcd, be and le */
+        bool Range(Op op)
+        {
+            int64_t first, last;
+            if (!Expect("(") || Word() != "mem" || !Expect("[") ||
+                !Number(first) || !Expect("..") || !Number(last) ||
+                !Expect("]") || !Expect(")"))
+                return Fail("expected (mem[first..last])");
+            if (first < 0 || last < first || last >= Constants::MEMSIZE)
+                return Fail("bad address range");
+            /* anything longer does not fit in the int64_t evaluated */
+            if (op == BCD && last - first >= 18)
+                return Fail("bcd() takes at most 18 digits");
+            if (op != BCD && last - first >= 8)
+                return Fail("be() and le() take at most 8 bytes");
+            code.push_back({ op, uint16_t(first), uint16_t(last), 0 });
+            return true;
+        }
+
+        bool Call(Op op, unsigned args)
+        {
+            if (!Expect("(") || !Or()) return false;
+            for (unsigned i = 1; i < args; i++)
+                if (!Expect(",") || !Or()) return false;
+            if (!Expect(")")) return false;
+            code.push_back({ op, 0, 0, 0 });
+            return true;
+        }
+
+        bool Prev()
+        {
+            Skip();
+            if (pos < src.size() && src[pos] == '(') {
+                if (!Call(PREV, 1)) return false;
+            } else {
+                if (lhs_end == lhs_start)
+                    return Fail("prev needs an operand, write prev(x)");
+                std::vector<Insn> lhs{ code.begin() + lhs_start,
+                                       code.begin() + lhs_end };
+                /* prevs inside the copy keep their own history */
+                for (Insn& insn : lhs)
+                    if (insn.op == PREV) insn.a = slots++;
+                code.insert(code.end(), lhs.begin(), lhs.end());
+                code.push_back({ PREV, 0, 0, 0 });
+            }
+            code.back().a = slots++;
+            return true;
+        }
+
+        bool Primary()
+        {
+            Skip();
+            if (pos == src.size()) return Fail("unexpected end");
+            if (std::isdigit(uint8_t(src[pos]))) {
+                int64_t value;
+                if (!Number(value)) return false;
+                code.push_back({ CONST, 0, 0, value });
+                return true;
+            }
+            if (Eat("(")) {
+                size_t start = lhs_start, end = lhs_end;
+                lhs_start = lhs_end = 0;
+                bool ok = Or() && Expect(")");
+                lhs_start = start, lhs_end = end;
+                return ok;
+            }
+
+            std::string word = Word();
+            std::string lower = word;
+            for (char& c : lower)
+                c = std::tolower(uint8_t(c));
+            if (lower == "mem") {
+                if (!Expect("[") || !Or() || !Expect("]")) return false;
+                /* fold constant addresses into the load */
+                if (code.back().op == CONST) {
+                    code.back() = {
+                        MEM,
+                        uint16_t(code.back().k & (Constants::MEMSIZE - 1)),
+                        0,
+                        0
+                    };
+                } else
+                    code.push_back({ MEM_AT, 0, 0, 0 });
+                return true;
+            }
+            if (lower.size() == 2 && lower[0] == 'v' &&
+                std::isxdigit(uint8_t(lower[1]))) {
+                code.push_back(
+                  { REG, uint16_t(std::stoi(lower.substr(1), nullptr, 16)) });
+                return true;
+            }
+            if (lower == "i") return code.push_back({ INDEX }), true;
+            if (lower == "pc") return code.push_back({ PC }), true;
+            if (lower == "dt") return code.push_back({ DT }), true;
+            if (lower == "st") return code.push_back({ ST }), true;
+            if (lower == "bcd") return Range(BCD);
+            if (lower == "be") return Range(BIG);
+            if (lower == "le") return Range(LITTLE);
+            if (lower == "min") return Call(MIN, 2);
+            if (lower == "max") return Call(MAX, 2);
+            if (lower == "abs") return Call(ABS, 1);
+            if (lower == "prev") return Prev();
+            return Fail(word.empty() ? "expected an operand"
+                                     : "unknown name " + word);
+        }
+
+        bool Unary()
+        {
+            if (Eat("-")) return Unary() && (code.push_back({ NEG }), true);
+            if (Eat("!")) return Unary() && (code.push_back({ NOT }), true);
+            return Primary();
+        }
+
+        /* one level of left associative binary operators */
+        template<typename Next>
+        bool Binary(Next next,
+                    std::initializer_list<std::pair<const char*, Op>> ops)
+        {
+            size_t start = code.size();
+            if (!(this->*next)()) return false;
+            for (;;) {
+                const std::pair<const char*, Op>* found = nullptr;
+                for (auto& op : ops)
+                    if (Eat(op.first)) {
+                        found = &op;
+                        break;
+                    }
+                if (found == nullptr) return true;
+
+                size_t outer_start = lhs_start, outer_end = lhs_end;
+                lhs_start = start, lhs_end = code.size();
+                bool ok = (this->*next)();
+                lhs_start = outer_start, lhs_end = outer_end;
+                if (!ok) return false;
+                code.push_back({ found->second });
+            }
+        }
+
+        bool Term()
+        {
+            return Binary(&Parser::Unary,
+                          { { "*", MUL }, { "/", DIV }, { "%", MOD } });
+        }
+
+        bool Sum()
+        {
+            return Binary(&Parser::Term, { { "+", ADD }, { "-", SUB } });
+        }
+
+        bool Compare()
+        {
+            return Binary(&Parser::Sum,
+                          { { "<=", LE },
+                            { ">=", GE },
+                            { "<", LT },
+                            { ">", GT },
+                            { "==", EQ },
+                            { "!=", NE } });
+        }
+
+        bool And()
+        {
+            return Binary(&Parser::Compare, { { "&&", AND } });
+        }
+
+        bool Or()
+        {
+            return Binary(&Parser::And, { { "||", OR } });
+        }
+    };
+
+    /* instances evaluated at a time, so the columns stay in L1 */
+    static constexpr size_t BLOCK = 256;
+
+    std::vector<Insn> code;
+    std::vector<Insn> loads; /* distinct loads, all run in one pass */
+    unsigned depth;
+    unsigned slots;
+    std::vector<int64_t> loaded; /* a column per load */
+    std::vector<int64_t> stack;  /* depth columns */
+    std::vector<int64_t> history;
+    std::vector<uint8_t> primed;
+    size_t size;
+
+    RewardExpr(std::vector<Insn> code, unsigned slots)
+      : code{ std::move(code) }
+      , depth{ 0 }
+      , slots{ slots }
+      , size{ 0 }
+    {
+        unsigned height = 0;
+        for (Insn& insn : this->code) {
+            if (insn.op >= MEM && insn.op <= LITTLE) {
+                auto same = [&](const Insn& l) {
+                    return l.op == insn.op && l.a == insn.a && l.b == insn.b;
+                };
+                auto it = std::find_if(loads.begin(), loads.end(), same);
+                if (it == loads.end()) it = loads.insert(it, insn);
+                insn = { LOADED, uint16_t(it - loads.begin()) };
+            }
+            if (insn.op <= LITTLE)
+                height++;
+            else if (insn.op >= ADD)
+                height--;
+            depth = std::max(depth, height);
+        }
+    }
+
+    void Resize(size_t n)
+    {
+        size = n;
+        loaded.assign(loads.size() * BLOCK, 0);
+        stack.assign(depth * BLOCK, 0);
+        history.assign(slots * n, 0);
+        primed.assign(n, 0);
+    }
+
+    static int64_t Fetch(system& c, const Insn& load) noexcept
+    {
+        int64_t v = 0;
+        switch (load.op) {
+            case MEM:
+                return c.GetMemory(load.a);
+            case REG:
+                return c.GetRegister(Registers(load.a));
+            case INDEX:
+                return c.GetIndexRegister();
+            case PC:
+                return c.GetPC();
+            case DT:
+                return c.GetDT();
+            case ST:
+                return c.GetST();
+            case BCD: {
+                /* bytes above 9 can still take 18 digits past INT64_MAX,
+                 * wrap around instead of overflowing */
+                uint64_t digits = 0;
+                for (int a = load.a; a <= load.b; a++)
+                    digits = digits * 10 + c.GetMemory(a);
+                return static_cast<int64_t>(digits);
+            }
+            case BIG:
+                for (int a = load.a; a <= load.b; a++)
+                    v = v << 8 | c.GetMemory(a);
+                return v;
+            case LITTLE:
+                for (int a = load.b; a >= load.a; a--)
+                    v = v << 8 | c.GetMemory(a);
+                return v;
+            default:
+                return 0;
+        }
+    }
+
+    /* every load of an instance at once, while its lines are in cache */
+    void Gather(Batch& batch, size_t base, size_t n) noexcept
+    {
+        constexpr size_t AHEAD = 8;
+        for (size_t e = 0; e < n; e++) {
+            if (base + e + AHEAD < size) {
+                system& next = batch[base + e + AHEAD];
+                for (const Insn& load : loads)
+                    __builtin_prefetch(load.op >= BCD || load.op == MEM
+                                         ? &next.RefMemory()[load.a]
+                                         : next.RefRegisterArray().data());
+            }
+            system& c = batch[base + e];
+            for (size_t j = 0; j < loads.size(); j++)
+                loaded[j * BLOCK + e] = Fetch(c, loads[j]);
+        }
+    }
+
+    /* signed overflow is undefined, so the arithmetic is done unsigned */
+    static int64_t Wrap(uint64_t v) noexcept
+    {
+        return static_cast<int64_t>(v);
+    }
+
+    void Run(Batch& batch, size_t base, size_t n, int64_t* out) noexcept
+    {
+        int64_t* top = stack.data() - BLOCK; /* column of the top of stack */
+        Gather(batch, base, n);
+
+        for (const Insn& insn : code) {
+            int64_t* x = top;
+            int64_t* y = top + BLOCK;
+            switch (insn.op) {
+                case CONST:
+                    top += BLOCK;
+                    std::fill(top, top + n, insn.k);
+                    break;
+                case LOADED:
+                    top += BLOCK;
+                    std::copy_n(loaded.data() + insn.a * BLOCK, n, top);
+                    break;
+                case MEM_AT:
+                    for (size_t e = 0; e < n; e++)
+                        x[e] = batch[base + e].GetMemory(uint16_t(x[e]));
+                    break;
+                case PREV: {
+                    int64_t* old = history.data() + insn.a * size + base;
+                    for (size_t e = 0; e < n; e++) {
+                        int64_t now = x[e];
+                        x[e] = primed[base + e] ? old[e] : now;
+                        old[e] = now;
+                    }
+                    break;
+                }
+                case NEG:
+                    for (size_t e = 0; e < n; e++)
+                        x[e] = Wrap(0 - uint64_t(x[e]));
+                    break;
+                case NOT:
+                    for (size_t e = 0; e < n; e++)
+                        x[e] = !x[e];
+                    break;
+                case ABS:
+                    for (size_t e = 0; e < n; e++)
+                        x[e] = x[e] < 0 ? Wrap(0 - uint64_t(x[e])) : x[e];
+                    break;
+                default:
+                    top -= BLOCK;
+                    x = top;
+                    y = top + BLOCK;
+                    switch (insn.op) {
+                        case ADD:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = Wrap(uint64_t(x[e]) + uint64_t(y[e]));
+                            break;
+                        case SUB:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = Wrap(uint64_t(x[e]) - uint64_t(y[e]));
+                            break;
+                        case MUL:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = Wrap(uint64_t(x[e]) * uint64_t(y[e]));
+                            break;
+                        case DIV:
+                            /* INT64_MIN / -1 traps, negate instead */
+                            for (size_t e = 0; e < n; e++) {
+                                if (y[e] == -1)
+                                    x[e] = Wrap(0 - uint64_t(x[e]));
+                                else
+                                    x[e] = y[e] ? x[e] / y[e] : 0;
+                            }
+                            break;
+                        case MOD:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = y[e] && y[e] != -1 ? x[e] % y[e] : 0;
+                            break;
+                        case EQ:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] == y[e];
+                            break;
+                        case NE:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] != y[e];
+                            break;
+                        case LT:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] < y[e];
+                            break;
+                        case LE:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] <= y[e];
+                            break;
+                        case GT:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] > y[e];
+                            break;
+                        case GE:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] >= y[e];
+                            break;
+                        case AND:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] && y[e];
+                            break;
+                        case OR:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = x[e] || y[e];
+                            break;
+                        case MIN:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = std::min(x[e], y[e]);
+                            break;
+                        case MAX:
+                            for (size_t e = 0; e < n; e++)
+                                x[e] = std::max(x[e], y[e]);
+                            break;
+                        default:
+                            break;
+                    }
+            }
+        }
+        std::fill_n(primed.begin() + base, n, 1);
+        std::copy_n(top, n, out);
+    }
+
+
+  public:
+    /**
+     * Compiles an expression.
+     * @param source the expression, see the class description
+     * @param error set to the reason and column on failure
+     * @return the compiled expression, or nullptr on a syntax error
+     */
+    static std::unique_ptr<RewardExpr> Compile(const std::string& source,
+                                               std::string& error)
+    {
+        Parser parser{ source, 0, {}, 0, 0, 0, {} };
+        bool ok = parser.Or();
+        parser.Skip();
+        if (ok && parser.pos != source.size())
+            ok = parser.Fail("unexpected " + source.substr(parser.pos, 1));
+        if (ok == false) {
+            error = parser.error;
+            return nullptr;
+        }
+        return std::unique_ptr<RewardExpr>{ new RewardExpr{
+          std::move(parser.code), parser.slots } };
+    }
+
+    /**
+     * Starts a new episode of an instance, its next Evaluate() sees no
+     * previous values.
+     * @param idx index of the instance in the batch
+     */
+    void Reset(size_t idx) noexcept
+    {
+        if (idx < primed.size()) primed[idx] = 0;
+    }
+
+    /**
+     * Evaluates the expression on every instance of a batch. The batch
+     * should keep its instances in the same order between calls, as prev
+     * values are kept by index. A batch of another size starts over.
+     * @param batch the instances
+     * @param out receives one value per instance
+     */
+    void Evaluate(Batch& batch, std::span<int64_t> out)
+    {
+        if (batch.Size() != size) Resize(batch.Size());
+        for (size_t base = 0; base < size; base += BLOCK)
+            Run(batch, base, std::min(BLOCK, size - base), &out[base]);
+    }
+
+    /**
+     * Returns the number of bytecode instructions.
+     */
+    size_t Instructions() const noexcept
+    {
+        return code.size();
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
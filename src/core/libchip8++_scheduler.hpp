@@ -0,0 +1,344 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_SCHEDULER
+#define BASED_CHIP8_SCHEDULER
+
+#include "libchip8++.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * Contains named constants for the scheduling classes of instances.
+ */
+enum Priority {
+    INTERACTIVE, /**< Runs every frame, before any batch work. */
+    BATCH,       /**< Runs in whatever time the frame has left. */
+};
+
+/**
+ * Per class counters kept by Scheduler.
+ */
+struct ClassStats {
+    uint64_t frames;          /**< Instance frames run. */
+    uint64_t deferred;        /**< Instance frames put off for lack of time. */
+    uint64_t busy_ns;         /**< Time spent running the class. */
+    uint64_t last_latency_ns; /**< Frame() start to the class being done. */
+    uint64_t max_latency_ns;  /**< Largest last_latency_ns seen. */
+};
+
+/**
+ * Runs instances frame by frame as C++20 coroutines. An instance whose next
+ * instruction is an FX0A that would only wait (no key held, or the latched
+ * key still held) suspends and is parked off the run queue. A parked
+ * instance costs nothing per frame. It goes back on the run queue when a key
+ * event arrives for it through Press(), and catches up on the timer ticks it
+ * missed. Waiting in FX0A changes nothing but the timers, so every instance
+ * ends up in exactly the state Chip8_core::frame() would have left it in.
+ *
+ * Instances are either INTERACTIVE or BATCH. Each Frame() runs a frame of
+ * every interactive instance first. Batch instances then run, in round-robin
+ * order, until the frame's time budget is used up. The ones left over keep
+ * their place at the head of the queue for the next Frame(). A batch
+ * instance only ever holds the core for one of its frames, so interactive
+ * work is delayed by at most one instance frame past the boundary. Timers
+ * of a batch instance stand still while it waits its turn.
+ */
+class Scheduler {
+  private:
+    struct Task {
+        struct promise_type {
+            Task get_return_object() noexcept
+            {
+                return Task{
+                    std::coroutine_handle<promise_type>::from_promise(*this)
+                };
+            }
+            std::suspend_always initial_suspend() noexcept
+            {
+                return {};
+            }
+            std::suspend_always final_suspend() noexcept
+            {
+                return {};
+            }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept
+            {
+                std::terminate();
+            }
+        };
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Instance {
+        system* chip8;
+        Priority prio;
+        std::coroutine_handle<Task::promise_type> handle;
+        uint64_t parked_at; /* frame the instance parked in */
+        bool parked;
+    };
+
+    /* queues the instance for the next frame */
+    struct NextFrame {
+        Scheduler& self;
+        Instance& inst;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<>) const
+        {
+            self.next[inst.prio].push_back(&inst);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    /* leaves the instance off every queue until Press() */
+    struct Park {
+        Scheduler& self;
+        Instance& inst;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<>) const noexcept
+        {
+            inst.parked = true;
+            inst.parked_at = self.frames;
+            self.parked++;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::vector<std::unique_ptr<Instance>> instances;
+    std::vector<Instance*> run;
+    std::vector<Instance*> spill;
+    std::vector<Instance*> next[2];
+    ClassStats stats[2]{};
+    Quirks mode;
+    unsigned cycles_per_frame;
+    uint64_t frames;
+    size_t parked;
+
+    /* whether executing the next instruction would only wait for a key */
+    static bool Waiting(system& Chip8)
+    {
+        if ((Chip8.Peek() & 0xF0FF) != 0xF00A) return false;
+        if (Chip8.isHalted()) {
+            auto rx = static_cast<Registers>(Chip8.Peek() >> 8 & 0xF);
+            auto latched = static_cast<KeyCode>(Chip8.GetRegister(rx));
+            return Chip8.GetKey(latched) == Key::DOWN;
+        }
+        for (int k = 0; k < Constants::KEYCOUNT; k++)
+            if (Chip8.GetKey(static_cast<KeyCode>(k)) == Key::DOWN)
+                return false;
+        return true;
+    }
+
+    Task Drive(Instance& inst)
+    {
+        system& Chip8 = *inst.chip8;
+        for (;;) {
+            Chip8.ClearInputPolls();
+            unsigned i = 0;
+            for (; i < cycles_per_frame; i++) {
+                if (Waiting(Chip8)) break;
+                cycle(Chip8, mode);
+            }
+            if (i < cycles_per_frame) {
+                /* the FX0A skipped over would have read the keypad */
+                Chip8.NoteInputPoll();
+                co_await Park{ *this, inst };
+                /* every frame since parking ended on a tick, the one
+                 * running now has not yet */
+                for (uint64_t f = inst.parked_at; f < frames; f++) {
+                    if (Chip8.GetDT() == 0 && Chip8.GetST() == 0) break;
+                    tick_timers(Chip8);
+                }
+                continue;
+            }
+            tick_timers(Chip8);
+            co_await NextFrame{ *this, inst };
+        }
+    }
+
+  public:
+    /**
+     * Constructs the Scheduler.
+     * @param mode the quirks every instance follows
+     * @param cycles_per_frame the number of cycles per frame
+     */
+    Scheduler(Quirks mode, unsigned cycles_per_frame = 10)
+      : mode{ mode }
+      , cycles_per_frame{ cycles_per_frame }
+      , frames{ 0 }
+      , parked{ 0 }
+    {
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    ~Scheduler()
+    {
+        for (auto& inst : instances)
+            inst->handle.destroy();
+    }
+
+    /**
+     * Adds an instance, which must outlive the Scheduler. It starts running
+     * on the next Frame().
+     * @param Chip8 the instance to add
+     * @param prio the class to schedule it in
+     * @return the id to pass to Press()
+     */
+    size_t Add(system& Chip8, Priority prio = BATCH)
+    {
+        instances.push_back(std::make_unique<Instance>());
+        Instance& inst = *instances.back();
+        inst.chip8 = &Chip8;
+        inst.prio = prio;
+        inst.parked = false;
+        inst.handle = Drive(inst).handle;
+        next[prio].push_back(&inst);
+        return instances.size() - 1;
+    }
+
+    /**
+     * Runs one frame on every interactive instance that is not parked, then
+     * as many batch instance frames as fit in the budget.
+     * @param budget time the whole frame may take, zero runs every batch
+     * instance
+     */
+    void Frame(std::chrono::nanoseconds budget = {})
+    {
+        Clock::time_point start = Clock::now();
+        auto since = [&](Clock::time_point from) {
+            return static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - from)
+                .count());
+        };
+        auto done = [&](ClassStats& st, Clock::time_point from) {
+            st.last_latency_ns = since(start);
+            st.max_latency_ns = std::max(st.max_latency_ns, st.last_latency_ns);
+            st.busy_ns += since(from);
+        };
+
+        run.swap(next[INTERACTIVE]);
+        next[INTERACTIVE].clear();
+        for (Instance* inst : run)
+            inst->handle.resume();
+        stats[INTERACTIVE].frames += run.size();
+        done(stats[INTERACTIVE], start);
+
+        /* the batch queue is drained from the front, whatever is left and
+         * whatever gets queued while running goes to the next frame */
+        Clock::time_point batch_start = Clock::now();
+        Clock::time_point deadline = start + budget;
+        run.swap(next[BATCH]);
+        next[BATCH].clear();
+        size_t ran = 0;
+        for (; ran < run.size(); ran++) {
+            if (budget.count() && ran % 8 == 0 && Clock::now() >= deadline)
+                break;
+            run[ran]->handle.resume();
+        }
+        spill.swap(next[BATCH]);
+        next[BATCH].assign(run.begin() + ran, run.end());
+        next[BATCH].insert(next[BATCH].end(), spill.begin(), spill.end());
+        stats[BATCH].frames += ran;
+        stats[BATCH].deferred += run.size() - ran;
+        done(stats[BATCH], batch_start);
+        frames++;
+    }
+
+    /**
+     * Sets the state of a key, waking the instance if it is parked.
+     * @param id the instance, as returned by Add()
+     * @param k the key
+     * @param state Key::DOWN or Key::UP
+     */
+    void Press(size_t id, KeyCode k, Key state)
+    {
+        Instance& inst = *instances[id];
+        inst.chip8->SetKey(k, state);
+        if (inst.parked == false) return;
+        inst.parked = false;
+        parked--;
+        next[inst.prio].push_back(&inst);
+    }
+
+    /**
+     * Returns the number of instances.
+     */
+    size_t Size() const noexcept
+    {
+        return instances.size();
+    }
+
+    /**
+     * Returns the number of instances parked on FX0A.
+     */
+    size_t Parked() const noexcept
+    {
+        return parked;
+    }
+
+    /**
+     * Returns whether an instance is parked on FX0A. Its timers lag behind
+     * until it wakes.
+     * @param id the instance, as returned by Add()
+     */
+    bool Parked(size_t id) const noexcept
+    {
+        return instances[id]->parked;
+    }
+
+    /**
+     * Returns the counters of a class.
+     * @param prio the class
+     */
+    const ClassStats& Stats(Priority prio) const noexcept
+    {
+        return stats[prio];
+    }
+
+    /**
+     * Returns the number of frames run so far.
+     */
+    uint64_t Frames() const noexcept
+    {
+        return frames;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
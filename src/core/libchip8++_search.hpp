@@ -0,0 +1,433 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_SEARCH
+#define BASED_CHIP8_SEARCH
+
+#include "libchip8++.hpp"
+#include "libchip8++_workers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * A memory location whose value counts towards the reward of a state, such
+ * as the score a game keeps in RAM.
+ */
+struct RewardTerm {
+    uint16_t addr;       /**< Address of the most significant byte. */
+    uint8_t bytes = 1;   /**< Width of the big endian value, 1 to 8. */
+    double weight = 1.0; /**< Factor the value is multiplied by. */
+};
+
+/**
+ * Parameters of a Search.
+ */
+struct SearchConfig {
+    Quirks mode = Quirks::COWGOD; /**< The quirks to run the ROM with. */
+    unsigned cycles_per_frame = 10;  /**< Cycles between timer ticks. */
+    unsigned frames_per_action = 4;  /**< Frames a key is held for. */
+    unsigned rollout_depth = 16;     /**< Random actions per MCTS rollout. */
+    double exploration = 1.4;        /**< UCT exploration constant. */
+    unsigned virtual_loss = 1; /**< Losses a thread charges to the nodes it
+                                    is rolling out below, steers the other
+                                    threads elsewhere. */
+    std::vector<RewardTerm> rewards; /**< Summed into the reward. */
+    std::vector<int> actions; /**< Keys to choose from, Search::NO_KEY for
+                                   pressing nothing. Empty means all 16 keys
+                                   and NO_KEY. */
+    uint64_t seed = 0;        /**< Seeds the rollout policy. */
+};
+
+/**
+ * The outcome of a search: the keys to press, one per action period, and
+ * the reward expected from following them.
+ */
+struct Plan {
+    std::vector<int> actions;
+    double reward;
+};
+
+/**
+ * Plans keypad input for a ROM by searching over future machine states.
+ * An action holds one key, or none, for SearchConfig::frames_per_action
+ * frames, the reward of a state is the weighted sum of the configured memory
+ * locations minus that of the root. Every state is reached by copying a
+ * system and running it, ROMs are deterministic given their input so no
+ * other bookkeeping is needed.
+ * Two strategies are offered: Mcts(), UCT tree search with random rollouts
+ * run in parallel under virtual loss, and Beam(), a breadth first beam
+ * search that merges branches reaching the same state through
+ * system::Hash(). Both spread their work over an internal WorkerPool.
+ * States whose next action period never reads the keypad are lag frames,
+ * every action leads to the same state from them, so both searches follow
+ * a single action from such states instead of branching.
+ */
+class Search {
+  public:
+    static constexpr int NO_KEY = -1;
+
+  private:
+    struct Node {
+        int parent;
+        int action;
+        int first_child; /* -1 until expanded, children are contiguous */
+        unsigned visits;
+        unsigned virtual_visits;
+        double value; /* sum of the rewards backed up through this node */
+        unsigned children = 0;
+        bool lag = false; /* actions from here read no input, one child */
+    };
+
+    struct HashOf {
+        size_t operator()(const Hash128& h) const noexcept
+        {
+            return h.lo;
+        }
+    };
+
+    SearchConfig config;
+    WorkerPool workers;
+
+    /* tree of the running Mcts(), guarded by tree_lock */
+    std::vector<Node> nodes;
+    std::mutex tree_lock;
+    double min_reward;
+    double max_reward;
+
+    static uint64_t NextRandom(uint64_t& state) noexcept
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    /* UCT score of a child, virtual visits count as the worst reward seen
+     * and values are normalised to the range seen so far */
+    double Score(const Node& child, double log_parent) const noexcept
+    {
+        double n = child.visits + child.virtual_visits;
+        if (n == 0) return std::numeric_limits<double>::infinity();
+        double q = (child.value + child.virtual_visits * min_reward) / n;
+        q = max_reward > min_reward
+              ? (q - min_reward) / (max_reward - min_reward)
+              : 0.0;
+        return q + config.exploration * std::sqrt(log_parent / n);
+    }
+
+    /* walks down from the root to a node to roll out from, expanding the
+     * leaf it stops at if it was rolled out before */
+    void Select(std::vector<int>& path)
+    {
+        const size_t width = config.actions.size();
+        int idx = 0;
+        path.push_back(idx);
+        nodes[idx].virtual_visits += config.virtual_loss;
+
+        for (;;) {
+            if (nodes[idx].first_child < 0) {
+                if (nodes[idx].visits == 0 && idx != 0) return;
+                if (nodes.size() + width > nodes.capacity()) return;
+                unsigned count = nodes[idx].lag ? 1 : width;
+                nodes[idx].first_child = nodes.size();
+                nodes[idx].children = count;
+                for (unsigned i = 0; i < count; i++)
+                    nodes.push_back({ idx, config.actions[i], -1, 0, 0, 0.0 });
+            }
+
+            const Node& node = nodes[idx];
+            double log_parent =
+              std::log(double(node.visits + node.virtual_visits) + 1.0);
+            int best = node.first_child;
+            double best_score = -std::numeric_limits<double>::infinity();
+            for (size_t i = 0; i < node.children; i++) {
+                double score = Score(nodes[node.first_child + i], log_parent);
+                if (score > best_score) {
+                    best_score = score;
+                    best = node.first_child + i;
+                }
+            }
+
+            bool fresh = nodes[best].visits + nodes[best].virtual_visits == 0;
+            idx = best;
+            path.push_back(idx);
+            nodes[idx].virtual_visits += config.virtual_loss;
+            if (fresh) return;
+        }
+    }
+
+    /* polled[i] tells whether the action taken from path[i] read input,
+     * nodes found to be lag frames before expansion get a single child */
+    void Backup(const std::vector<int>& path,
+                const std::vector<uint8_t>& polled,
+                double reward)
+    {
+        min_reward = std::min(min_reward, reward);
+        max_reward = std::max(max_reward, reward);
+        for (size_t i = 0; i < path.size(); i++) {
+            Node& node = nodes[path[i]];
+            node.visits++;
+            node.value += reward;
+            node.virtual_visits -= config.virtual_loss;
+            if (i < polled.size() && node.first_child < 0)
+                node.lag = polled[i] == 0;
+        }
+    }
+
+  public:
+    /**
+     * Constructs the Search.
+     * @param config the search parameters
+     * @param threads the number of threads to search with, zero picks one
+     * per hardware thread
+     */
+    explicit Search(SearchConfig config, unsigned threads = 0)
+      : config{ std::move(config) }
+      , workers{ threads }
+      , min_reward{ 0 }
+      , max_reward{ 0 }
+    {
+        if (this->config.actions.empty()) {
+            this->config.actions.push_back(NO_KEY);
+            for (int key = KeyCode::Zero; key <= KeyCode::F; key++)
+                this->config.actions.push_back(key);
+        }
+    }
+
+    /**
+     * Runs one action on a system: releases every key, presses the action's
+     * key and runs SearchConfig::frames_per_action frames.
+     * @param Chip8 the system to advance
+     * @param action a key or NO_KEY
+     * @return whether any of the frames read the keypad. If none did, every
+     * action leads to the same state.
+     */
+    bool Apply(system& Chip8, int action) const
+    {
+        bool polled = false;
+        Chip8.reset_keys();
+        if (action != NO_KEY)
+            Chip8.SetKey(static_cast<KeyCode>(action), Key::DOWN);
+        for (unsigned i = 0; i < config.frames_per_action; i++) {
+            frame(Chip8, config.mode, config.cycles_per_frame);
+            polled |= Chip8.InputPolled();
+        }
+        return polled;
+    }
+
+    /**
+     * Returns the weighted sum of the configured reward locations.
+     * @param Chip8 the system to read
+     */
+    double Reward(system& Chip8) const
+    {
+        double total = 0;
+        for (const RewardTerm& term : config.rewards) {
+            uint64_t v = 0;
+            for (unsigned b = 0; b < term.bytes; b++)
+                v = v << 8 | Chip8.GetMemory(term.addr + b);
+            total += term.weight * double(v);
+        }
+        return total;
+    }
+
+    /**
+     * Monte-Carlo tree search. Every iteration descends the tree by UCT,
+     * replays the chosen actions on a copy of the root, finishes with
+     * SearchConfig::rollout_depth random actions and backs the reward up.
+     * The tree is kept between a thread's descent and its backup by virtual
+     * loss, the emulation runs outside of the tree lock.
+     * @param root the state to plan from
+     * @param iterations the number of rollouts
+     * @return the most visited path from the root, with the mean reward of
+     * its first action
+     */
+    Plan Mcts(const system& root, unsigned iterations)
+    {
+        nodes.clear();
+        nodes.reserve(1 + size_t{ iterations } * config.actions.size());
+        nodes.push_back({ -1, NO_KEY, -1, 0, 0, 0.0 });
+        min_reward = std::numeric_limits<double>::infinity();
+        max_reward = -std::numeric_limits<double>::infinity();
+
+        system base = root;
+        const double base_reward = Reward(base);
+        nodes[0].lag = Apply(base, config.actions[0]) == false;
+        base = root;
+        std::atomic<long> left{ iterations };
+
+        workers.Run([&](unsigned worker) {
+            uint64_t rng = config.seed + worker * 0x2545F4914F6CDD1DULL;
+            std::vector<int> path;
+            std::vector<int> replay;
+            std::vector<uint8_t> polled;
+            system state = root;
+
+            while (left.fetch_sub(1) > 0) {
+                path.clear();
+                replay.clear();
+                polled.clear();
+                {
+                    std::lock_guard guard{ tree_lock };
+                    Select(path);
+                    for (size_t i = 1; i < path.size(); i++)
+                        replay.push_back(nodes[path[i]].action);
+                }
+
+                state = root;
+                for (int action : replay)
+                    polled.push_back(Apply(state, action));
+                for (unsigned i = 0; i < config.rollout_depth; i++) {
+                    bool read = Apply(
+                      state,
+                      config.actions[NextRandom(rng) % config.actions.size()]);
+                    if (i == 0) polled.push_back(read);
+                }
+                double reward = Reward(state) - base_reward;
+
+                std::lock_guard guard{ tree_lock };
+                Backup(path, polled, reward);
+            }
+        });
+
+        Plan plan{ {}, 0.0 };
+        for (int idx = 0; nodes[idx].first_child >= 0;) {
+            int best = nodes[idx].first_child;
+            for (size_t i = 0; i < nodes[idx].children; i++)
+                if (nodes[nodes[idx].first_child + i].visits >
+                    nodes[best].visits)
+                    best = nodes[idx].first_child + i;
+            if (nodes[best].visits == 0) break;
+            if (idx == 0) plan.reward = nodes[best].value / nodes[best].visits;
+            plan.actions.push_back(nodes[best].action);
+            idx = best;
+        }
+        return plan;
+    }
+
+    /**
+     * Beam search. Every state in the beam is expanded by every action in
+     * parallel, children reaching an identical machine state are merged and
+     * the width best by reward form the next beam.
+     * @param root the state to plan from
+     * @param width the number of states kept per level, at least 1
+     * @param depth the number of actions to plan
+     * @return the actions leading to the best state seen at any level
+     */
+    Plan Beam(const system& root, unsigned width, unsigned depth)
+    {
+        width = std::max(width, 1u);
+        const size_t actions = config.actions.size();
+        std::vector<system> beam{ root };
+        std::vector<system> next(size_t{ width } * actions, root);
+        std::vector<double> rewards(next.size());
+        std::vector<Hash128> hashes(next.size());
+        std::vector<uint8_t> polled(width);
+        std::vector<size_t> order;
+        std::unordered_map<Hash128, size_t, HashOf> unique;
+
+        /* per level, the beam index each survivor came from and its action */
+        std::vector<std::vector<std::pair<size_t, int>>> history;
+
+        beam[0].Hash();
+        const double base_reward = Reward(beam[0]);
+        double best_reward = -std::numeric_limits<double>::infinity();
+        size_t best_level = 0, best_idx = 0;
+
+        for (unsigned level = 0; level < depth; level++) {
+            size_t count = beam.size() * actions;
+            auto expand = [&](size_t i) {
+                next[i] = beam[i / actions];
+                bool read = Apply(next[i], config.actions[i % actions]);
+                rewards[i] = Reward(next[i]) - base_reward;
+                /* the held key is part of Hash() but Apply() replaces it,
+                 * so children of different actions can still merge */
+                next[i].reset_keys();
+                hashes[i] = next[i].Hash();
+                return read;
+            };
+            /* the first action of every state tells whether the others
+             * can differ, states that read no input only get that one */
+            workers.ParallelFor(beam.size(), [&](size_t b, unsigned) {
+                polled[b] = expand(b * actions);
+            });
+            workers.ParallelFor(count, [&](size_t i, unsigned) {
+                if (i % actions != 0 && polled[i / actions]) expand(i);
+            });
+
+            unique.clear();
+            order.clear();
+            for (size_t i = 0; i < count; i++) {
+                if (i % actions != 0 && !polled[i / actions]) continue;
+                auto [it, inserted] = unique.try_emplace(hashes[i], i);
+                if (inserted) order.push_back(i);
+            }
+            size_t keep = std::min<size_t>(width, order.size());
+            std::partial_sort(order.begin(),
+                              order.begin() + keep,
+                              order.end(),
+                              [&](size_t a, size_t b) {
+                                  if (rewards[a] != rewards[b])
+                                      return rewards[a] > rewards[b];
+                                  return a < b;
+                              });
+
+            auto& survivors = history.emplace_back();
+            beam.resize(keep, root);
+            for (size_t j = 0; j < keep; j++) {
+                beam[j] = next[order[j]];
+                survivors.push_back(
+                  { order[j] / actions, config.actions[order[j] % actions] });
+            }
+
+            if (rewards[order[0]] > best_reward) {
+                best_reward = rewards[order[0]];
+                best_level = level;
+                best_idx = 0;
+            }
+        }
+
+        Plan plan{ {}, depth ? best_reward : 0.0 };
+        if (depth == 0) return plan;
+        plan.actions.resize(best_level + 1);
+        for (size_t level = best_level + 1; level-- > 0;) {
+            plan.actions[level] = history[level][best_idx].second;
+            best_idx = history[level][best_idx].first;
+        }
+        return plan;
+    }
+
+    /**
+     * Returns the number of threads searching.
+     */
+    unsigned Threads() const noexcept
+    {
+        return workers.Size();
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
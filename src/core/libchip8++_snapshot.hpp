@@ -0,0 +1,474 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_SNAPSHOT
+#define BASED_CHIP8_SNAPSHOT
+
+#include "libchip8++.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+#include <zlib.h>
+
+namespace Chip8_core {
+
+/**
+ * Counters of a SnapshotStore.
+ */
+struct SnapshotStats {
+    uint64_t states;       /**< Snapshots stored. */
+    uint64_t chunks;       /**< Unique chunks stored. */
+    uint64_t raw_bytes;    /**< Bytes of state put in. */
+    uint64_t stored_bytes; /**< Bytes the chunks take on disk. */
+};
+
+/**
+ * A content addressed, append only store of machine states.
+ *
+ * A state is cut into CHUNK byte chunks, memory first, then the display and
+ * then the registers. Each distinct chunk is kept once and a snapshot is
+ * just the list of its chunk ids. States from the same ROM share the font,
+ * the ROM and most of the display, so only a few chunks per snapshot are
+ * new. New chunks are deflated against a preset dictionary of the chunks
+ * that were most common among sample states given when the store was
+ * created, and appended to the file together with each snapshot's chunk
+ * list.
+ * Every chunk is also kept inflated in memory, so Get() is a series of
+ * copies.
+ *
+ * File layout: a header with the dictionary, then records. A 'C' record is
+ * a deflated chunk, an 'R' record is a chunk that did not shrink, an 'M'
+ * record lists the chunk ids of one snapshot and a 'D' record only those
+ * that differ from the snapshot before it. Chunk ids are the order of the
+ * chunk records, so once a write fails nothing more is appended.
+ */
+class SnapshotStore {
+  public:
+    static constexpr size_t CHUNK = 256; /**< Bytes per chunk. */
+    static constexpr size_t CHUNKS =
+      (sizeof(system) + CHUNK - 1) / CHUNK; /**< Chunks per snapshot. */
+
+  private:
+    static constexpr uint64_t MAGIC = 0x5453504e53384843ULL; /* CH8SNPST */
+    /* file format in the upper half, system layout in the lower */
+    static constexpr uint32_t VERSION = 1 << 16 | SYSTEM_LAYOUT_VERSION;
+    static constexpr size_t MAX_DICT = 32768;
+
+    static_assert(std::is_trivially_copyable_v<system>);
+
+    using Chunk = std::array<uint8_t, CHUNK>;
+    using Manifest = std::array<uint32_t, CHUNKS>;
+
+    struct FileHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t state_size;
+        uint32_t chunk_size;
+        uint32_t dict_size;
+    };
+
+    std::FILE* file;
+    std::vector<uint8_t> dict;
+    std::vector<Chunk> chunks;
+    std::vector<Manifest> manifests;
+    std::unordered_map<uint64_t, uint32_t> index;
+    z_stream deflater{};
+    z_stream inflater{};
+    SnapshotStats stats{};
+    bool failed = false;
+
+    static uint64_t HashChunk(const uint8_t* data) noexcept
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < CHUNK; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * 0x100000001b3ULL;
+        }
+        return hash ^ (hash >> 32);
+    }
+
+    static Chunk Cut(const system& state, size_t c) noexcept
+    {
+        Chunk chunk{};
+        size_t off = c * CHUNK;
+        std::memcpy(chunk.data(),
+                    reinterpret_cast<const uint8_t*>(&state) + off,
+                    std::min(CHUNK, sizeof(system) - off));
+        return chunk;
+    }
+
+    /* finds or adds a chunk, probing on past hash collisions */
+    uint32_t Intern(const Chunk& chunk, bool& added)
+    {
+        added = false;
+        for (uint64_t h = HashChunk(chunk.data());; h++) {
+            auto [it, inserted] = index.try_emplace(h, chunks.size());
+            if (inserted) {
+                chunks.push_back(chunk);
+                added = true;
+                return it->second;
+            }
+            if (chunks[it->second] == chunk) return it->second;
+        }
+    }
+
+    bool WriteChunk(const Chunk& chunk)
+    {
+        uint8_t out[CHUNK + 64];
+        deflateReset(&deflater);
+        if (dict.empty() == false)
+            deflateSetDictionary(&deflater, dict.data(), dict.size());
+        deflater.next_in = const_cast<uint8_t*>(chunk.data());
+        deflater.avail_in = CHUNK;
+        deflater.next_out = out;
+        deflater.avail_out = sizeof out;
+        bool shrunk = deflate(&deflater, Z_FINISH) == Z_STREAM_END &&
+                      deflater.total_out < CHUNK;
+
+        uint16_t size = shrunk ? deflater.total_out : CHUNK;
+        char tag = shrunk ? 'C' : 'R';
+        const uint8_t* data = shrunk ? out : chunk.data();
+        stats.stored_bytes += 1 + sizeof size + size;
+        return std::fputc(tag, file) != EOF &&
+               std::fwrite(&size, sizeof size, 1, file) == 1 &&
+               std::fwrite(data, size, 1, file) == 1;
+    }
+
+    bool WriteManifest(const Manifest& manifest)
+    {
+        stats.stored_bytes += 1 + sizeof manifest;
+        return std::fputc('M', file) != EOF &&
+               std::fwrite(&manifest, sizeof manifest, 1, file) == 1;
+    }
+
+    /* only the chunk ids that differ from the previous snapshot */
+    bool WriteDelta(const Manifest& manifest,
+                    const uint8_t* changed,
+                    uint8_t count)
+    {
+        stats.stored_bytes += 2 + count * (1 + sizeof(uint32_t));
+        if (std::fputc('D', file) == EOF || std::fputc(count, file) == EOF)
+            return false;
+        for (uint8_t i = 0; i < count; i++) {
+            const uint32_t& id = manifest[changed[i]];
+            if (std::fputc(changed[i], file) == EOF ||
+                std::fwrite(&id, sizeof id, 1, file) != 1)
+                return false;
+        }
+        return true;
+    }
+
+    bool ReadDelta(Manifest& manifest)
+    {
+        int count = std::fgetc(file);
+        if (count == EOF || manifests.empty()) return false;
+        manifest = manifests.back();
+        for (int i = 0; i < count; i++) {
+            int c = std::fgetc(file);
+            if (c == EOF || size_t(c) >= CHUNKS ||
+                std::fread(&manifest[c], sizeof(uint32_t), 1, file) != 1)
+                return false;
+        }
+        stats.stored_bytes += 2 + count * (1 + sizeof(uint32_t));
+        return true;
+    }
+
+    bool ReadChunk(char tag, Chunk& chunk)
+    {
+        uint16_t size;
+        uint8_t in[CHUNK + 64];
+        if (std::fread(&size, sizeof size, 1, file) != 1 || size > sizeof in ||
+            std::fread(in, size, 1, file) != 1)
+            return false;
+        stats.stored_bytes += 1 + sizeof size + size;
+        if (tag == 'R') {
+            if (size != CHUNK) return false;
+            std::memcpy(chunk.data(), in, CHUNK);
+            return true;
+        }
+        inflateReset(&inflater);
+        if (dict.empty() == false)
+            inflateSetDictionary(&inflater, dict.data(), dict.size());
+        inflater.next_in = in;
+        inflater.avail_in = size;
+        inflater.next_out = chunk.data();
+        inflater.avail_out = CHUNK;
+        return inflate(&inflater, Z_FINISH) == Z_STREAM_END &&
+               inflater.total_out == CHUNK;
+    }
+
+    /* the most common chunks among the samples that appear more than
+     * once, the most common last where deflate reaches them cheapest */
+    static std::vector<uint8_t> Train(const std::vector<system>& samples)
+    {
+        std::unordered_map<uint64_t, std::pair<uint32_t, Chunk>> seen;
+        for (const system& state : samples)
+            for (size_t c = 0; c < CHUNKS; c++) {
+                Chunk chunk = Cut(state, c);
+                auto& entry = seen[HashChunk(chunk.data())];
+                entry.first++;
+                entry.second = chunk;
+            }
+
+        std::vector<std::pair<uint32_t, Chunk>> common;
+        for (auto& [hash, entry] : seen)
+            if (entry.first > 1) common.push_back(entry);
+        std::sort(common.begin(), common.end(), [](auto& a, auto& b) {
+            return a.first > b.first;
+        });
+        common.resize(std::min(common.size(), MAX_DICT / CHUNK));
+
+        std::vector<uint8_t> dict;
+        for (auto it = common.rbegin(); it != common.rend(); ++it)
+            dict.insert(dict.end(), it->second.begin(), it->second.end());
+        return dict;
+    }
+
+    explicit SnapshotStore(std::FILE* file)
+      : file{ file }
+    {
+        deflateInit2(&deflater, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        inflateInit2(&inflater, -15);
+    }
+
+  public:
+    /**
+     * Creates a store, replacing any file at the path.
+     * @param path the file to write
+     * @param samples states to train the compression dictionary on, a few
+     * hundred states typical of what will be stored
+     * @param error set to the reason on failure
+     * @return the store, or nullptr on failure
+     */
+    static std::unique_ptr<SnapshotStore>
+    Create(const std::filesystem::path& path,
+           const std::vector<system>& samples,
+           std::string& error)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "w+b");
+        if (file == nullptr) {
+            error = "cannot create " + path.string();
+            return nullptr;
+        }
+        std::unique_ptr<SnapshotStore> store{ new SnapshotStore{ file } };
+        store->dict = Train(samples);
+
+        FileHeader header{ MAGIC,
+                           VERSION,
+                           sizeof(system),
+                           CHUNK,
+                           static_cast<uint32_t>(store->dict.size()) };
+        if (std::fwrite(&header, sizeof header, 1, file) != 1 ||
+            std::fwrite(store->dict.data(), 1, store->dict.size(), file) !=
+              store->dict.size()) {
+            error = "cannot write " + path.string();
+            return nullptr;
+        }
+        return store;
+    }
+
+    /**
+     * Opens a store, loading every chunk and snapshot into memory. New
+     * snapshots are appended.
+     * @param path the file to open
+     * @param error set to the reason on failure
+     * @return the store, or nullptr if the file is missing, was written by
+     * another build or is damaged
+     */
+    static std::unique_ptr<SnapshotStore>
+    Open(const std::filesystem::path& path, std::string& error)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "r+b");
+        if (file == nullptr) {
+            error = "cannot open " + path.string();
+            return nullptr;
+        }
+        std::unique_ptr<SnapshotStore> store{ new SnapshotStore{ file } };
+
+        FileHeader header;
+        if (std::fread(&header, sizeof header, 1, file) != 1 ||
+            header.magic != MAGIC || header.version != VERSION ||
+            header.state_size != sizeof(system) || header.chunk_size != CHUNK ||
+            header.dict_size > MAX_DICT) {
+            error = path.string() + " is not a snapshot store of this build";
+            return nullptr;
+        }
+        store->dict.resize(header.dict_size);
+        if (std::fread(store->dict.data(), 1, header.dict_size, file) !=
+            header.dict_size) {
+            error = path.string() + " is truncated";
+            return nullptr;
+        }
+
+        long good = std::ftell(file);
+        for (int tag; (tag = std::fgetc(file)) != EOF;) {
+            if (tag == 'M' || tag == 'D') {
+                Manifest manifest;
+                bool read =
+                  tag == 'M'
+                    ? std::fread(&manifest, sizeof manifest, 1, file) == 1
+                    : store->ReadDelta(manifest);
+                if (read == false && std::feof(file)) break;
+                if (read == false) {
+                    error = path.string() + " is damaged";
+                    return nullptr;
+                }
+                if (tag == 'M')
+                    store->stats.stored_bytes += 1 + sizeof manifest;
+                for (uint32_t id : manifest)
+                    if (id >= store->chunks.size()) {
+                        error = path.string() + " is damaged";
+                        return nullptr;
+                    }
+                store->manifests.push_back(manifest);
+                store->stats.states++;
+                store->stats.raw_bytes += sizeof(system);
+            } else {
+                Chunk chunk;
+                bool read = (tag == 'C' || tag == 'R') &&
+                            store->ReadChunk(tag, chunk);
+                if (read == false && std::feof(file)) break;
+                if (read == false) {
+                    error = path.string() + " is damaged";
+                    return nullptr;
+                }
+                bool added;
+                store->Intern(chunk, added);
+                store->stats.chunks++;
+            }
+            good = std::ftell(file);
+        }
+        /* a record torn by a crash while appending is cut off */
+        if (ftruncate(fileno(file), good) != 0 ||
+            std::fseek(file, good, SEEK_SET) != 0) {
+            error = "cannot truncate " + path.string();
+            return nullptr;
+        }
+        return store;
+    }
+
+    SnapshotStore(const SnapshotStore&) = delete;
+    SnapshotStore& operator=(const SnapshotStore&) = delete;
+
+    ~SnapshotStore()
+    {
+        std::fclose(file);
+        deflateEnd(&deflater);
+        inflateEnd(&inflater);
+    }
+
+    /**
+     * Stores a state.
+     * @param state the state
+     * @return the id to Get() it back with, or std::nullopt if the file could
+     * not be written. The store takes no more states after that.
+     */
+    std::optional<uint64_t> Put(const system& state)
+    {
+        if (failed) return std::nullopt;
+        Manifest manifest;
+        uint8_t changed[CHUNKS];
+        uint8_t count = 0;
+        for (size_t c = 0; c < CHUNKS; c++) {
+            Chunk chunk = Cut(state, c);
+            /* most chunks are the ones of the state put before */
+            if (manifests.empty() == false &&
+                chunks[manifests.back()[c]] == chunk) {
+                manifest[c] = manifests.back()[c];
+                continue;
+            }
+            bool added;
+            manifest[c] = Intern(chunk, added);
+            if (added) {
+                failed = failed || WriteChunk(chunk) == false;
+                stats.chunks++;
+            }
+            if (manifests.empty() || manifests.back()[c] != manifest[c])
+                changed[count++] = c;
+        }
+        if (failed) return std::nullopt;
+        bool ok = manifests.empty() || count > CHUNKS / 2
+                    ? WriteManifest(manifest)
+                    : WriteDelta(manifest, changed, count);
+        if (ok == false) {
+            failed = true;
+            return std::nullopt;
+        }
+        manifests.push_back(manifest);
+        stats.states++;
+        stats.raw_bytes += sizeof(system);
+        return manifests.size() - 1;
+    }
+
+    /**
+     * Restores a state.
+     * @param id the id Put() returned
+     * @param state the system to overwrite
+     */
+    void Get(uint64_t id, system& state) const noexcept
+    {
+        auto* out = reinterpret_cast<uint8_t*>(&state);
+        const Manifest& manifest = manifests[id];
+        for (size_t c = 0; c < CHUNKS - 1; c++)
+            std::memcpy(out + c * CHUNK, chunks[manifest[c]].data(), CHUNK);
+        std::memcpy(out + (CHUNKS - 1) * CHUNK,
+                    chunks[manifest[CHUNKS - 1]].data(),
+                    sizeof(system) - (CHUNKS - 1) * CHUNK);
+    }
+
+    /**
+     * Writes buffered records to the file.
+     * @return false if this or an earlier write failed
+     */
+    bool Flush()
+    {
+        failed = std::fflush(file) != 0 || failed;
+        return failed == false;
+    }
+
+    /**
+     * Returns the number of snapshots stored.
+     */
+    size_t Size() const noexcept
+    {
+        return manifests.size();
+    }
+
+    /**
+     * Returns the counters of the store.
+     */
+    const SnapshotStats& Stats() const noexcept
+    {
+        return stats;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
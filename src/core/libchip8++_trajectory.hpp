@@ -0,0 +1,560 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_TRAJECTORY
+#define BASED_CHIP8_TRAJECTORY
+
+#include "libchip8++.hpp"
+#include "libchip8++_conformance.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace Chip8_core {
+
+/**
+ * One recorded step of one instance.
+ */
+struct TrajectoryStep {
+    PackedFrame frame;        /**< The display after the step. */
+    uint16_t keys;            /**< The keys held, one bit per KeyCode. */
+    float reward;             /**< The reward of the step. */
+    std::vector<uint8_t> ram; /**< The selected memory bytes. */
+};
+
+/* the file layout shared by TrajectoryWriter and TrajectoryReader */
+namespace trajectory_file {
+
+constexpr uint64_t MAGIC = 0x4a52544338504843ULL; /* CHP8CTRJ */
+constexpr uint32_t VERSION = 1;
+
+/* frames, keys, rewards and ram, each deflated on its own */
+constexpr int COLUMNS = 4;
+
+struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t instances;
+    uint32_t chunk_steps;
+    uint32_t ram_count; /* followed by as many uint16_t addresses */
+};
+
+struct Chunk {
+    uint32_t instance;
+    uint32_t steps;
+    uint64_t first_step;
+    uint64_t offset; /* of the deflated columns, which follow in order */
+    uint32_t sizes[COLUMNS];
+};
+
+struct Footer {
+    uint64_t index_offset; /* of the Chunk array, chunks in file order */
+    uint64_t chunk_count;
+    uint64_t magic;
+};
+
+} // namespace trajectory_file
+
+/**
+ * Records the steps of many instances into a columnar file for offline
+ * training.
+ *
+ * Steps are buffered per instance as columns: packed frames, key bitsets,
+ * rewards and a fixed selection of memory bytes. When an instance has
+ * buffered a chunk worth of steps the buffer is handed to a writer thread,
+ * which deflates every column on its own and appends it to the file, and
+ * the instance carries on in a spare buffer. Emulation threads only ever
+ * take the queue lock, never wait on zlib or the disk. Close() flushes the
+ * partial chunks and writes the index TrajectoryReader looks chunks up in.
+ *
+ * Record() may be called from several threads as long as each instance is
+ * only recorded by one of them at a time.
+ */
+class TrajectoryWriter {
+  private:
+    struct Columns {
+        uint32_t instance;
+        uint32_t steps;
+        uint64_t first_step;
+        std::vector<uint8_t> frames;
+        std::vector<uint16_t> keys;
+        std::vector<float> rewards;
+        std::vector<uint8_t> ram;
+    };
+
+    std::FILE* file;
+    std::vector<uint16_t> ram_addrs;
+    uint32_t chunk_steps;
+    std::vector<std::unique_ptr<Columns>> open;
+    std::vector<uint64_t> recorded;
+    std::vector<trajectory_file::Chunk> index;
+    uint64_t offset;
+    std::vector<uint8_t> deflated;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::unique_ptr<Columns>> queue;
+    std::vector<std::unique_ptr<Columns>> spare;
+    bool stopping;
+    bool failed;
+    std::thread writer;
+
+    std::unique_ptr<Columns> Fresh(uint32_t instance)
+    {
+        std::unique_ptr<Columns> cols;
+        {
+            std::lock_guard guard{ lock };
+            if (spare.empty() == false) {
+                cols = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        if (cols == nullptr) {
+            cols = std::make_unique<Columns>();
+            cols->frames.reserve(chunk_steps * sizeof(PackedFrame));
+            cols->keys.reserve(chunk_steps);
+            cols->rewards.reserve(chunk_steps);
+            cols->ram.reserve(chunk_steps * ram_addrs.size());
+        }
+        cols->instance = instance;
+        cols->steps = 0;
+        cols->first_step = recorded[instance];
+        cols->frames.clear();
+        cols->keys.clear();
+        cols->rewards.clear();
+        cols->ram.clear();
+        return cols;
+    }
+
+    void Hand(std::unique_ptr<Columns> cols)
+    {
+        {
+            std::lock_guard guard{ lock };
+            queue.push_back(std::move(cols));
+        }
+        wake.notify_one();
+    }
+
+    bool Append(const void* data, size_t size, uint32_t& stored)
+    {
+        uLongf bound = compressBound(size);
+        deflated.resize(bound);
+        if (compress2(deflated.data(),
+                      &bound,
+                      static_cast<const Bytef*>(data),
+                      size,
+                      Z_BEST_SPEED) != Z_OK)
+            return false;
+        stored = bound;
+        offset += bound;
+        return std::fwrite(deflated.data(), 1, bound, file) == bound;
+    }
+
+    void Write()
+    {
+        for (;;) {
+            std::unique_ptr<Columns> cols;
+            {
+                std::unique_lock guard{ lock };
+                wake.wait(guard, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                cols = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            trajectory_file::Chunk chunk{
+                cols->instance, cols->steps, cols->first_step, offset, {}
+            };
+            bool ok =
+              Append(cols->frames.data(),
+                     cols->frames.size(),
+                     chunk.sizes[0]) &&
+              Append(cols->keys.data(),
+                     cols->keys.size() * sizeof(uint16_t),
+                     chunk.sizes[1]) &&
+              Append(cols->rewards.data(),
+                     cols->rewards.size() * sizeof(float),
+                     chunk.sizes[2]) &&
+              Append(cols->ram.data(), cols->ram.size(), chunk.sizes[3]);
+
+            std::lock_guard guard{ lock };
+            if (ok)
+                index.push_back(chunk);
+            else
+                failed = true;
+            spare.push_back(std::move(cols));
+        }
+    }
+
+    TrajectoryWriter(std::FILE* file,
+                     size_t instances,
+                     std::vector<uint16_t> ram_addrs,
+                     uint32_t chunk_steps,
+                     uint64_t offset)
+      : file{ file }
+      , ram_addrs{ std::move(ram_addrs) }
+      , chunk_steps{ chunk_steps }
+      , open(instances)
+      , recorded(instances, 0)
+      , offset{ offset }
+      , stopping{ false }
+      , failed{ false }
+      , writer{ [this] { Write(); } }
+    {
+    }
+
+  public:
+    /**
+     * Creates a trajectory file, replacing any file at the path.
+     * @param path the file to write
+     * @param instances the number of instances that will be recorded
+     * @param ram_addrs the memory addresses recorded every step
+     * @param chunk_steps the steps per instance in a chunk, the unit the
+     * reader inflates, at least 1
+     * @param error set to the reason on failure
+     * @return the writer, or nullptr on failure
+     */
+    static std::unique_ptr<TrajectoryWriter>
+    Create(const std::filesystem::path& path,
+           size_t instances,
+           const std::vector<uint16_t>& ram_addrs,
+           uint32_t chunk_steps,
+           std::string& error)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            error = "cannot create " + path.string();
+            return nullptr;
+        }
+        chunk_steps = std::max(chunk_steps, 1u);
+        trajectory_file::Header header{
+            trajectory_file::MAGIC,
+            trajectory_file::VERSION,
+            static_cast<uint32_t>(instances),
+            chunk_steps,
+            static_cast<uint32_t>(ram_addrs.size())
+        };
+        if (std::fwrite(&header, sizeof header, 1, file) != 1 ||
+            std::fwrite(ram_addrs.data(),
+                        sizeof(uint16_t),
+                        ram_addrs.size(),
+                        file) != ram_addrs.size()) {
+            std::fclose(file);
+            error = "cannot write " + path.string();
+            return nullptr;
+        }
+        return std::unique_ptr<TrajectoryWriter>{ new TrajectoryWriter{
+          file,
+          instances,
+          ram_addrs,
+          chunk_steps,
+          sizeof header + ram_addrs.size() * sizeof(uint16_t) } };
+    }
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    ~TrajectoryWriter()
+    {
+        std::string error;
+        Close(error);
+    }
+
+    /**
+     * Records a step of an instance.
+     * @param instance the instance, below the count given to Create()
+     * @param chip8 the instance after the step
+     * @param keys the keys held during the step, one bit per KeyCode
+     * @param reward the reward of the step
+     */
+    void Record(size_t instance, system& chip8, uint16_t keys, float reward)
+    {
+        auto& cols = open[instance];
+        if (cols == nullptr) cols = Fresh(instance);
+
+        PackedFrame frame = PackDisplay(chip8);
+        cols->frames.insert(cols->frames.end(), frame.begin(), frame.end());
+        cols->keys.push_back(keys);
+        cols->rewards.push_back(reward);
+        for (uint16_t addr : ram_addrs)
+            cols->ram.push_back(chip8[addr]);
+        cols->steps++;
+        recorded[instance]++;
+
+        if (cols->steps == chunk_steps) Hand(std::move(cols));
+    }
+
+    /**
+     * Returns the number of steps recorded for an instance.
+     * @param instance the instance
+     */
+    uint64_t Steps(size_t instance) const noexcept
+    {
+        return recorded[instance];
+    }
+
+    /**
+     * Hands the partial chunks to the writer, waits for it to finish and
+     * writes the index. Recording is not possible afterwards.
+     * @param error set to the reason on failure
+     * @return true if every chunk and the index were written
+     */
+    bool Close(std::string& error)
+    {
+        if (file == nullptr) return true;
+        for (auto& cols : open)
+            if (cols != nullptr) Hand(std::move(cols));
+        {
+            std::lock_guard guard{ lock };
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+
+        trajectory_file::Footer footer{ offset,
+                                        index.size(),
+                                        trajectory_file::MAGIC };
+        bool ok = failed == false &&
+                  std::fwrite(index.data(),
+                              sizeof(trajectory_file::Chunk),
+                              index.size(),
+                              file) == index.size() &&
+                  std::fwrite(&footer, sizeof footer, 1, file) == 1;
+        ok = std::fclose(file) == 0 && ok;
+        file = nullptr;
+        if (ok == false) error = "cannot write the trajectory file";
+        return ok;
+    }
+};
+
+/**
+ * Random access to the steps of a file written by TrajectoryWriter. The file
+ * is mapped, a step is found through the chunk index and its chunk
+ * inflated. The last inflated chunk is kept, so reading the steps of an
+ * instance in order inflates every chunk once. Not safe to share between
+ * threads, open one reader per thread instead.
+ */
+class TrajectoryReader {
+  private:
+    const uint8_t* base;
+    size_t size;
+    const trajectory_file::Header* header;
+    const uint16_t* ram_addrs;
+    std::vector<std::vector<trajectory_file::Chunk>> chunks;
+
+    const trajectory_file::Chunk* cached;
+    std::vector<uint8_t> frames;
+    std::vector<uint16_t> keys;
+    std::vector<float> rewards;
+    std::vector<uint8_t> ram;
+
+    TrajectoryReader(const uint8_t* base, size_t size)
+      : base{ base }
+      , size{ size }
+      , header{ reinterpret_cast<const trajectory_file::Header*>(base) }
+      , ram_addrs{ reinterpret_cast<const uint16_t*>(header + 1) }
+      , cached{ nullptr }
+    {
+    }
+
+    bool Inflate(uint64_t& at, uint32_t stored, void* out, size_t want)
+    {
+        uLongf got = want;
+        if (at + stored > size ||
+            uncompress(static_cast<Bytef*>(out), &got, base + at, stored) !=
+              Z_OK ||
+            got != want)
+            return false;
+        at += stored;
+        return true;
+    }
+
+    bool Load(const trajectory_file::Chunk* chunk)
+    {
+        if (chunk == cached) return true;
+        cached = nullptr;
+        frames.resize(chunk->steps * sizeof(PackedFrame));
+        keys.resize(chunk->steps);
+        rewards.resize(chunk->steps);
+        ram.resize(chunk->steps * header->ram_count);
+        uint64_t at = chunk->offset;
+        if (Inflate(at, chunk->sizes[0], frames.data(), frames.size()) &&
+            Inflate(at,
+                    chunk->sizes[1],
+                    keys.data(),
+                    keys.size() * sizeof(uint16_t)) &&
+            Inflate(at,
+                    chunk->sizes[2],
+                    rewards.data(),
+                    rewards.size() * sizeof(float)) &&
+            Inflate(at, chunk->sizes[3], ram.data(), ram.size()))
+            cached = chunk;
+        return cached != nullptr;
+    }
+
+  public:
+    /**
+     * Opens a trajectory file.
+     * @param path the file to open
+     * @param error set to the reason on failure
+     * @return the reader, or nullptr if the file is missing, was not
+     * closed or is damaged
+     */
+    static std::unique_ptr<TrajectoryReader>
+    Open(const std::filesystem::path& path, std::string& error)
+    {
+        using namespace trajectory_file;
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            error = "cannot open " + path.string();
+            return nullptr;
+        }
+        size_t size = st.st_size;
+        void* map = size > sizeof(Header) + sizeof(Footer)
+                      ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                      : MAP_FAILED;
+        close(fd);
+        if (map == MAP_FAILED) {
+            error = path.string() + " is not a trajectory file";
+            return nullptr;
+        }
+        std::unique_ptr<TrajectoryReader> reader{ new TrajectoryReader{
+          static_cast<const uint8_t*>(map), size } };
+
+        const Header& header = *reader->header;
+        Footer footer;
+        std::memcpy(
+          &footer, reader->base + size - sizeof footer, sizeof footer);
+        if (header.magic != MAGIC || header.version != VERSION ||
+            footer.magic != MAGIC || footer.index_offset > size ||
+            sizeof header + header.ram_count * sizeof(uint16_t) >
+              footer.index_offset ||
+            footer.chunk_count >
+              (size - footer.index_offset) / sizeof(Chunk)) {
+            error = path.string() + " is not a closed trajectory file";
+            return nullptr;
+        }
+
+        reader->chunks.resize(header.instances);
+        for (uint64_t i = 0; i < footer.chunk_count; i++) {
+            Chunk chunk;
+            std::memcpy(&chunk,
+                        reader->base + footer.index_offset + i * sizeof chunk,
+                        sizeof chunk);
+            if (chunk.instance >= header.instances) {
+                error = path.string() + " is damaged";
+                return nullptr;
+            }
+            reader->chunks[chunk.instance].push_back(chunk);
+        }
+        /* chunks of an instance are queued in order but stay sorted even if
+         * a future writer interleaves them */
+        for (auto& list : reader->chunks)
+            std::sort(list.begin(), list.end(), [](auto& a, auto& b) {
+                return a.first_step < b.first_step;
+            });
+        return reader;
+    }
+
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    ~TrajectoryReader()
+    {
+        munmap(const_cast<uint8_t*>(base), size);
+    }
+
+    /**
+     * Returns the number of instances in the file.
+     */
+    size_t Instances() const noexcept
+    {
+        return chunks.size();
+    }
+
+    /**
+     * Returns the number of steps recorded for an instance.
+     * @param instance the instance
+     */
+    uint64_t Steps(size_t instance) const noexcept
+    {
+        const auto& list = chunks[instance];
+        return list.empty() ? 0 : list.back().first_step + list.back().steps;
+    }
+
+    /**
+     * Returns the memory addresses recorded every step, in the order of
+     * TrajectoryStep::ram.
+     */
+    std::vector<uint16_t> RamAddresses() const
+    {
+        return { ram_addrs, ram_addrs + header->ram_count };
+    }
+
+    /**
+     * Reads a step.
+     * @param instance the instance
+     * @param step the step, below Steps(instance)
+     * @param out set to the step
+     * @return false if the step is out of range or its chunk is damaged
+     */
+    bool Read(size_t instance, uint64_t step, TrajectoryStep& out)
+    {
+        if (instance >= chunks.size()) return false;
+        const auto& list = chunks[instance];
+        auto it = std::upper_bound(
+          list.begin(), list.end(), step, [](uint64_t s, auto& chunk) {
+              return s < chunk.first_step;
+          });
+        if (it == list.begin()) return false;
+        const trajectory_file::Chunk& chunk = *--it;
+        if (step - chunk.first_step >= chunk.steps || !Load(&chunk))
+            return false;
+
+        size_t i = step - chunk.first_step;
+        std::memcpy(out.frame.data(),
+                    frames.data() + i * sizeof(PackedFrame),
+                    sizeof(PackedFrame));
+        out.keys = keys[i];
+        out.reward = rewards[i];
+        out.ram.assign(ram.begin() + i * header->ram_count,
+                       ram.begin() + (i + 1) * header->ram_count);
+        return true;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,164 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_TTABLE
+#define BASED_CHIP8_TTABLE
+
+#include "libchip8++.hpp"
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+namespace Chip8_core {
+
+/**
+ * A fixed size transposition table for searches that reach the same machine
+ * state through different paths. States are identified by system::Hash() and
+ * each one maps to a 64-bit value whose meaning is up to the search, such as
+ * a packed score and visit count.
+ * The table is lossy: buckets hold a handful of entries and a full bucket
+ * overwrites one of them, so Probe() may miss a state stored earlier. It never
+ * takes a lock and may be shared by any number of threads. Every entry stores
+ * its value next to its key XORed with that value, a torn write from a
+ * racing thread fails the check and reads as a miss. The key is the upper
+ * hash half with the low bit set. No key is zero, so an empty entry never
+ * matches and an entry holding any value, its own key included, is never
+ * taken for empty.
+ */
+class TranspositionTable {
+  private:
+    static constexpr size_t WAYS = 4;
+
+    struct Entry {
+        std::atomic<uint64_t> check; /* Key() ^ data, same as data if empty */
+        std::atomic<uint64_t> data;
+    };
+
+    struct alignas(64) Bucket {
+        Entry entries[WAYS];
+    };
+
+    std::unique_ptr<Bucket[]> buckets;
+    size_t mask;
+
+    Bucket& BucketFor(const Hash128& hash) const noexcept
+    {
+        return buckets[hash.lo & mask];
+    }
+
+    static uint64_t Key(const Hash128& hash) noexcept
+    {
+        return hash.hi | 1;
+    }
+
+  public:
+    /**
+     * Constructs the TranspositionTable.
+     * @param entries the minimum number of entries, rounded up so the number
+     * of buckets is a power of two
+     */
+    explicit TranspositionTable(size_t entries)
+      : buckets{ std::make_unique<Bucket[]>(
+          std::bit_ceil((entries + WAYS - 1) / WAYS | 1)) }
+      , mask{ std::bit_ceil((entries + WAYS - 1) / WAYS | 1) - 1 }
+    {
+    }
+
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    /**
+     * Looks a state up.
+     * @param hash the state hash
+     * @param data set to the stored value on a hit, left alone otherwise
+     * @return whether the state was found
+     */
+    bool Probe(const Hash128& hash, uint64_t& data) const noexcept
+    {
+        for (const Entry& e : BucketFor(hash).entries) {
+            uint64_t d = e.data.load(std::memory_order_relaxed);
+            uint64_t c = e.check.load(std::memory_order_relaxed);
+            if ((c ^ d) == Key(hash)) {
+                data = d;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Stores the value of a state, replacing its previous value. If the
+     * bucket is full an entry picked by the hash is evicted.
+     * @param hash the state hash
+     * @param data the value to store
+     */
+    void Store(const Hash128& hash, uint64_t data) noexcept
+    {
+        Bucket& b = BucketFor(hash);
+        Entry* victim = &b.entries[hash.hi % WAYS];
+        for (Entry& e : b.entries) {
+            uint64_t c = e.check.load(std::memory_order_relaxed);
+            uint64_t d = e.data.load(std::memory_order_relaxed);
+            if ((c ^ d) == Key(hash) || c == d) {
+                victim = &e;
+                break;
+            }
+        }
+        victim->check.store(Key(hash) ^ data, std::memory_order_relaxed);
+        victim->data.store(data, std::memory_order_relaxed);
+    }
+
+    /**
+     * Looks a state up and stores a value for it if it was missing, the
+     * hash-consing form of Probe() and Store().
+     * @param hash the state hash
+     * @param data the value to store on a miss, set to the stored value on a
+     * hit
+     * @return whether the state was already present
+     */
+    bool Intern(const Hash128& hash, uint64_t& data) noexcept
+    {
+        if (Probe(hash, data)) return true;
+        Store(hash, data);
+        return false;
+    }
+
+    /**
+     * Empties the table. Must not race with other calls.
+     */
+    void Clear() noexcept
+    {
+        for (size_t i = 0; i <= mask; i++)
+            for (Entry& e : buckets[i].entries) {
+                e.check.store(0, std::memory_order_relaxed);
+                e.data.store(0, std::memory_order_relaxed);
+            }
+    }
+
+    /**
+     * Returns the number of entries the table can hold.
+     */
+    size_t Capacity() const noexcept
+    {
+        return (mask + 1) * WAYS;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -0,0 +1,148 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BASED_CHIP8_WORKERS
+#define BASED_CHIP8_WORKERS
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Chip8_core {
+
+/**
+ * A fixed set of threads that run one job at a time, for spreading
+ * emulation work over the cores. The threads are started once and sleep
+ * between jobs, the thread calling Run() takes part as worker 0.
+ */
+class WorkerPool {
+  private:
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(unsigned)>* job;
+    uint64_t generation;
+    unsigned pending;
+    bool stopping;
+
+    void Work(unsigned worker)
+    {
+        uint64_t seen = 0;
+        for (;;) {
+            std::unique_lock guard{ lock };
+            wake.wait(guard,
+                      [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            const auto* fn = job;
+            guard.unlock();
+
+            (*fn)(worker);
+
+            guard.lock();
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+  public:
+    /**
+     * Constructs the WorkerPool.
+     * @param workers the number of workers including the calling thread,
+     * zero picks one per hardware thread
+     */
+    explicit WorkerPool(unsigned workers = 0)
+      : job{ nullptr }
+      , generation{ 0 }
+      , pending{ 0 }
+      , stopping{ false }
+    {
+        if (workers == 0)
+            workers = std::max(1u, std::thread::hardware_concurrency());
+        threads.reserve(workers - 1);
+        for (unsigned i = 1; i < workers; i++)
+            threads.emplace_back([this, i] { Work(i); });
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard guard{ lock };
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    /**
+     * Calls fn once on every worker, in parallel, and waits for all of them
+     * to return. Must not be called from inside a job.
+     * @param fn the job, receives the index of the worker running it
+     */
+    void Run(const std::function<void(unsigned)>& fn)
+    {
+        {
+            std::lock_guard guard{ lock };
+            job = &fn;
+            pending = threads.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        fn(0);
+
+        std::unique_lock guard{ lock };
+        done.wait(guard, [&] { return pending == 0; });
+    }
+
+    /**
+     * Calls fn for every index in [0, count), spread over the workers.
+     * Indices are handed out one at a time so uneven tasks balance out.
+     * @param count the number of indices
+     * @param fn receives the index and the worker running it
+     */
+    void ParallelFor(size_t count,
+                     const std::function<void(size_t, unsigned)>& fn)
+    {
+        std::atomic<size_t> next{ 0 };
+        Run([&](unsigned worker) {
+            for (size_t i; (i = next.fetch_add(1)) < count;)
+                fn(i, worker);
+        });
+    }
+
+    /**
+     * Returns the number of workers including the calling thread.
+     */
+    unsigned Size() const noexcept
+    {
+        return threads.size() + 1;
+    }
+};
+
+} // namespace Chip8_core
+
+#endif
@@ -1,2 +1,87 @@
-#define LIBCHIP8_IMPLEMENTATION_SOURCE
-#include "libchip8++.hpp"
\ No newline at end of file
+#include "libchip8++.hpp"
+
+/* The core is meant to stay usable in constant expressions, these fail to
+ * compile the moment an instruction stops being constexpr-evaluable. */
+namespace {
+
+namespace c8 = Chip8_core;
+
+template<size_t N>
+constexpr c8::system
+run_program(const std::array<uint8_t, N>& rom, unsigned cycles)
+{
+    return c8::run(
+      c8::system{ c8::MakeBootImage(rom), 0 }, c8::Quirks::MATT, cycles);
+}
+
+/* V0 := 5, V1 := 7, V0 += V1, call 0x20A, jump to self, V2 += 1, return */
+constexpr std::array<uint8_t, 14> alu_call{ 0x60, 0x05, 0x61, 0x07, 0x80,
+                                            0x14, 0x22, 0x0A, 0x12, 0x08,
+                                            0x72, 0x01, 0x00, 0xEE };
+static_assert(run_program(alu_call, 7).GetRegister(c8::Registers::R0) == 12);
+static_assert(run_program(alu_call, 7).GetRegister(c8::Registers::R2) == 1);
+static_assert(run_program(alu_call, 7).GetPC() == 0x208);
+
+/* I := 0x300, V0 := 234, BCD V0, load V0..V2 from I */
+constexpr std::array<uint8_t, 8> bcd{ 0xA3, 0x00, 0x60, 0xEA,
+                                      0xF0, 0x33, 0xF2, 0x65 };
+static_assert(run_program(bcd, 4).GetRegister(c8::Registers::R1) == 3);
+
+/* V0 := 7, V1 := 7, V0 -= V1: no borrow, so VF is set */
+constexpr std::array<uint8_t, 6> sub_equal{ 0x60, 0x07, 0x61, 0x07,
+                                            0x80, 0x15 };
+static_assert(run_program(sub_equal, 3).GetRegister(c8::Registers::RF) == 1);
+
+/* store V0..V1 at 0x300, clear V1, load V0..V1 back */
+constexpr std::array<uint8_t, 14> store_load{ 0xA3, 0x00, 0x60, 0x01, 0x61,
+                                              0x02, 0xF1, 0x55, 0x61, 0x00,
+                                              0xA3, 0x00, 0xF1, 0x65 };
+static_assert(run_program(store_load, 7).GetRegister(c8::Registers::R1) == 2);
+
+/* I := font digit 0, draw it at 0,0 */
+constexpr std::array<uint8_t, 4> draw_digit{ 0xF0, 0x29, 0xD0, 0x05 };
+static_assert(run_program(draw_digit, 2).GetPixel(0) == 0xffffffff);
+
+/* the hash kept up to date while drawing matches one computed from scratch */
+constexpr bool
+hash_is_incremental()
+{
+    c8::system chip8{ c8::MakeBootImage(draw_digit), 0 };
+    chip8.Hash();
+    c8::cycle(chip8, c8::Quirks::MATT);
+    c8::cycle(chip8, c8::Quirks::MATT);
+    c8::system fresh = chip8;
+    fresh.MarkMemory(0, 1);
+    return chip8.Hash() == fresh.Hash();
+}
+static_assert(hash_is_incremental());
+
+/* draws digits left to right, clearing the screen now and then */
+constexpr std::array<uint8_t, 14> draw_clear{ 0xF0, 0x29, 0xD0, 0x15, 0x70,
+                                              0x03, 0x30, 0x0F, 0x12, 0x00,
+                                              0x00, 0xE0, 0x12, 0x00 };
+
+/* the incremental hash survives random memory and pixel writes, zeroes
+ * included, mixed with drawing and clearing */
+constexpr bool
+hash_survives_random_writes()
+{
+    c8::system chip8{ c8::MakeBootImage(draw_clear), 0 };
+    chip8.Hash();
+    uint64_t rng = 1;
+    for (int i = 0; i < 64; i++) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t r = rng >> 32;
+        chip8.SetMemory(0x300 + r % 0xD00, r >> 12 & 3 ? r >> 16 : 0);
+        chip8.SetPixel(r >> 8 & 0x7FF, r >> 20 & 1 ? 0xffffffff : 0x0);
+        c8::cycle(chip8, c8::Quirks::COWGOD);
+        if (i % 8 != 7) continue;
+        c8::system fresh = chip8;
+        fresh.MarkMemory(0, 1);
+        if (chip8.Hash() != fresh.Hash()) return false;
+    }
+    return true;
+}
+static_assert(hash_survives_random_writes());
+
+} // namespace
@@ -0,0 +1,918 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "libchip8++.hpp"
+#include "libchip8++_aot.hpp"
+#include "libchip8++_aotcache.hpp"
+#include "libchip8++_batch.hpp"
+#include "libchip8++_bootcache.hpp"
+#include "libchip8++_checkpoint.hpp"
+#include "libchip8++_farm.hpp"
+#include "libchip8++_framestack.hpp"
+#include "libchip8++_memo.hpp"
+#include "libchip8++_numa.hpp"
+#include "libchip8++_obsring.hpp"
+#include "libchip8++_pool.hpp"
+#include "libchip8++_ramsearch.hpp"
+#include "libchip8++_reward.hpp"
+#include "libchip8++_scheduler.hpp"
+#include "libchip8++_search.hpp"
+#include "libchip8++_ttable.hpp"
+#ifdef CHIP8_HAVE_ZLIB
+#include "libchip8++_snapshot.hpp"
+#include "libchip8++_trajectory.hpp"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace c8 = Chip8_core;
+
+#ifndef CHIP8_AOT_COMPILER
+#define CHIP8_AOT_COMPILER "c++"
+#endif
+#ifndef CHIP8_AOT_INCLUDE_DIR
+#define CHIP8_AOT_INCLUDE_DIR "src/core"
+#endif
+
+/* keeps the optimiser from throwing away the work being measured */
+static volatile uint8_t sink;
+
+/* forces the optimiser to assume everything reachable from p is read and
+ * written at this point */
+static inline void
+clobber(void* p)
+{
+    asm volatile("" : : "r"(p) : "memory");
+}
+
+/* runs fn(iterations) and reports the cost per iteration */
+static void
+measure(const char* name, long iterations, const std::function<void(long)>& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn(iterations);
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-40s %12.1f ns/op\n", name, ns / iterations);
+}
+
+static void
+bench_construct(long n)
+{
+    for (long i = 0; i < n; i++) {
+        c8::system chip8{ std::random_device{} };
+        sink = chip8.GetRegister(c8::Registers::R0);
+    }
+}
+
+static void
+bench_construct_image(long n)
+{
+    for (long i = 0; i < n; i++) {
+        c8::system chip8{ c8::DEFAULT_IMAGE, static_cast<uint32_t>(i) };
+        clobber(&chip8);
+    }
+}
+
+static void
+bench_pool(long n)
+{
+    c8::Pool pool{ c8::system{ 0u }, 64 };
+    for (long i = 0; i < n; i++) {
+        c8::system* chip8 = pool.Acquire();
+        sink = chip8->GetRegister(c8::Registers::R0);
+        pool.Release(chip8);
+    }
+}
+
+/* number of instances the reset benchmarks cycle through, large enough for
+ * their state to fall out of the caches like it does in batch workloads */
+static constexpr size_t RESET_INSTANCES = 4096;
+
+/* a rollout touching a handful of bytes and rows, as ~100 frames of a
+ * typical game would */
+static void
+touch(c8::system& chip8, long i)
+{
+    for (uint16_t addr = 0x2F0; addr < 0x300; addr++)
+        chip8.SetMemory(addr, i);
+    for (uint16_t row = 0; row < 4; row++)
+        chip8.SetPixel(row * c8::Constants::DISPW, 0xffffffff);
+}
+
+static void
+bench_reset(long n)
+{
+    std::vector<c8::system> chip8s(RESET_INSTANCES, c8::system{ 0u });
+    c8::BootImage image = chip8s[0].RefMemory();
+    for (long i = 0; i < n; i++) {
+        c8::system& chip8 = chip8s[i % RESET_INSTANCES];
+        touch(chip8, i);
+        chip8.reset(image);
+        clobber(&chip8);
+    }
+}
+
+static void
+bench_reset_copy(long n)
+{
+    const c8::system pristine{ 0u };
+    std::vector<c8::system> chip8s(RESET_INSTANCES, pristine);
+    for (long i = 0; i < n; i++) {
+        c8::system& chip8 = chip8s[i % RESET_INSTANCES];
+        touch(chip8, i);
+        chip8 = pristine;
+        clobber(&chip8);
+    }
+}
+
+/* clears the screen, counts V0 up to 250 writing each value into memory,
+ * then polls the keypad: ~1000 cycles of init before the first impure
+ * instruction */
+static constexpr std::array<uint8_t, 16> warmup_rom{
+    0x00, 0xE0, 0xA3, 0x00, 0x70, 0x01, 0xF0, 0x55,
+    0x30, 0xFA, 0x12, 0x04, 0xE0, 0x9E, 0x12, 0x0C
+};
+static constexpr c8::BootImage warmup_image = c8::MakeBootImage(warmup_rom);
+
+static void
+bench_start_cold(long n)
+{
+    for (long i = 0; i < n; i++) {
+        c8::system chip8{ warmup_image, static_cast<uint32_t>(i) };
+        c8::BootCache::WarmUp(chip8, c8::Quirks::COWGOD, 1'000'000);
+        clobber(&chip8);
+    }
+}
+
+static void
+bench_start_cached(long n)
+{
+    c8::BootCache cache;
+    uint64_t hash = c8::HashImage(warmup_image);
+    for (long i = 0; i < n; i++) {
+        c8::system chip8 = cache.Start(
+          warmup_image, hash, c8::Quirks::COWGOD, static_cast<uint32_t>(i));
+        clobber(&chip8);
+    }
+}
+
+/* redraws a two digit score through a subroutine in a loop: BCD, load the
+ * digits, draw both with the font */
+static constexpr std::array<uint8_t, 30> score_rom{
+    0x6A, 0x2A, 0x22, 0x08, 0x12, 0x02, 0x00, 0x00, 0xA3, 0x00,
+    0xFA, 0x33, 0xF2, 0x65, 0xF1, 0x29, 0x63, 0x00, 0xD3, 0x35,
+    0xF2, 0x29, 0x63, 0x05, 0xD3, 0x05, 0x00, 0xEE, 0x00, 0x00
+};
+static constexpr c8::BootImage score_image = c8::MakeBootImage(score_rom);
+
+/* calls a subroutine multiplying VA by 50 through repeated addition, ~200
+ * cycles per call */
+static constexpr std::array<uint8_t, 22> multiply_rom{
+    0x6A, 0x2A, 0x22, 0x08, 0x12, 0x02, 0x00, 0x00, 0x60, 0x00, 0x62,
+    0x00, 0x80, 0xA4, 0x72, 0x01, 0x32, 0x32, 0x12, 0x0C, 0x00, 0xEE
+};
+static constexpr c8::BootImage multiply_image =
+  c8::MakeBootImage(multiply_rom);
+
+static void
+run_cycles(const c8::BootImage& image, long n)
+{
+    c8::system chip8{ image, 0 };
+    for (long i = 0; i < n; i++)
+        c8::cycle(chip8, c8::Quirks::COWGOD);
+    clobber(&chip8);
+}
+
+static void
+run_memo(const c8::BootImage& image, long n)
+{
+    c8::system chip8{ image, 0 };
+    c8::SubroutineMemo memo{ c8::Quirks::COWGOD };
+    for (long i = 0; i < n;)
+        i += memo.Step(chip8);
+    clobber(&chip8);
+}
+
+/* the multiply loop built into a plugin by the "AotCache::Get, cold" entry,
+ * which runs right before the entries using it */
+static std::unique_ptr<c8::AotEngine> multiply_aot;
+
+static c8::AotCache&
+aot_cache()
+{
+    static c8::AotCache cache{
+        std::filesystem::temp_directory_path() / "chip8-bench-aot",
+        CHIP8_AOT_COMPILER,
+        c8::AotIncludeDir(CHIP8_AOT_INCLUDE_DIR)
+    };
+    return cache;
+}
+
+/* translates and compiles from scratch when cold, loads from disk when warm */
+static void
+bench_aot_cache(long n, bool cold)
+{
+    namespace fs = std::filesystem;
+    std::string error;
+    for (long i = 0; i < n; i++) {
+        if (cold) fs::remove_all(fs::temp_directory_path() / "chip8-bench-aot");
+        multiply_aot =
+          aot_cache().Get(multiply_image, c8::Quirks::COWGOD, error);
+        if (multiply_aot == nullptr) {
+            fprintf(stderr, "AotCache::Get failed: %s\n", error.c_str());
+            return;
+        }
+    }
+}
+
+static void
+run_aot(const c8::BootImage& image, long n)
+{
+    if (multiply_aot == nullptr) {
+        printf("(no plugin, skipped) ");
+        return;
+    }
+    c8::system chip8{ image, 0 };
+    multiply_aot->Run(chip8, n);
+    clobber(&chip8);
+}
+
+/* hashes the state after every cycle, from scratch when full is set */
+static void
+run_hash(long n, bool full)
+{
+    c8::system chip8{ score_image, 0 };
+    uint64_t acc = 0;
+    for (long i = 0; i < n; i++) {
+        c8::cycle(chip8, c8::Quirks::COWGOD);
+        if (full) chip8.MarkMemory(0, 1);
+        acc += chip8.Hash().lo;
+    }
+    sink = static_cast<uint8_t>(acc);
+}
+
+static void
+bench_ttable(long n)
+{
+    c8::TranspositionTable table{ 1 << 20 };
+    c8::system chip8{ score_image, 0 };
+    uint64_t hits = 0;
+    for (long i = 0; i < n; i++) {
+        c8::cycle(chip8, c8::Quirks::COWGOD);
+        uint64_t visits = 1;
+        if (table.Intern(chip8.Hash(), visits))
+            table.Store(chip8.Hash(), visits + 1);
+        hits += visits;
+    }
+    sink = static_cast<uint8_t>(hits);
+}
+
+/* the instances the "batch" entries step, filled by the "allocate" entry
+ * running right before them */
+static std::vector<c8::system> batch_machines;
+
+static void
+batch_allocate(long n)
+{
+    batch_machines.clear();
+    batch_machines.shrink_to_fit();
+    double avail = double(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+    if (n * sizeof(c8::system) > avail * 0.8) {
+        printf("(%ld instances do not fit in memory, skipped) ", n);
+        return;
+    }
+    batch_machines.assign(n, c8::system{ multiply_image, 0 });
+}
+
+/* one 10 cycle frame per instance per sweep, n counts cycles */
+static void
+batch_run(long n, unsigned group, bool prefetch)
+{
+    if (batch_machines.empty()) {
+        printf("(no instances, skipped) ");
+        return;
+    }
+    c8::Batch batch{ c8::Quirks::COWGOD, group, prefetch };
+    for (c8::system& chip8 : batch_machines)
+        batch.Add(chip8);
+    for (long i = 0; i < n; i += batch.Size() * 10)
+        batch.Frame(10);
+    clobber(batch_machines.data());
+}
+
+/* a frame then a reward over 10k instances, n counts instance frames. The
+ * score and lives of a typical game: BCD digits and a counter */
+static void
+bench_reward(long n)
+{
+    std::string error;
+    auto reward = c8::RewardExpr::Compile(
+      "bcd(mem[0x2F0..0x2F2]) - prev + 10 * (mem[0x2F8] < prev)", error);
+    if (reward == nullptr) {
+        printf("(%s, skipped) ", error.c_str());
+        return;
+    }
+    std::vector<c8::system> machines(10'000, c8::system{ multiply_image, 0 });
+    c8::Batch batch{ c8::Quirks::COWGOD };
+    for (c8::system& chip8 : machines)
+        batch.Add(chip8);
+    std::vector<int64_t> rewards(batch.Size());
+
+    double frame_ns = 0, reward_ns = 0;
+    for (long i = 0; i < n; i += batch.Size()) {
+        auto start = std::chrono::steady_clock::now();
+        batch.Frame(10);
+        auto mid = std::chrono::steady_clock::now();
+        reward->Evaluate(batch, rewards);
+        auto end = std::chrono::steady_clock::now();
+        frame_ns +=
+          std::chrono::duration<double, std::nano>(mid - start).count();
+        reward_ns +=
+          std::chrono::duration<double, std::nano>(end - mid).count();
+    }
+    sink = rewards[0];
+    printf("(%zu insns, Evaluate %.1f%% of the step) ",
+           reward->Instructions(),
+           100 * reward_ns / (frame_ns + reward_ns));
+}
+
+/* waits for a key forever */
+static constexpr std::array<uint8_t, 4> wait_rom{ 0xF0, 0x0A, 0x12, 0x00 };
+static constexpr c8::BootImage wait_image = c8::MakeBootImage(wait_rom);
+
+/* 10k instances of which 1 in 100 runs the multiply loop and the rest wait
+ * on FX0A, n counts frames */
+static void
+bench_waiting(long n, bool coroutines)
+{
+    std::vector<c8::system> chip8s;
+    chip8s.reserve(10'000);
+    for (size_t i = 0; i < 10'000; i++)
+        chip8s.emplace_back(i % 100 ? wait_image : multiply_image, 0);
+
+    c8::Scheduler scheduler{ c8::Quirks::COWGOD };
+    c8::Batch batch{ c8::Quirks::COWGOD };
+    for (c8::system& chip8 : chip8s) {
+        scheduler.Add(chip8);
+        batch.Add(chip8);
+    }
+    for (long i = 0; i < n; i++)
+        coroutines ? scheduler.Frame() : batch.Frame(10);
+    clobber(chip8s.data());
+}
+
+/* 4 interactive and 10k batch instances all running the multiply loop
+ * with 250us per frame, less than the batch instances need, n counts
+ * frames */
+static void
+bench_priority(long n)
+{
+    std::vector<c8::system> chip8s(10'004, c8::system{ multiply_image, 0 });
+    c8::Scheduler scheduler{ c8::Quirks::COWGOD };
+    for (size_t i = 0; i < chip8s.size(); i++)
+        scheduler.Add(chip8s[i], i < 4 ? c8::INTERACTIVE : c8::BATCH);
+    for (long i = 0; i < n; i++)
+        scheduler.Frame(std::chrono::microseconds{ 250 });
+
+    const c8::ClassStats& fg = scheduler.Stats(c8::INTERACTIVE);
+    const c8::ClassStats& bg = scheduler.Stats(c8::BATCH);
+    printf("(interactive: max %.1f us, batch: %.0f frames/s, %.0f%% "
+           "deferred) ",
+           fg.max_latency_ns / 1e3,
+           bg.frames / (bg.busy_ns / 1e9),
+           100.0 * bg.deferred / (bg.frames + bg.deferred));
+}
+
+/* n jobs through a farm of 2 worker processes, keeping their rings full */
+static void
+bench_farm(long n, uint32_t frames)
+{
+    c8::Farm farm{ std::span{ &multiply_image, 1 }, 2 };
+    std::vector<c8::FarmResult> results;
+    results.reserve(n);
+    long submitted = 0;
+    while (static_cast<long>(results.size()) < n) {
+        for (; submitted < n; submitted++) {
+            c8::FarmJob job{ static_cast<uint64_t>(submitted),
+                             0,
+                             c8::Quirks::COWGOD,
+                             frames,
+                             10,
+                             0,
+                             0x200,
+                             1 };
+            if (farm.Submit(job) == false) break;
+        }
+        farm.Wait(results);
+    }
+    sink = static_cast<uint8_t>(results.back().hash.lo);
+}
+
+/* one step of 1024 environments to a trainer process answering with a key
+ * per environment, the observations are written once up front */
+static void
+bench_obsring(long n)
+{
+    constexpr size_t ENVS = 1024;
+    std::string error;
+    auto ring = c8::ObservationRing::Create("/chip8-bench", ENVS, 2, error);
+    if (ring == nullptr) {
+        printf("(%s, skipped) ", error.c_str());
+        return;
+    }
+    c8::system chip8{ score_image, 0 };
+    c8::frame(chip8, c8::Quirks::COWGOD, 10);
+
+    pid_t trainer = fork();
+    if (trainer == 0) {
+        auto peer = c8::ObservationRing::Attach("/chip8-bench", error);
+        while (peer && peer->Observe(std::chrono::seconds{ 1 })) {
+            uint16_t* actions = peer->Actions();
+            for (size_t env = 0; env < ENVS; env++)
+                actions[env] = peer->Frames()[env][0] ^
+                               static_cast<uint16_t>(peer->Rewards()[env]);
+            peer->Act();
+        }
+        _exit(0);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t env = 0; env < ENVS; env++)
+        ring->Write(env, chip8, env % 3, false);
+    auto end = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < n; i++) {
+        ring->Publish();
+        if (ring->WaitActions(std::chrono::seconds{ 1 }) == false) break;
+        sink = ring->Action(i % ENVS);
+    }
+    ring->Close();
+    waitpid(trainer, nullptr, 0);
+    printf("(Write %.0f ns per env) ",
+           std::chrono::duration<double, std::nano>(end - start).count() /
+             ENVS);
+}
+
+/* 100k instances over one worker per CPU, n counts instance frames. The
+ * topology comes from CHIP8_TOPOLOGY ("0-3;4-7" style) if set, run under
+ * numactl --membind to see the cost of the unplaced layout on one node */
+static void
+bench_numa(long n, bool placed)
+{
+    const char* spec = std::getenv("CHIP8_TOPOLOGY");
+    c8::Topology topology =
+      spec ? c8::Topology::Parse(spec) : c8::Topology::Detect();
+    c8::WorkerPool pool;
+    c8::PlacedBatch batch{ pool,
+                           topology,
+                           c8::system{ multiply_image, 0 },
+                           100'000,
+                           c8::Quirks::COWGOD,
+                           placed };
+    for (long i = 0; i < n; i += batch.Size())
+        batch.Frame(10);
+    c8::NumaStats stats = batch.Stats();
+    printf("(%u nodes, %.0f%% local) ",
+           topology.Nodes(),
+           100.0 * stats.local / (stats.local + stats.remote));
+}
+
+/* one frame on every instance of a checkpoint file, then a commit, n times.
+ * Skipped when both copies of the state do not fit in memory */
+static void
+bench_checkpoint(long n, size_t instances)
+{
+    double avail = double(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+    if (2 * instances * sizeof(c8::system) > avail * 0.8) {
+        printf("(%zu instances do not fit in memory, skipped) ", instances);
+        return;
+    }
+    std::string error;
+    auto file = std::filesystem::temp_directory_path() / "chip8-bench.ckpt";
+    auto ckpt = c8::Checkpoint::Create(
+      file, instances, c8::system{ multiply_image, 0 }, error);
+    if (ckpt == nullptr) {
+        printf("(%s, skipped) ", error.c_str());
+        return;
+    }
+
+    double commit_ms = 0;
+    for (long i = 0; i < n; i++) {
+        for (size_t idx = 0; idx < instances; idx++)
+            c8::frame((*ckpt)[idx], c8::Quirks::COWGOD, 10);
+        auto start = std::chrono::steady_clock::now();
+        if (ckpt->Commit() == false) {
+            printf("(cannot write %s, skipped) ", file.c_str());
+            ckpt.reset();
+            std::filesystem::remove(file);
+            return;
+        }
+        auto end = std::chrono::steady_clock::now();
+        commit_ms +=
+          std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    printf("(Commit %.1f ms) ", commit_ms / n);
+    ckpt.reset();
+    std::filesystem::remove(file);
+}
+
+/* the score loop redrawing every value of VA, one state per frame */
+static std::vector<c8::system>
+score_trajectory(size_t frames)
+{
+    std::vector<c8::system> states;
+    c8::system chip8{ score_image, 0 };
+    for (size_t i = 0; i < frames; i++) {
+        chip8.SetRegister(c8::Registers::RA, i);
+        c8::frame(chip8, c8::Quirks::COWGOD, 10);
+        states.push_back(chip8);
+    }
+    return states;
+}
+
+static std::vector<c8::system> snapshot_states = score_trajectory(4096);
+
+#ifdef CHIP8_HAVE_ZLIB
+static std::unique_ptr<c8::SnapshotStore> snapshots;
+
+static void
+snapshot_put(long n)
+{
+    std::string error;
+    auto file = std::filesystem::temp_directory_path() / "chip8-bench.snap";
+    std::vector<c8::system> samples(snapshot_states.begin(),
+                                    snapshot_states.begin() + 256);
+    snapshots = c8::SnapshotStore::Create(file, samples, error);
+    if (snapshots == nullptr) {
+        printf("(%s, skipped) ", error.c_str());
+        return;
+    }
+    bool written = true;
+    for (long i = 0; i < n && written; i++)
+        written = snapshots->Put(snapshot_states[i % snapshot_states.size()])
+                    .has_value();
+    written = snapshots->Flush() && written;
+    std::filesystem::remove(file);
+    if (written == false) {
+        printf("(cannot write %s, skipped) ", file.c_str());
+        snapshots.reset();
+        return;
+    }
+
+    const c8::SnapshotStats& stats = snapshots->Stats();
+    printf("(%llu chunks, %.1f bytes per state) ",
+           static_cast<unsigned long long>(stats.chunks),
+           double(stats.stored_bytes) / stats.states);
+}
+
+static void
+snapshot_get(long n)
+{
+    if (snapshots == nullptr) return;
+    c8::system chip8{ score_image, 0 };
+    for (long i = 0; i < n; i++) {
+        snapshots->Get(i * 7919 % snapshots->Size(), chip8);
+        clobber(&chip8);
+    }
+}
+
+static const auto trajectory_file =
+  std::filesystem::temp_directory_path() / "chip8-bench.trj";
+
+/* records the snapshot trajectory as 64 instances, Close() included */
+static void
+trajectory_record(long n)
+{
+    std::string error;
+    auto writer = c8::TrajectoryWriter::Create(
+      trajectory_file, 64, { 0x300, 0x301, 0x302 }, 256, error);
+    if (writer == nullptr) {
+        printf("(%s, skipped) ", error.c_str());
+        return;
+    }
+    for (long i = 0; i < n; i++)
+        writer->Record(i % 64,
+                       snapshot_states[i % snapshot_states.size()],
+                       i & 0xFFFF,
+                       i % 3);
+    if (writer->Close(error) == false) printf("(%s) ", error.c_str());
+    printf("(%.1f bytes per step) ",
+           double(std::filesystem::file_size(trajectory_file)) / n);
+}
+
+static void
+trajectory_read(long n, bool random)
+{
+    std::string error;
+    auto reader = c8::TrajectoryReader::Open(trajectory_file, error);
+    if (reader == nullptr) {
+        printf("(%s, skipped) ", error.c_str());
+        return;
+    }
+    c8::TrajectoryStep step;
+    uint64_t steps = reader->Steps(0);
+    for (long i = 0; i < n; i++) {
+        if (random)
+            reader->Read(i % 64, i * 7919 % steps, step);
+        else
+            reader->Read(i / steps % 64, i % steps, step);
+        sink = step.frame[0];
+    }
+    /* the random case runs last */
+    if (random) std::filesystem::remove(trajectory_file);
+}
+#endif
+
+/* pushes the score trajectory into 1024 stacks of 4 and gathers them, n
+ * counts pushes */
+static void
+bench_framestack(long n, bool max_pool)
+{
+    c8::FrameStack stack{ 1024, 4, max_pool };
+    std::vector<uint32_t> indices(stack.Size() * stack.Depth());
+    for (long i = 0; i < n; i++) {
+        stack.Push(i % stack.Size(),
+                   snapshot_states[i % snapshot_states.size()]);
+        if (i % stack.Size() == stack.Size() - 1) stack.Gather(indices);
+    }
+    sink = stack.View(0)[0][0] + indices[0];
+}
+
+/* adds one to V0 every frame key 5 is held, keeps V0 in BCD at 0x300 */
+static constexpr std::array<uint8_t, 14> counter_rom{
+    0xA3, 0x00, 0x60, 0x00, 0x61, 0x05, 0xE1,
+    0xA1, 0x70, 0x01, 0xF0, 0x33, 0x12, 0x06
+};
+static constexpr c8::BootImage counter_image = c8::MakeBootImage(counter_rom);
+
+static c8::SearchConfig
+counter_search()
+{
+    c8::SearchConfig config;
+    config.rewards = { { 0x300, 1, 100 }, { 0x301, 1, 10 }, { 0x302, 1, 1 } };
+    return config;
+}
+
+/* the counter, but key 5 is only read once every 16 frames, the frames in
+ * between are lag frames */
+static constexpr std::array<uint8_t, 22> lag_counter_rom{
+    0xA3, 0x00, 0x60, 0x10, 0xF0, 0x15, 0xF1, 0x07, 0x31, 0x00, 0x12,
+    0x06, 0x61, 0x05, 0xE1, 0xA1, 0x72, 0x01, 0xF2, 0x33, 0x12, 0x02
+};
+static constexpr c8::BootImage lag_counter_image =
+  c8::MakeBootImage(lag_counter_rom);
+
+static void
+bench_mcts(long n, const c8::BootImage& image)
+{
+    c8::Search search{ counter_search() };
+    c8::Plan plan =
+      search.Mcts(c8::system{ image, 0 }, static_cast<unsigned>(n));
+    sink = static_cast<uint8_t>(plan.actions.size());
+}
+
+static void
+bench_beam(long n, const c8::BootImage& image)
+{
+    c8::Search search{ counter_search() };
+    c8::Plan plan =
+      search.Beam(c8::system{ image, 0 }, 16, static_cast<unsigned>(n));
+    sink = static_cast<uint8_t>(plan.actions.size());
+}
+
+static std::unique_ptr<c8::RamSearch> ram_search;
+static std::vector<float> ram_keys;
+
+/* plays the counter with key 5 held at random, a new run every 10k frames,
+ * n counts snapshots */
+static void
+ramsearch_add(long n)
+{
+    ram_search = std::make_unique<c8::RamSearch>();
+    ram_keys.clear();
+    c8::system chip8{ counter_image, 0 };
+    uint32_t rng = 1;
+    for (long i = 0; i < n; i++) {
+        if (i % 10'000 == 0) {
+            chip8 = c8::system{ counter_image, 0 };
+            ram_search->NewRun();
+        }
+        rng = rng * 1664525 + 1013904223;
+        uint8_t held = rng >> 31;
+        chip8.SetKey(c8::KeyCode::Five, held);
+        c8::frame(chip8, c8::Quirks::COWGOD, 10);
+        ram_search->Add(chip8);
+        ram_keys.push_back(held);
+    }
+}
+
+/* n counts snapshots scanned, a scan covers every snapshot */
+static void
+ramsearch_scan(long n, bool rank)
+{
+    if (ram_search == nullptr) return;
+    long scans = 0;
+    size_t found = 0;
+    for (long i = 0; i < n; i += ram_search->Size(), scans++) {
+        ram_search->Reset();
+        if (rank)
+            found = ram_search->Rank(ram_keys, c8::DELTAS, 1)[0].addr;
+        else
+            found = ram_search->Filter(c8::UNCHANGED);
+    }
+    printf(rank ? "(best 0x%zX) " : "(%zu left) ", found);
+}
+
+struct benchmark {
+    const char* name;
+    long iterations;
+    void (*fn)(long);
+};
+
+static const benchmark benchmarks[] = {
+    { "create: system{ std::random_device }", 100'000, bench_construct },
+    { "create: system{ BootImage, seed }", 1'000'000, bench_construct_image },
+    { "create+reset: Pool::Acquire/Release", 1'000'000, bench_pool },
+    { "reset: system::reset", 1'000'000, bench_reset },
+    { "reset: copy from pristine", 1'000'000, bench_reset_copy },
+    { "start: construct and warm up", 10'000, bench_start_cold },
+    { "start: BootCache::Start", 1'000'000, bench_start_cached },
+    { "score loop: cycle",
+      10'000'000,
+      [](long n) { run_cycles(score_image, n); } },
+    { "score loop: SubroutineMemo::Step",
+      10'000'000,
+      [](long n) { run_memo(score_image, n); } },
+    { "multiply loop: cycle",
+      10'000'000,
+      [](long n) { run_cycles(multiply_image, n); } },
+    { "multiply loop: SubroutineMemo::Step",
+      10'000'000,
+      [](long n) { run_memo(multiply_image, n); } },
+    { "multiply loop: AotCache::Get, cold",
+      1,
+      [](long n) { bench_aot_cache(n, true); } },
+    { "multiply loop: AotCache::Get, warm",
+      1'000,
+      [](long n) { bench_aot_cache(n, false); } },
+    { "multiply loop: AotEngine::Run",
+      100'000'000,
+      [](long n) { run_aot(multiply_image, n); } },
+    { "hash: cycle + system::Hash",
+      10'000'000,
+      [](long n) { run_hash(n, false); } },
+    { "hash: cycle + full rehash",
+      100'000,
+      [](long n) { run_hash(n, true); } },
+    { "hash: cycle + TranspositionTable", 10'000'000, bench_ttable },
+    { "scheduler: 10k, 99% on FX0A, Batch::Frame",
+      1'000,
+      [](long n) { bench_waiting(n, false); } },
+    { "scheduler: 10k, 99% on FX0A, Scheduler::Frame",
+      100'000,
+      [](long n) { bench_waiting(n, true); } },
+    { "scheduler: 4 interactive + 10k batch", 10'000, bench_priority },
+    { "farm: empty job round trip",
+      1'000'000,
+      [](long n) { bench_farm(n, 0); } },
+    { "farm: 1 frame job", 1'000'000, [](long n) { bench_farm(n, 1); } },
+    { "framestack 1024 x4: Push + Gather",
+      1'000'000,
+      [](long n) { bench_framestack(n, false); } },
+    { "framestack 1024 x4: Push max pooled + Gather",
+      1'000'000,
+      [](long n) { bench_framestack(n, true); } },
+    { "obsring 1024: Publish + WaitActions", 100'000, bench_obsring },
+    { "numa: 100k, placed + pinned",
+      50'000'000,
+      [](long n) { bench_numa(n, true); } },
+    { "numa: 100k, allocated by one thread",
+      50'000'000,
+      [](long n) { bench_numa(n, false); } },
+    { "checkpoint 10k: frame + Commit",
+      10,
+      [](long n) { bench_checkpoint(n, 10'000); } },
+    { "checkpoint 100k: frame + Commit",
+      3,
+      [](long n) { bench_checkpoint(n, 100'000); } },
+    { "checkpoint 1M: frame + Commit",
+      1,
+      [](long n) { bench_checkpoint(n, 1'000'000); } },
+#ifdef CHIP8_HAVE_ZLIB
+    { "snapshot: Put", 1'000'000, snapshot_put },
+    { "snapshot: Get", 10'000'000, snapshot_get },
+    { "trajectory: Record", 1'000'000, trajectory_record },
+    { "trajectory: Read, in order",
+      1'000'000,
+      [](long n) { trajectory_read(n, false); } },
+    { "trajectory: Read, random step",
+      10'000,
+      [](long n) { trajectory_read(n, true); } },
+#endif
+    { "search: Mcts, per rollout",
+      10'000,
+      [](long n) { bench_mcts(n, counter_image); } },
+    { "search: Beam width 16, per level",
+      100,
+      [](long n) { bench_beam(n, counter_image); } },
+    { "search: Mcts, per rollout, lag frames",
+      10'000,
+      [](long n) { bench_mcts(n, lag_counter_image); } },
+    { "search: Beam width 16, per level, lag frames",
+      100,
+      [](long n) { bench_beam(n, lag_counter_image); } },
+    { "reward 10k: frame + Evaluate", 10'000'000, bench_reward },
+    { "ramsearch 100k: Add", 100'000, ramsearch_add },
+    { "ramsearch 100k: Filter, per snapshot",
+      1'000'000,
+      [](long n) { ramsearch_scan(n, false); } },
+    { "ramsearch 100k: Rank, per snapshot",
+      1'000'000,
+      [](long n) { ramsearch_scan(n, true); } },
+    { "batch 100: allocate", 100, batch_allocate },
+    { "batch 100: sequential",
+      10'000'000,
+      [](long n) { batch_run(n, 1, false); } },
+    { "batch 100: sequential + prefetch",
+      10'000'000,
+      [](long n) { batch_run(n, 1, true); } },
+    { "batch 100: groups of 4",
+      10'000'000,
+      [](long n) { batch_run(n, 4, true); } },
+    { "batch 100: groups of 8",
+      10'000'000,
+      [](long n) { batch_run(n, 8, true); } },
+    { "batch 10k: allocate", 10'000, batch_allocate },
+    { "batch 10k: sequential",
+      10'000'000,
+      [](long n) { batch_run(n, 1, false); } },
+    { "batch 10k: sequential + prefetch",
+      10'000'000,
+      [](long n) { batch_run(n, 1, true); } },
+    { "batch 10k: groups of 4",
+      10'000'000,
+      [](long n) { batch_run(n, 4, true); } },
+    { "batch 10k: groups of 8",
+      10'000'000,
+      [](long n) { batch_run(n, 8, true); } },
+    { "batch 100k: allocate", 100'000, batch_allocate },
+    { "batch 100k: sequential",
+      10'000'000,
+      [](long n) { batch_run(n, 1, false); } },
+    { "batch 100k: sequential + prefetch",
+      10'000'000,
+      [](long n) { batch_run(n, 1, true); } },
+    { "batch 100k: groups of 4",
+      10'000'000,
+      [](long n) { batch_run(n, 4, true); } },
+    { "batch 100k: groups of 8",
+      10'000'000,
+      [](long n) { batch_run(n, 8, true); } },
+    { "batch 1M: allocate", 1'000'000, batch_allocate },
+    { "batch 1M: sequential",
+      10'000'000,
+      [](long n) { batch_run(n, 1, false); } },
+    { "batch 1M: sequential + prefetch",
+      10'000'000,
+      [](long n) { batch_run(n, 1, true); } },
+    { "batch 1M: groups of 4",
+      10'000'000,
+      [](long n) { batch_run(n, 4, true); } },
+    { "batch 1M: groups of 8",
+      10'000'000,
+      [](long n) { batch_run(n, 8, true); } },
+};
+
+/* usage: chip8-bench [filter], runs every benchmark whose name contains
+ * filter */
+int
+main(int argc, char** argv)
+{
+    const char* filter = argc > 1 ? argv[1] : "";
+    for (const auto& b : benchmarks)
+        if (std::strstr(b.name, filter)) measure(b.name, b.iterations, b.fn);
+}
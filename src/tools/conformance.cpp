@@ -0,0 +1,295 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "libchip8++.hpp"
+#include "libchip8++_aotcache.hpp"
+#include "libchip8++_conformance.hpp"
+#include "libchip8++_workers.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Runs a conformance suite described by a manifest, one case per line:
+ *
+ *     # name  rom                quirks  frames  [options]
+ *     flags   roms/4-flags.ch8   all     200
+ *     quirks  roms/5-quirks.ch8  cowgod  300     poke=0x1FF:1
+ *     keypad  roms/6-keypad.ch8  matt    200     poke=0x1FF:1 key=40:5:down
+ *
+ * quirks is matt, cowgod or all. Options are cycles=N (cycles per frame,
+ * default 10), poke=ADDR:VALUE (memory written before the first cycle) and
+ * key=FRAME:KEY:down|up. ROM paths are relative to the manifest, the golden
+ * display of each case lives in golden/NAME.QUIRKS.bin next to it. Every case
+ * runs on every engine, --update rewrites the goldens from the reference
+ * implementation. AOT plugins are kept in the --aot-cache directory.
+ */
+
+namespace c8 = Chip8_core;
+namespace fs = std::filesystem;
+
+static const char* const QUIRK_NAMES[] = { "matt", "cowgod" };
+static const char* const ENGINE_NAMES[] = {
+    "interpreter", "memo", "aot", "batch", "reference"
+};
+
+#ifndef CHIP8_AOT_COMPILER
+#define CHIP8_AOT_COMPILER "c++"
+#endif
+#ifndef CHIP8_AOT_INCLUDE_DIR
+#define CHIP8_AOT_INCLUDE_DIR "src/core"
+#endif
+
+static void
+usage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--update] [--threads N] [--aot-cache DIR] manifest\n"
+            "runs every case of the manifest on every engine and compares "
+            "the final display to the golden one\n",
+            argv0);
+    std::exit(1);
+}
+
+static unsigned long
+parse_number(const std::string& s, const fs::path& manifest, int line)
+{
+    char* end;
+    unsigned long v = std::strtoul(s.c_str(), &end, 0);
+    if (s.empty() || *end != '\0') {
+        fprintf(stderr,
+                "%s:%d: '%s' is not a number\n",
+                manifest.c_str(),
+                line,
+                s.c_str());
+        std::exit(1);
+    }
+    return v;
+}
+
+static fs::path
+golden_path(const fs::path& manifest, const c8::ConformanceCase& test)
+{
+    return manifest.parent_path() / "golden" /
+           (test.name + "." + QUIRK_NAMES[test.mode] + ".bin");
+}
+
+static std::vector<c8::ConformanceCase>
+load_manifest(const fs::path& manifest, bool need_goldens)
+{
+    std::ifstream in{ manifest };
+    if (in.is_open() == false) {
+        fprintf(stderr, "could not open manifest '%s'\n", manifest.c_str());
+        std::exit(1);
+    }
+
+    std::vector<c8::ConformanceCase> tests;
+    std::string text;
+    for (int line = 1; std::getline(in, text); line++) {
+        text = text.substr(0, text.find('#'));
+        std::istringstream fields{ text };
+        std::string name, rom, quirks, frames;
+        if (!(fields >> name)) continue;
+        if (!(fields >> rom >> quirks >> frames)) {
+            fprintf(stderr,
+                    "%s:%d: expected 'name rom quirks frames'\n",
+                    manifest.c_str(),
+                    line);
+            std::exit(1);
+        }
+
+        c8::ConformanceCase test{};
+        test.name = name;
+        test.frames = parse_number(frames, manifest, line);
+        test.cycles_per_frame = 10;
+
+        c8::system loader{ 0u };
+        loader.LoadRom(manifest.parent_path() / rom);
+        test.image = loader.RefMemory();
+
+        for (std::string option; fields >> option;) {
+            size_t eq = option.find('=');
+            std::string key = option.substr(0, eq);
+            std::string value = eq == std::string::npos
+                                  ? std::string{}
+                                  : option.substr(eq + 1);
+            size_t colon = value.find(':');
+
+            if (key == "cycles") {
+                test.cycles_per_frame = parse_number(value, manifest, line);
+            } else if (key == "poke" && colon != std::string::npos) {
+                test.pokes.push_back(
+                  { parse_number(value.substr(0, colon), manifest, line),
+                    parse_number(value.substr(colon + 1), manifest, line) });
+            } else if (key == "key" && colon != std::string::npos &&
+                       value.find(':', colon + 1) != std::string::npos) {
+                size_t second = value.find(':', colon + 1);
+                std::string state = value.substr(second + 1);
+                test.input.push_back(
+                  { static_cast<unsigned>(
+                      parse_number(value.substr(0, colon), manifest, line)),
+                    static_cast<c8::KeyCode>(
+                      parse_number(value.substr(colon + 1, second - colon - 1),
+                                   manifest,
+                                   line) &
+                      0xF),
+                    state == "down" ? c8::Key::DOWN : c8::Key::UP });
+            } else {
+                fprintf(stderr,
+                        "%s:%d: unknown option '%s'\n",
+                        manifest.c_str(),
+                        line,
+                        option.c_str());
+                std::exit(1);
+            }
+        }
+
+        if (quirks != "all" && quirks != QUIRK_NAMES[c8::Quirks::MATT] &&
+            quirks != QUIRK_NAMES[c8::Quirks::COWGOD]) {
+            fprintf(stderr,
+                    "%s:%d: unknown quirks '%s'\n",
+                    manifest.c_str(),
+                    line,
+                    quirks.c_str());
+            std::exit(1);
+        }
+        for (c8::Quirks mode : c8::QUIRK_PROFILES) {
+            if (quirks != "all" && quirks != QUIRK_NAMES[mode]) continue;
+            test.mode = mode;
+            tests.push_back(test);
+        }
+    }
+
+    for (c8::ConformanceCase& test : tests) {
+        std::ifstream golden{ golden_path(manifest, test), std::ios::binary };
+        golden.read(reinterpret_cast<char*>(test.golden.data()),
+                    test.golden.size());
+        if (golden.gcount() != static_cast<long>(test.golden.size()) &&
+            need_goldens) {
+            fprintf(stderr,
+                    "%s: missing or short, run with --update to create it\n",
+                    golden_path(manifest, test).c_str());
+            std::exit(1);
+        }
+    }
+    return tests;
+}
+
+static int
+pixels_off(const c8::PackedFrame& a, const c8::PackedFrame& b)
+{
+    int count = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        count += std::popcount(static_cast<uint8_t>(a[i] ^ b[i]));
+    return count;
+}
+
+int
+main(int argc, char** argv)
+{
+    bool update = false;
+    unsigned threads = 0;
+    fs::path aot_cache = fs::temp_directory_path() / "chip8-aot";
+    const char* manifest = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--update") == 0)
+            update = true;
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--aot-cache") == 0 && i + 1 < argc)
+            aot_cache = argv[++i];
+        else if (manifest == nullptr && argv[i][0] != '-')
+            manifest = argv[i];
+        else
+            usage(argv[0]);
+    }
+    if (manifest == nullptr) usage(argv[0]);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<c8::ConformanceCase> tests = load_manifest(manifest, !update);
+    c8::WorkerPool workers{ threads };
+    c8::AotCache plugins{ aot_cache,
+                          CHIP8_AOT_COMPILER,
+                          c8::AotIncludeDir(CHIP8_AOT_INCLUDE_DIR) };
+    std::vector<c8::ConformanceResult> results =
+      c8::RunConformance(tests, workers, plugins);
+
+    const size_t reference_slot =
+      std::find(c8::ENGINES.begin(),
+                c8::ENGINES.end(),
+                c8::Engine::REFERENCE_IMPL) -
+      c8::ENGINES.begin();
+    int failed = 0;
+    for (const c8::ConformanceResult& result : results) {
+        const c8::ConformanceCase& test = tests[result.test];
+        const c8::PackedFrame& reference =
+          results[result.test * c8::ENGINES.size() + reference_slot].frame;
+
+        if (result.error.empty() == false) {
+            printf("FAIL %s [%s] %s: %s\n",
+                   test.name.c_str(),
+                   QUIRK_NAMES[test.mode],
+                   ENGINE_NAMES[result.engine],
+                   result.error.c_str());
+            failed++;
+            continue;
+        }
+
+        if (update) {
+            if (result.engine == c8::Engine::REFERENCE_IMPL) {
+                fs::path path = golden_path(manifest, test);
+                fs::create_directories(path.parent_path());
+                std::ofstream out{ path, std::ios::binary };
+                out.write(reinterpret_cast<const char*>(result.frame.data()),
+                          result.frame.size());
+            } else if (result.frame != reference) {
+                printf("FAIL %s [%s] %s: %d pixels off the reference\n",
+                       test.name.c_str(),
+                       QUIRK_NAMES[test.mode],
+                       ENGINE_NAMES[result.engine],
+                       pixels_off(result.frame, reference));
+                failed++;
+            }
+            continue;
+        }
+
+        if (result.passed == false) {
+            printf("FAIL %s [%s] %s: %d pixels off the golden image\n",
+                   test.name.c_str(),
+                   QUIRK_NAMES[test.mode],
+                   ENGINE_NAMES[result.engine],
+                   pixels_off(result.frame, test.golden));
+            failed++;
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    printf("%zu cases on %zu engines, %d failed, %.1f ms on %u threads\n",
+           tests.size(),
+           c8::ENGINES.size(),
+           failed,
+           std::chrono::duration<double, std::milli>(end - start).count(),
+           workers.Size());
+    return failed != 0;
+}
@@ -0,0 +1,669 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "libchip8++.hpp"
+#include "libchip8++_aot.hpp"
+#include "libchip8++_aotcache.hpp"
+#include "libchip8++_farm.hpp"
+#include "libchip8++_memo.hpp"
+#include "libchip8++_reference.hpp"
+#include "libchip8++_scheduler.hpp"
+#include "libchip8++_workers.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+#include <csignal>
+
+/* Checks Instructions::execute() against Reference::execute() on random
+ * states under every quirk profile, see DiffChecker. With --aot, also runs
+ * random ROMs through AOT plugins and the interpreter side by side, with
+ * --scheduler through a Scheduler and frame(), with --memo through a
+ * SubroutineMemo and cycle(), and with --farm jobs through a Farm whose
+ * workers keep getting killed. */
+
+namespace c8 = Chip8_core;
+
+#ifndef CHIP8_AOT_COMPILER
+#define CHIP8_AOT_COMPILER "c++"
+#endif
+#ifndef CHIP8_AOT_INCLUDE_DIR
+#define CHIP8_AOT_INCLUDE_DIR "src/core"
+#endif
+
+static const char* const QUIRK_NAMES[] = { "matt", "cowgod" };
+
+static void
+usage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--cases N] [--seed N] [--threads N] [--aot ROMS]\n"
+            "          [--aot-cache DIR] [--scheduler ROMS] [--memo ROMS]\n"
+            "          [--farm JOBS]\n"
+            "runs N random cases per quirk profile, 10 million by default,\n"
+            "compares ROMS random ROMs per quirk profile on AOT plugins, on\n"
+            "a Scheduler and on a SubroutineMemo against the interpreter,\n"
+            "and runs JOBS jobs on a Farm while killing its workers\n",
+            argv0);
+    std::exit(1);
+}
+
+/* splitmix64 */
+static uint64_t
+next_random(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* random bytes with most instructions replaced by the arithmetic, skips,
+ * jumps back into the ROM, stores and keypad reads that control flow
+ * recovery and the translated blocks have to get right */
+static c8::BootImage
+random_rom(uint64_t& rng)
+{
+    static constexpr uint8_t FX[] = { 0x07, 0x15, 0x18, 0x1E, 0x29,
+                                      0x33, 0x55, 0x65, 0x0A };
+    std::array<uint8_t, 256> rom;
+    for (size_t i = 0; i < rom.size(); i += 2) {
+        uint64_t r = next_random(rng);
+        rom[i] = r;
+        rom[i + 1] = r >> 8;
+        switch ((r >> 16) % 12) {
+            case 0:
+            case 1:
+            case 2:
+            case 3:
+                rom[i] = 0x60 + (r >> 24) % 0x30; /* 6XNN, 7XNN, 8XYN */
+                break;
+            case 4:
+                rom[i] = 0x12 + (r >> 24) % 2 * 0x10; /* 1NNN, 2NNN */
+                rom[i + 1] &= 0xFE;
+                break;
+            case 5:
+                rom[i] = 0x30 + (r >> 24) % 0x30; /* 3XNN, 4XNN, 5XY0 */
+                break;
+            case 6:
+                rom[i] = 0xF0 | (r >> 24) % 16;
+                rom[i + 1] = FX[(r >> 32) % sizeof FX];
+                break;
+            case 7:
+                rom[i] = 0xA3; /* I in the scratch page */
+                break;
+            case 8:
+                rom[i] = 0xE0 | (r >> 24) % 16;
+                rom[i + 1] = (r >> 32) % 2 ? 0x9E : 0xA1;
+                break;
+            case 9:
+                rom[i] = 0x00; /* 00EE */
+                rom[i + 1] = 0xEE;
+                break;
+            default:
+                break;
+        }
+    }
+    return c8::MakeBootImage(rom);
+}
+
+struct AotReport {
+    uint64_t cycles;
+    uint64_t mismatches;
+};
+
+/* runs each ROM through its plugin in random sized steps and the
+ * interpreter for as many cycles, comparing the whole state after each
+ * step while the keys change now and then */
+static AotReport
+check_aot(c8::Quirks mode,
+          unsigned roms,
+          uint64_t seed,
+          c8::AotCache& plugins,
+          c8::WorkerPool& workers)
+{
+    std::atomic<uint64_t> cycles{ 0 }, mismatches{ 0 };
+    std::mutex print_lock;
+    workers.ParallelFor(roms, [&](size_t idx, unsigned) {
+        uint64_t rng = seed ^ (idx + 1) * 0xD1B54A32D192ED03ULL ^ mode;
+        c8::BootImage image = random_rom(rng);
+        std::string error;
+        auto aot = plugins.Get(image, mode, error);
+        if (aot == nullptr) {
+            std::lock_guard guard{ print_lock };
+            printf("AOT ROM %zu [%s]: %s\n", idx, QUIRK_NAMES[mode],
+                   error.c_str());
+            mismatches++;
+            return;
+        }
+
+        c8::system compiled{ image, 7 }, interpreted{ image, 7 };
+        uint64_t ran = 0;
+        for (int step = 0; step < 4000; step++) {
+            /* stack overflow is left undefined, start over instead */
+            int8_t sp = compiled.GetStackTop();
+            if (sp < -1 || sp >= c8::Constants::STACKSIZE - 1) {
+                compiled = interpreted = c8::system{ image, 7 };
+                continue;
+            }
+
+            uint64_t r = next_random(rng);
+            unsigned n = aot->Step(compiled, 1 + r % 64);
+            for (unsigned i = 0; i < n; i++)
+                c8::cycle(interpreted, mode);
+            ran += n;
+            if ((r >> 8) % 8 == 0)
+                for (int k = 0; k < 16; k++) {
+                    uint8_t state = (r >> (16 + k)) & 1;
+                    compiled.SetKey(static_cast<c8::KeyCode>(k), state);
+                    interpreted.SetKey(static_cast<c8::KeyCode>(k), state);
+                }
+
+            if (compiled.Hash() == interpreted.Hash() &&
+                compiled.InputPolls() == interpreted.InputPolls())
+                continue;
+            std::lock_guard guard{ print_lock };
+            printf("AOT MISMATCH ROM %zu [%s] after %llu cycles, "
+                   "PC %03X vs %03X, rerun with --seed %llu\n",
+                   idx,
+                   QUIRK_NAMES[mode],
+                   static_cast<unsigned long long>(ran),
+                   compiled.GetPC(),
+                   interpreted.GetPC(),
+                   static_cast<unsigned long long>(seed));
+            mismatches++;
+            break;
+        }
+        cycles += ran;
+    });
+    return { cycles, mismatches };
+}
+
+struct SchedulerReport {
+    uint64_t parked;
+    uint64_t mismatches;
+};
+
+/* runs each ROM on an interactive and a batch instance of a Scheduler and
+ * on copies driven by frame(), with keys going up and down now and then,
+ * and compares the whole state after every frame an instance does not end
+ * parked in. Parking is only sound if nothing but the timers tell it apart
+ * while it lasts. */
+static SchedulerReport
+check_scheduler(c8::Quirks mode,
+                unsigned roms,
+                uint64_t seed,
+                c8::WorkerPool& workers)
+{
+    static constexpr unsigned CYCLES_PER_FRAME = 10;
+    std::atomic<uint64_t> parked{ 0 }, mismatches{ 0 };
+    std::mutex print_lock;
+    workers.ParallelFor(roms, [&](size_t idx, unsigned) {
+        uint64_t rng = seed ^ (idx + 1) * 0x9FB21C651E98DF25ULL ^ mode;
+        c8::BootImage image = random_rom(rng);
+
+        c8::system scheduled[2] = { { image, 7 }, { image, 7 } };
+        c8::system framed[2] = { { image, 7 }, { image, 7 } };
+        c8::Scheduler scheduler{ mode, CYCLES_PER_FRAME };
+        scheduler.Add(scheduled[0], c8::Priority::INTERACTIVE);
+        scheduler.Add(scheduled[1], c8::Priority::BATCH);
+
+        for (unsigned f = 0; f < 3000; f++) {
+            for (size_t id = 0; id < 2; id++) {
+                uint64_t r = next_random(rng);
+                /* random ROMs seldom set the timers, parking with them
+                 * running is what needs the catch-up */
+                if (r % 8 == 0 && scheduler.Parked(id) == false) {
+                    for (c8::system* c : { &scheduled[id], &framed[id] }) {
+                        c->SetDT(r >> 16 & 0x3F);
+                        c->SetST(r >> 24 & 0x3F);
+                    }
+                }
+                if (r >> 3 & 1) continue;
+                auto k = static_cast<c8::KeyCode>(r >> 8 & 0xF);
+                c8::Key state = r >> 12 & 1 ? c8::Key::DOWN : c8::Key::UP;
+                scheduler.Press(id, k, state);
+                framed[id].SetKey(k, state);
+            }
+            scheduler.Frame();
+            for (size_t id = 0; id < 2; id++)
+                c8::frame(framed[id], mode, CYCLES_PER_FRAME);
+
+            for (size_t id = 0; id < 2; id++) {
+                if (scheduler.Parked(id)) {
+                    parked++;
+                    continue;
+                }
+                if (scheduled[id].Hash() != framed[id].Hash()) {
+                    std::lock_guard guard{ print_lock };
+                    printf("SCHEDULER MISMATCH ROM %zu [%s] %s instance "
+                           "after frame %u, PC %03X vs %03X, rerun with "
+                           "--seed %llu\n",
+                           idx,
+                           QUIRK_NAMES[mode],
+                           id ? "batch" : "interactive",
+                           f,
+                           scheduled[id].GetPC(),
+                           framed[id].GetPC(),
+                           static_cast<unsigned long long>(seed));
+                    mismatches++;
+                    return;
+                }
+                /* stack overflow is left undefined, start over instead */
+                int8_t sp = framed[id].GetStackTop();
+                if (sp < -1 || sp >= c8::Constants::STACKSIZE - 1)
+                    scheduled[id] = framed[id] = c8::system{ image, 7 };
+            }
+        }
+    });
+    return { parked, mismatches };
+}
+
+/* the state letter of a process from /proc, 0 if it cannot be read */
+static char
+process_state(pid_t pid)
+{
+    char path[32];
+    snprintf(path, sizeof path, "/proc/%d/stat", static_cast<int>(pid));
+    FILE* stat = fopen(path, "r");
+    if (stat == nullptr) return 0;
+    /* pid (comm) state, and comm is a fixed name here */
+    char state = 0;
+    if (fscanf(stat, "%*d %*s %c", &state) != 1) state = 0;
+    fclose(stat);
+    return state;
+}
+
+/* a main loop loading a few small values into V0 to V3 and calling four
+ * subroutines, so calls keep meeting the inputs of earlier ones. The
+ * subroutines do arithmetic, skips, stores, loads and draws, call the ones
+ * after them and now and then return early or run something impure */
+static c8::BootImage
+memo_rom(uint64_t& rng)
+{
+    static constexpr uint8_t FX[] = { 0x15, 0x18, 0x1E, 0x29,
+                                      0x33, 0x55, 0x65 };
+    static constexpr uint16_t SKIP[] = { 0x3001, 0x4001, 0x5000, 0x9000 };
+    static constexpr uint16_t SUBS[] = { 0x220, 0x250, 0x280, 0x2B0 };
+    std::array<uint8_t, 256> rom;
+    auto put = [&](uint16_t addr, uint16_t opcode) {
+        rom[addr - 0x200] = opcode >> 8;
+        rom[addr - 0x200 + 1] = opcode;
+    };
+    for (uint16_t addr = 0x200; addr < 0x300; addr += 2)
+        put(addr, 0x00EE);
+
+    for (uint16_t addr = 0x200; addr < 0x21E; addr += 2) {
+        uint64_t r = next_random(rng);
+        if (r % 3)
+            put(addr, 0x6000 | (r >> 8) % 4 << 8 | (r >> 16) % 4);
+        else
+            put(addr, 0x2000 | SUBS[(r >> 8) % 4]);
+    }
+    put(0x21E, 0x1200);
+
+    for (unsigned sub = 0; sub < 4; sub++) {
+        for (uint16_t addr = SUBS[sub]; addr < SUBS[sub] + 46; addr += 2) {
+            uint64_t r = next_random(rng);
+            uint16_t x = (r >> 8) % 8 << 8, y = (r >> 12) % 8 << 4;
+            switch ((r >> 16) % 16) {
+                case 0:
+                case 1:
+                case 2:
+                    put(addr, 0x8000 | x | y | (r >> 24) % 8);
+                    break;
+                case 3:
+                    put(addr, 0x800E | x | y);
+                    break;
+                case 4:
+                case 5:
+                    put(addr, 0x7000 | x | (r >> 24 & 0xFF));
+                    break;
+                case 6:
+                    put(addr, SKIP[(r >> 24) % 4] | x | y);
+                    break;
+                case 7:
+                    put(addr, 0xA300 | (r >> 24 & 0xFF));
+                    break;
+                case 8:
+                case 9:
+                    put(addr, 0xF000 | x | FX[(r >> 24) % sizeof FX]);
+                    break;
+                case 10:
+                    put(addr, 0xD000 | x | y | (r >> 24) % 16);
+                    break;
+                case 11:
+                    if (sub == 3) break;
+                    put(addr, 0x2000 | SUBS[sub + 1 + (r >> 24) % (3 - sub)]);
+                    break;
+                case 12:
+                    if ((r >> 24) % 4 == 0) put(addr, 0xC000 | x | 0xFF);
+                    break;
+                default:
+                    put(addr, 0x6000 | x | (r >> 24) % 4);
+                    break;
+            }
+        }
+    }
+    return c8::MakeBootImage(rom);
+}
+
+struct MemoReport {
+    uint64_t hits;
+    uint64_t mismatches;
+};
+
+/* runs each ROM through SubroutineMemo::Step() and cycle() for as many
+ * cycles, comparing the whole state after every step, so after every call
+ * answered from the memo or recorded and every return */
+static MemoReport
+check_memo(c8::Quirks mode,
+           unsigned roms,
+           uint64_t seed,
+           c8::WorkerPool& workers)
+{
+    std::atomic<uint64_t> hits{ 0 }, mismatches{ 0 };
+    std::mutex print_lock;
+    workers.ParallelFor(roms, [&](size_t idx, unsigned) {
+        uint64_t rng = seed ^ (idx + 1) * 0xC2B2AE3D27D4EB4FULL ^ mode;
+        c8::BootImage image = memo_rom(rng);
+
+        c8::SubroutineMemo memo{ mode };
+        c8::system memoized{ image, 7 }, plain{ image, 7 };
+        uint64_t ran = 0;
+        for (int step = 0; step < 20000; step++) {
+            /* stack overflow is left undefined, start over instead */
+            int8_t sp = plain.GetStackTop();
+            if (sp < -1 || sp >= c8::Constants::STACKSIZE - 1) {
+                memoized = plain = c8::system{ image, 7 };
+                continue;
+            }
+
+            unsigned n = memo.Step(memoized);
+            for (unsigned i = 0; i < n; i++)
+                c8::cycle(plain, mode);
+            ran += n;
+            /* one memo serves instances of any colors */
+            uint64_t r = next_random(rng);
+            if (r % 64 == 0) {
+                for (int k = 0; k < 16; k++) {
+                    uint8_t state = (r >> (16 + k)) & 1;
+                    memoized.SetKey(static_cast<c8::KeyCode>(k), state);
+                    plain.SetKey(static_cast<c8::KeyCode>(k), state);
+                }
+                uint32_t fg = r >> 32 & 1 ? 0xffffffff : 0x00ff00ff;
+                uint32_t bg = r >> 33 & 1 ? 0x0 : 0x20202020;
+                memoized.display_fg = plain.display_fg = fg;
+                memoized.display_bg = plain.display_bg = bg;
+            }
+
+            if (memoized.Hash() == plain.Hash() &&
+                memoized.InputPolls() == plain.InputPolls())
+                continue;
+            std::lock_guard guard{ print_lock };
+            printf("MEMO MISMATCH ROM %zu [%s] after %llu cycles, "
+                   "PC %03X vs %03X, rerun with --seed %llu\n",
+                   idx,
+                   QUIRK_NAMES[mode],
+                   static_cast<unsigned long long>(ran),
+                   memoized.GetPC(),
+                   plain.GetPC(),
+                   static_cast<unsigned long long>(seed));
+            mismatches++;
+            break;
+        }
+        hits += memo.GetStats().hits;
+    });
+    return { hits, mismatches };
+}
+
+struct FarmReport {
+    uint64_t kills;
+    uint64_t faults;
+    uint64_t mismatches;
+};
+
+/* runs jobs on a Farm of 4 workers, SIGKILLing one of them every few
+ * hundred results. Every job has to be reported exactly once, either as a
+ * FAULT from the kill or as DONE with the hash and reward a local run
+ * gets. The ROM draws and stores random numbers in a loop, it has no calls
+ * for a stack overflow to make the outcome undefined. */
+static FarmReport
+check_farm(unsigned jobs, uint64_t seed)
+{
+    static constexpr uint8_t ROM[] = {
+        0xC0, 0xFF, /* 200: V0 = rand */
+        0xC1, 0x1F, /* 202: V1 = rand & 1F */
+        0x80, 0x14, /* 204: V0 += V1 */
+        0xF0, 0x29, /* 206: I = font(V0) */
+        0xD0, 0x15, /* 208: draw at V0, V1 */
+        0x72, 0x01, /* 20A: V2 += 1 */
+        0xA3, 0x00, /* 20C: I = 300 */
+        0xF2, 0x55, /* 20E: store V0-V2 */
+        0x12, 0x00, /* 210: jump 200 */
+    };
+    static constexpr uint16_t REWARD_ADDR = 0x300;
+    static constexpr uint8_t REWARD_BYTES = 3;
+    const c8::BootImage image = c8::MakeBootImage(ROM);
+
+    uint64_t rng = seed ^ 0xF4A7C15D1B54A32DULL;
+    std::vector<c8::FarmJob> submitted(jobs);
+    for (uint64_t id = 0; id < jobs; id++) {
+        uint64_t r = next_random(rng);
+        submitted[id] = { id,
+                          0,
+                          r & 1 ? c8::Quirks::COWGOD : c8::Quirks::MATT,
+                          static_cast<uint32_t>(1 + (r >> 8) % 1024),
+                          10,
+                          static_cast<uint32_t>(r >> 32),
+                          REWARD_ADDR,
+                          REWARD_BYTES };
+    }
+
+    FarmReport report{};
+    std::vector<unsigned> seen(jobs);
+    std::vector<c8::FarmResult> results;
+    c8::Farm farm{ std::span{ &image, 1 }, 4, 64 };
+    auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::minutes{ 1 };
+    size_t next = 0, checked = 0;
+    while (checked < jobs && std::chrono::steady_clock::now() < deadline) {
+        while (next < jobs && farm.Submit(submitted[next]))
+            next++;
+        /* kill while jobs are queued, preferring a worker that is
+         * runnable and so likely in the middle of a job */
+        if (next - checked > 16 && next_random(rng) % 2 == 0) {
+            std::vector<pid_t> pids = farm.Pids();
+            pid_t victim = pids[next_random(rng) % pids.size()];
+            for (pid_t pid : pids)
+                if (process_state(pid) == 'R') victim = pid;
+            kill(victim, SIGKILL);
+            report.kills++;
+        }
+        farm.Wait(results);
+
+        for (; checked < results.size(); checked++) {
+            const c8::FarmResult& res = results[checked];
+            if (res.id >= jobs || seen[res.id]++) {
+                printf("FARM job %llu reported twice\n",
+                       static_cast<unsigned long long>(res.id));
+                report.mismatches++;
+                continue;
+            }
+            if (res.status == c8::FarmStatus::FAULT) {
+                report.faults++;
+                if (res.signal == SIGKILL) continue;
+                printf("FARM job %llu died of signal %d\n",
+                       static_cast<unsigned long long>(res.id),
+                       res.signal);
+                report.mismatches++;
+                continue;
+            }
+
+            const c8::FarmJob& job = submitted[res.id];
+            c8::system local{ image, 0 };
+            local.Seed(job.seed);
+            for (uint32_t f = 0; f < job.frames; f++)
+                c8::frame(local, job.mode, job.cycles_per_frame);
+            uint64_t reward = 0;
+            for (unsigned b = 0; b < job.reward_bytes; b++)
+                reward = reward << 8 | local.GetMemory(job.reward_addr + b);
+            if (res.hash == local.Hash() && res.reward == reward) continue;
+            printf("FARM MISMATCH job %llu, rerun with --seed %llu\n",
+                   static_cast<unsigned long long>(res.id),
+                   static_cast<unsigned long long>(seed));
+            report.mismatches++;
+        }
+    }
+
+    for (uint64_t id = 0; id < jobs; id++) {
+        if (seen[id]) continue;
+        printf("FARM job %llu never reported\n",
+               static_cast<unsigned long long>(id));
+        report.mismatches++;
+    }
+    return report;
+}
+
+int
+main(int argc, char** argv)
+{
+    uint64_t cases = 10'000'000;
+    uint64_t seed = 0;
+    unsigned aot_roms = 0;
+    unsigned scheduler_roms = 0;
+    unsigned memo_roms = 0;
+    unsigned farm_jobs = 0;
+    std::filesystem::path aot_cache =
+      std::filesystem::temp_directory_path() / "chip8-aot";
+    unsigned threads = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+        if (std::strcmp(argv[i], "--cases") == 0)
+            cases = std::strtoull(argv[++i], nullptr, 0);
+        else if (std::strcmp(argv[i], "--seed") == 0)
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        else if (std::strcmp(argv[i], "--threads") == 0)
+            threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--aot") == 0)
+            aot_roms = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--aot-cache") == 0)
+            aot_cache = argv[++i];
+        else if (std::strcmp(argv[i], "--scheduler") == 0)
+            scheduler_roms = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--memo") == 0)
+            memo_roms = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--farm") == 0)
+            farm_jobs = std::atoi(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+
+    c8::WorkerPool workers{ threads };
+    c8::DiffChecker checker{ workers, seed };
+    const char* const* names = QUIRK_NAMES;
+
+    uint64_t mismatches = 0;
+    for (c8::Quirks mode : { c8::Quirks::MATT, c8::Quirks::COWGOD }) {
+        auto start = std::chrono::steady_clock::now();
+        c8::DiffReport report = checker.Run(mode, cases);
+        auto end = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(end - start).count();
+
+        for (const c8::Mismatch& m : report.samples)
+            printf("MISMATCH %04X [%s]\n  before: %s\n  after:  %s\n",
+                   m.opcode,
+                   names[m.mode],
+                   m.before.c_str(),
+                   m.diff.c_str());
+        printf("%s: %llu cases, %llu mismatches, %.1f M cases/s on %u "
+               "threads\n",
+               names[mode],
+               static_cast<unsigned long long>(report.cases),
+               static_cast<unsigned long long>(report.mismatches),
+               report.cases / s / 1e6,
+               workers.Size());
+        mismatches += report.mismatches;
+    }
+
+    for (c8::Quirks mode : { c8::Quirks::MATT, c8::Quirks::COWGOD }) {
+        if (scheduler_roms == 0) break;
+        auto start = std::chrono::steady_clock::now();
+        SchedulerReport report =
+          check_scheduler(mode, scheduler_roms, seed, workers);
+        auto end = std::chrono::steady_clock::now();
+        printf("%s: %u scheduler ROMs, %llu frames parked, %llu mismatches, "
+               "%.1f s\n",
+               names[mode],
+               scheduler_roms,
+               static_cast<unsigned long long>(report.parked),
+               static_cast<unsigned long long>(report.mismatches),
+               std::chrono::duration<double>(end - start).count());
+        mismatches += report.mismatches;
+    }
+
+    for (c8::Quirks mode : { c8::Quirks::MATT, c8::Quirks::COWGOD }) {
+        if (memo_roms == 0) break;
+        auto start = std::chrono::steady_clock::now();
+        MemoReport report = check_memo(mode, memo_roms, seed, workers);
+        auto end = std::chrono::steady_clock::now();
+        printf("%s: %u memo ROMs, %llu calls answered from the memo, %llu "
+               "mismatches, %.1f s\n",
+               names[mode],
+               memo_roms,
+               static_cast<unsigned long long>(report.hits),
+               static_cast<unsigned long long>(report.mismatches),
+               std::chrono::duration<double>(end - start).count());
+        mismatches += report.mismatches;
+    }
+
+    if (farm_jobs) {
+        auto start = std::chrono::steady_clock::now();
+        FarmReport report = check_farm(farm_jobs, seed);
+        auto end = std::chrono::steady_clock::now();
+        printf("farm: %u jobs, %llu workers killed, %llu faults, %llu "
+               "mismatches, %.1f s\n",
+               farm_jobs,
+               static_cast<unsigned long long>(report.kills),
+               static_cast<unsigned long long>(report.faults),
+               static_cast<unsigned long long>(report.mismatches),
+               std::chrono::duration<double>(end - start).count());
+        mismatches += report.mismatches;
+    }
+
+    if (aot_roms == 0) return mismatches != 0;
+    c8::AotCache plugins{ aot_cache,
+                          CHIP8_AOT_COMPILER,
+                          c8::AotIncludeDir(CHIP8_AOT_INCLUDE_DIR) };
+    for (c8::Quirks mode : { c8::Quirks::MATT, c8::Quirks::COWGOD }) {
+        auto start = std::chrono::steady_clock::now();
+        AotReport report = check_aot(mode, aot_roms, seed, plugins, workers);
+        auto end = std::chrono::steady_clock::now();
+        printf("%s: %u AOT ROMs, %llu cycles, %llu mismatches, %.1f s\n",
+               names[mode],
+               aot_roms,
+               static_cast<unsigned long long>(report.cycles),
+               static_cast<unsigned long long>(report.mismatches),
+               std::chrono::duration<double>(end - start).count());
+        mismatches += report.mismatches;
+    }
+    return mismatches != 0;
+}
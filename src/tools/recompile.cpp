@@ -0,0 +1,123 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "libchip8++.hpp"
+#include "libchip8++_aot.hpp"
+#include "libchip8++_aotcache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+/* Translates a ROM into C++ with AotTranslator and optionally builds the
+ * plugin AotEngine loads. */
+
+namespace c8 = Chip8_core;
+
+#ifndef CHIP8_AOT_COMPILER
+#define CHIP8_AOT_COMPILER "c++"
+#endif
+#ifndef CHIP8_AOT_INCLUDE_DIR
+#define CHIP8_AOT_INCLUDE_DIR "src/core"
+#endif
+
+static void
+usage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s ROM [--quirks matt|cowgod] -o OUT.cpp [--so OUT.so]\n"
+            "       %s ROM [--quirks matt|cowgod] --cache DIR\n"
+            "translates ROM to C++ and, with --so, compiles it into a "
+            "plugin\n"
+            "with --cache, makes sure DIR holds a plugin for ROM that "
+            "AotCache can load\n",
+            argv0,
+            argv0);
+    std::exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* rom = nullptr;
+    const char* source = nullptr;
+    const char* plugin = nullptr;
+    const char* cache = nullptr;
+    c8::Quirks mode = c8::Quirks::MATT;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            if (rom) usage(argv[0]);
+            rom = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) usage(argv[0]);
+        if (std::strcmp(argv[i], "-o") == 0)
+            source = argv[++i];
+        else if (std::strcmp(argv[i], "--so") == 0)
+            plugin = argv[++i];
+        else if (std::strcmp(argv[i], "--cache") == 0)
+            cache = argv[++i];
+        else if (std::strcmp(argv[i], "--quirks") == 0) {
+            std::string name = argv[++i];
+            if (name == "matt")
+                mode = c8::Quirks::MATT;
+            else if (name == "cowgod")
+                mode = c8::Quirks::COWGOD;
+            else
+                usage(argv[0]);
+        } else
+            usage(argv[0]);
+    }
+    if (rom == nullptr || (source == nullptr && cache == nullptr))
+        usage(argv[0]);
+
+    c8::system loader{ 0u };
+    loader.LoadRom(rom);
+
+    if (cache) {
+        c8::AotCache aot{ cache,
+                          CHIP8_AOT_COMPILER,
+                          c8::AotIncludeDir(CHIP8_AOT_INCLUDE_DIR) };
+        std::string error;
+        if (aot.Get(loader.RefMemory(), mode, error) == nullptr) {
+            fprintf(stderr, "%s: %s\n", cache, error.c_str());
+            std::exit(1);
+        }
+        printf("%s: %s\n", cache, aot.Builds() ? "built" : "already cached");
+        if (source == nullptr) return 0;
+    }
+    c8::AotTranslator translator{ loader.RefMemory(), mode };
+
+    std::ofstream out{ source };
+    out << translator.Source();
+    out.close();
+    if (out.fail()) {
+        fprintf(stderr, "could not write '%s'\n", source);
+        std::exit(1);
+    }
+    printf("%s: %zu blocks\n", source, translator.Blocks());
+
+    if (plugin == nullptr) return 0;
+    if (c8::AotCompile(source,
+                       plugin,
+                       CHIP8_AOT_COMPILER,
+                       c8::AotIncludeDir(CHIP8_AOT_INCLUDE_DIR)) == false) {
+        fprintf(stderr, "compiling '%s' failed\n", source);
+        std::exit(1);
+    }
+}
@@ -0,0 +1,819 @@
+/*
+     This file is part of based-chip8-pp.
+
+    based-chip8-pp is free software: you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option) any
+   later version.
+
+    based-chip8-pp is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+   details.
+
+    You should have received a copy of the GNU General Public License along with
+   based-chip8-pp. If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "libchip8++.hpp"
+#include "libchip8++_bootcache.hpp"
+#include "libchip8++_checkpoint.hpp"
+#include "libchip8++_numa.hpp"
+#include "libchip8++_pool.hpp"
+#include "libchip8++_ramsearch.hpp"
+#include "libchip8++_reward.hpp"
+#include "libchip8++_ttable.hpp"
+#ifdef CHIP8_HAVE_ZLIB
+#include "libchip8++_snapshot.hpp"
+#include "libchip8++_trajectory.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Checks of the core library that need more than the static_asserts in
+ * libchip8_impl.cpp: files, threads and machine state compared byte for
+ * byte. Runs the checks named on the command line, every one if none is,
+ * ctest runs each on its own. */
+
+namespace c8 = Chip8_core;
+
+static bool
+fail(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    printf("FAIL ");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    return false;
+}
+
+/* splitmix64 */
+static uint64_t
+next_random(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* the whole object, bookkeeping and cached hash included */
+static bool
+same_bytes(const c8::system& got, const c8::system& want, const char* what)
+{
+    auto* a = reinterpret_cast<const uint8_t*>(&got);
+    auto* b = reinterpret_cast<const uint8_t*>(&want);
+    for (size_t i = 0; i < sizeof(c8::system); i++)
+        if (a[i] != b[i])
+            return fail("%s: byte %zu of the system differs", what, i);
+    return true;
+}
+
+/* calls a subroutine that draws a digit, counts V0 up by 3 and stores it
+ * at 0x380, forever */
+static constexpr std::array<uint8_t, 20> draw_loop_rom{
+    0x61, 0x05, /* 200: V1 = 5 */
+    0x22, 0x08, /* 202: call 208 */
+    0x12, 0x02, /* 204: jump 202 */
+    0x00, 0x00, /* 206 */
+    0xF0, 0x29, /* 208: I = font(V0) */
+    0xD0, 0x15, /* 20A: draw at V0, V1 */
+    0x70, 0x03, /* 20C: V0 += 3 */
+    0xA3, 0x80, /* 20E: I = 380 */
+    0xF0, 0x55, /* 210: store V0 */
+    0x00, 0xEE, /* 212: return */
+};
+static constexpr c8::BootImage draw_loop_image =
+  c8::MakeBootImage(draw_loop_rom);
+
+/* dirties memory, display and stack through the ROM and directly, the
+ * direct writes stay clear of the program so it keeps running as written */
+static void
+dirty_run(c8::system& chip8, uint64_t& rng)
+{
+    unsigned cycles = 1 + next_random(rng) % 2000;
+    for (unsigned i = 0; i < cycles; i++)
+        c8::cycle(chip8, c8::Quirks::COWGOD);
+    constexpr unsigned PIXELS = c8::Constants::DISPW * c8::Constants::DISPH;
+    constexpr unsigned DATA = 0x300;
+    for (int i = 0; i < 8; i++) {
+        uint64_t r = next_random(rng);
+        chip8.SetMemory(DATA + r % (c8::Constants::MEMSIZE - DATA), r >> 16);
+        chip8.SetPixel((r >> 24) % PIXELS, 0xffffffff);
+    }
+    chip8.SetKey(c8::KeyCode::A, c8::Key::DOWN);
+    chip8.SetDT(next_random(rng) % 256);
+    if (next_random(rng) % 2) chip8.Hash();
+}
+
+/* a recycled instance is the same object a fresh copy of pristine is,
+ * whether pristine was run past power-on, hashed, or neither */
+static bool
+check_pool()
+{
+    uint64_t rng = 1;
+    for (int variant = 0; variant < 4; variant++) {
+        c8::system pristine{ draw_loop_image, 0 };
+        if (variant & 1) dirty_run(pristine, rng);
+        if (variant & 2) pristine.Hash();
+
+        c8::Pool pool{ pristine, 2 };
+        for (int round = 0; round < 200; round++) {
+            c8::system* chip8 = pool.Acquire();
+            dirty_run(*chip8, rng);
+            pool.Release(chip8);
+
+            chip8 = pool.Acquire();
+            c8::system fresh{ pristine };
+            chip8->Seed(round);
+            fresh.Seed(round);
+            if (same_bytes(*chip8, fresh, "recycled Pool instance") == false)
+                return fail("variant %d, round %d", variant, round);
+            pool.Release(chip8);
+        }
+    }
+
+    /* a later reset to the image restores what pristine wrote as well */
+    c8::system pristine{ draw_loop_image, 0 };
+    dirty_run(pristine, rng);
+    c8::system chip8{ pristine };
+    dirty_run(chip8, rng);
+    chip8.reset(pristine, pristine.RefMemory());
+    chip8.reset(draw_loop_image);
+    c8::system booted{ draw_loop_image, 0 };
+    chip8.Seed(0);
+    booted.Seed(0);
+    if (chip8.Hash() != booted.Hash())
+        return fail("reset(image) after reset(pristine, image) missed pages");
+    return true;
+}
+
+/* sets the delay timer, counts V1 to 100 storing it, draws, then reads the
+ * delay timer forever. The timer is still running when the warm-up ends */
+static constexpr std::array<uint8_t, 22> timer_rom{
+    0x60, 0xFF, /* 200: V0 = 255 */
+    0xF0, 0x15, /* 202: DT = V0 */
+    0xA3, 0x00, /* 204: I = 300 */
+    0x71, 0x01, /* 206: V1 += 1 */
+    0xF1, 0x55, /* 208: store V0, V1 */
+    0x31, 0x64, /* 20A: skip if V1 == 100 */
+    0x12, 0x06, /* 20C: jump 206 */
+    0xD0, 0x15, /* 20E: draw at V0, V1 */
+    0xF0, 0x07, /* 210: V0 = DT, impure */
+    0x12, 0x10, /* 212: jump 210 */
+    0x00, 0x00,
+};
+static constexpr c8::BootImage timer_image = c8::MakeBootImage(timer_rom);
+
+/* draw_loop_rom never gets to an impure instruction */
+static constexpr unsigned WARMUP_BUDGET = 5000;
+
+/* one start from the cache against the same start done by hand */
+static bool
+same_start(c8::BootCache& cache,
+           const c8::BootImage& image,
+           c8::Quirks mode,
+           uint32_t fg,
+           uint32_t bg)
+{
+    unsigned cpf = cache.CyclesPerFrame();
+    c8::system started = cache.Start(image, mode, 99, fg, bg);
+    c8::system fresh{ image, 99, fg, bg };
+    unsigned cycles = c8::BootCache::WarmUp(fresh, mode, WARMUP_BUDGET, cpf);
+    if (same_bytes(started, fresh, "BootCache start") == false)
+        return fail("%u cycles per frame, %u cycles", cpf, cycles);
+
+    const c8::BootState& warm =
+      cache.Get(image, c8::HashImage(image), mode, fg, bg);
+    unsigned phase = cpf ? cycles % cpf : 0;
+    if (warm.cycles != cycles || warm.phase != phase)
+        return fail("BootState says %u cycles, phase %u, want %u, %u",
+                    warm.cycles,
+                    warm.phase,
+                    cycles,
+                    phase);
+    if (cpf == 0) return true;
+
+    c8::BootCache::FinishFrame(started, mode, phase, cpf);
+    c8::system framed{ image, 99, fg, bg };
+    for (unsigned f = 0; f < (cycles + cpf - 1) / cpf; f++)
+        c8::frame(framed, mode, cpf);
+    if (same_bytes(started, framed, "BootCache start, frame finished") == false)
+        return fail("%u cycles per frame, %u cycles", cpf, cycles);
+    return true;
+}
+
+/* an instance started from the cache is the one a fresh instance becomes
+ * when warmed up by hand, and after FinishFrame() the one frame() makes */
+static bool
+check_bootcache()
+{
+    const c8::BootImage* images[] = { &timer_image, &draw_loop_image };
+    const uint32_t colors[][2] = { { 0xffffffff, 0x0 },
+                                   { 0x00ff00ff, 0x20202020 } };
+
+    for (unsigned cpf : { 0u, 7u, 10u }) {
+        c8::BootCache cache{ WARMUP_BUDGET, cpf };
+        /* twice, the second time from the cached states */
+        for (int pass = 0; pass < 2; pass++)
+            for (const c8::BootImage* image : images)
+                for (c8::Quirks mode : { c8::Quirks::MATT, c8::Quirks::COWGOD })
+                    for (const auto& [fg, bg] : colors)
+                        if (same_start(cache, *image, mode, fg, bg) == false)
+                            return false;
+        if (cache.Size() != 8)
+            return fail("%zu cached states, want 8", cache.Size());
+    }
+    return true;
+}
+
+/* a file of this process in the temporary directory */
+static std::filesystem::path
+scratch_file(const char* name)
+{
+    return std::filesystem::temp_directory_path() /
+           ("chip8-selftest-" + std::to_string(getpid()) + "-" + name);
+}
+
+/* every instance of a checkpoint against the states expected of it */
+static bool
+same_records(c8::Checkpoint& ckpt,
+             const std::vector<c8::system>& want,
+             const char* what)
+{
+    if (ckpt.Size() != want.size())
+        return fail("%s: %zu records, not %zu", what, ckpt.Size(), want.size());
+    for (size_t i = 0; i < want.size(); i++)
+        if (same_bytes(ckpt[i], want[i], what) == false)
+            return fail("record %zu", i);
+    return true;
+}
+
+/* runs a random third of the instances the same way on the checkpoint, if
+ * there is one, and on the states expected of it */
+static void
+run_some(c8::Checkpoint* ckpt, std::vector<c8::system>& want, uint64_t& rng)
+{
+    for (size_t i = 0; i < want.size(); i++) {
+        if (next_random(rng) % 3) continue;
+        uint64_t state = rng;
+        if (ckpt) dirty_run((*ckpt)[i], state);
+        dirty_run(want[i], rng);
+    }
+}
+
+/* commits survive reopening, records nobody ran between commits keep their
+ * state, and a process dying after Sync() but before its header is written
+ * leaves the previous epoch to be found */
+static bool
+check_checkpoint()
+{
+    std::filesystem::path file = scratch_file("checkpoint");
+    std::string error;
+    c8::system initial{ draw_loop_image, 0 };
+    std::vector<c8::system> want(130, initial);
+    uint64_t rng = 3;
+
+    auto ckpt = c8::Checkpoint::Create(file, want.size(), initial, error);
+    if (ckpt == nullptr) return fail("%s", error.c_str());
+    for (uint64_t epoch = 1; epoch <= 6; epoch++) {
+        run_some(ckpt.get(), want, rng);
+        if (ckpt->Commit() == false)
+            return fail("commit %llu failed",
+                        static_cast<unsigned long long>(epoch));
+        if (epoch % 2) continue;
+        ckpt = c8::Checkpoint::Open(file, error);
+        if (ckpt == nullptr) return fail("%s", error.c_str());
+        if (ckpt->Epoch() != epoch)
+            return fail("reopened at epoch %llu, want %llu",
+                        static_cast<unsigned long long>(ckpt->Epoch()),
+                        static_cast<unsigned long long>(epoch));
+        if (same_records(*ckpt, want, "reopened checkpoint") == false)
+            return false;
+    }
+
+    /* the second time the dying process commits once before it goes on */
+    for (uint64_t commits = 0; commits < 2; commits++) {
+        uint64_t epoch = ckpt->Epoch() + commits;
+        ckpt.reset();
+        pid_t child = fork();
+        if (child == 0) {
+            auto doomed = c8::Checkpoint::Open(file, error);
+            std::vector<c8::system> lost = want;
+            if (commits) run_some(doomed.get(), lost, rng);
+            if (commits && doomed->Commit() == false) _exit(1);
+            run_some(doomed.get(), lost, rng);
+            _exit(doomed->Sync() ? 0 : 1);
+        }
+        int status;
+        waitpid(child, &status, 0);
+        if (WIFEXITED(status) == false || WEXITSTATUS(status) != 0)
+            return fail("the dying process could not write the file");
+        if (commits) run_some(nullptr, want, rng);
+
+        ckpt = c8::Checkpoint::Open(file, error);
+        if (ckpt == nullptr) return fail("%s", error.c_str());
+        if (ckpt->Epoch() != epoch)
+            return fail("epoch %llu after the crash, want %llu",
+                        static_cast<unsigned long long>(ckpt->Epoch()),
+                        static_cast<unsigned long long>(epoch));
+        if (same_records(*ckpt, want, "checkpoint after a crash") == false)
+            return false;
+    }
+    ckpt.reset();
+    std::filesystem::remove(file);
+    return true;
+}
+
+#ifdef CHIP8_HAVE_ZLIB
+/* states of a few instances run on from one another, the kind of sequence a
+ * store sees */
+static std::vector<c8::system>
+snapshot_states(size_t n, uint64_t& rng)
+{
+    std::vector<c8::system> states;
+    c8::system chip8[3] = { { draw_loop_image, 1 },
+                            { draw_loop_image, 2 },
+                            { timer_image, 3 } };
+    for (size_t i = 0; i < n; i++) {
+        c8::system& next = chip8[next_random(rng) % 3];
+        dirty_run(next, rng);
+        states.push_back(next);
+    }
+    return states;
+}
+
+/* every state stored reads back the same after reopening */
+static bool
+same_snapshots(c8::SnapshotStore& store,
+               const std::vector<c8::system>& want,
+               const char* what)
+{
+    if (store.Size() != want.size())
+        return fail("%s: %zu states, not %zu", what, store.Size(), want.size());
+    c8::system got{ 0 };
+    for (size_t id = 0; id < want.size(); id++) {
+        store.Get(id, got);
+        if (same_bytes(got, want[id], what) == false)
+            return fail("state %zu", id);
+    }
+    return true;
+}
+
+/* states survive Flush() and Open(), a record torn at the end of the file
+ * is cut off and appending goes on after it, and a failed write turns every
+ * later Put() away */
+static bool
+check_snapshot()
+{
+    std::filesystem::path file = scratch_file("snapshot");
+    std::string error;
+    uint64_t rng = 5;
+    std::vector<c8::system> want = snapshot_states(300, rng);
+    std::vector<c8::system> samples(want.begin(), want.begin() + 50);
+
+    auto store = c8::SnapshotStore::Create(file, samples, error);
+    if (store == nullptr) return fail("%s", error.c_str());
+    for (size_t i = 0; i < want.size(); i++)
+        if (store->Put(want[i]) != i) return fail("Put() of state %zu", i);
+    if (store->Flush() == false) return fail("Flush() failed");
+    store = c8::SnapshotStore::Open(file, error);
+    if (store == nullptr) return fail("%s", error.c_str());
+    if (same_snapshots(*store, want, "reopened store") == false) return false;
+
+    /* the last state's record loses its tail, then junk is appended */
+    store.reset();
+    uintmax_t torn = std::filesystem::file_size(file) - 3, cut = 0;
+    std::filesystem::resize_file(file, torn);
+    for (const char* junk : { "", "C\x10" }) {
+        if (*junk) {
+            std::FILE* f = std::fopen(file.c_str(), "ab");
+            std::fputs(junk, f);
+            std::fclose(f);
+        }
+        store = c8::SnapshotStore::Open(file, error);
+        if (store == nullptr) return fail("%s", error.c_str());
+        want.erase(want.begin() + 299, want.end());
+        if (same_snapshots(*store, want, "store with a torn tail") == false)
+            return false;
+        store.reset();
+        if (cut == 0) cut = std::filesystem::file_size(file);
+        if (cut >= torn || std::filesystem::file_size(file) != cut)
+            return fail("the torn record was not cut off");
+    }
+    store = c8::SnapshotStore::Open(file, error);
+    std::vector<c8::system> more = snapshot_states(20, rng);
+    for (const c8::system& state : more) {
+        if (store->Put(state) != want.size()) return fail("Put() after a cut");
+        want.push_back(state);
+    }
+    store->Flush();
+    store = c8::SnapshotStore::Open(file, error);
+    if (store == nullptr) return fail("%s", error.c_str());
+    if (same_snapshots(*store, want, "store appended to") == false)
+        return false;
+    store.reset();
+    std::filesystem::remove(file);
+
+    /* a file size limit makes writes fail once the stdio buffer spills
+     * past it */
+    store = c8::SnapshotStore::Create(file, samples, error);
+    if (store == nullptr || store->Flush() == false)
+        return fail("cannot create %s", file.c_str());
+    rlimit old;
+    getrlimit(RLIMIT_FSIZE, &old);
+    rlimit limit = old;
+    limit.rlim_cur = std::filesystem::file_size(file) + 4096;
+    std::signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    size_t put = 0;
+    while (put < want.size() && store->Put(want[put])) put++;
+    bool stopped = store->Put(want[0]) == std::nullopt && !store->Flush();
+    setrlimit(RLIMIT_FSIZE, &old);
+    std::signal(SIGXFSZ, SIG_DFL);
+    store.reset();
+    std::filesystem::remove(file);
+    if (put == want.size()) return fail("every Put() past the limit succeeded");
+    if (stopped == false) return fail("the store went on after a failed write");
+    return true;
+}
+
+/* steps of instances recorded in interleaved runs, most of them ending in a
+ * partial chunk, read back at random after Close(). A file whose writer
+ * never closed it is refused */
+static bool
+check_trajectory()
+{
+    std::filesystem::path file = scratch_file("trajectory");
+    std::string error;
+    const std::vector<uint16_t> addrs = { 0x380, 0x300, 0x200, 0xFFF };
+    const uint64_t lengths[] = { 0, 3, 7, 20, 33 };
+    constexpr size_t N = sizeof lengths / sizeof lengths[0];
+
+    auto writer = c8::TrajectoryWriter::Create(file, N, addrs, 7, error);
+    if (writer == nullptr) return fail("%s", error.c_str());
+    std::vector<c8::TrajectoryStep> want[N];
+    std::vector<c8::system> chip8(N, c8::system{ draw_loop_image, 0 });
+    uint64_t rng = 7;
+    for (bool busy = true; busy;) {
+        busy = false;
+        for (size_t i = 0; i < N; i++) {
+            if (want[i].size() == lengths[i]) continue;
+            busy = true;
+            uint64_t run = std::min<uint64_t>(next_random(rng) % 4,
+                                              lengths[i] - want[i].size());
+            for (uint64_t n = 0; n < run; n++) {
+                dirty_run(chip8[i], rng);
+                uint64_t r = next_random(rng);
+                c8::TrajectoryStep step{ c8::PackDisplay(chip8[i]),
+                                         static_cast<uint16_t>(r),
+                                         float(r >> 16 & 0xFFFF) / 64,
+                                         {} };
+                for (uint16_t addr : addrs)
+                    step.ram.push_back(chip8[i][addr]);
+                writer->Record(i, chip8[i], step.keys, step.reward);
+                want[i].push_back(step);
+            }
+        }
+    }
+    if (writer->Close(error) == false) return fail("%s", error.c_str());
+
+    auto reader = c8::TrajectoryReader::Open(file, error);
+    if (reader == nullptr) return fail("%s", error.c_str());
+    if (reader->Instances() != N || reader->RamAddresses() != addrs)
+        return fail("%zu instances read back", reader->Instances());
+    c8::TrajectoryStep got;
+    for (size_t i = 0; i < N; i++) {
+        if (reader->Steps(i) != lengths[i])
+            return fail("instance %zu has %llu steps, not %llu",
+                        i,
+                        static_cast<unsigned long long>(reader->Steps(i)),
+                        static_cast<unsigned long long>(lengths[i]));
+        if (reader->Read(i, lengths[i], got))
+            return fail("instance %zu read past its last step", i);
+    }
+    for (int n = 0; n < 500; n++) {
+        size_t i = 1 + next_random(rng) % (N - 1);
+        uint64_t s = next_random(rng) % lengths[i];
+        const c8::TrajectoryStep& step = want[i][s];
+        if (reader->Read(i, s, got) == false || got.frame != step.frame ||
+            got.keys != step.keys || got.reward != step.reward ||
+            got.ram != step.ram)
+            return fail("step %llu of instance %zu read back wrong",
+                        static_cast<unsigned long long>(s),
+                        i);
+    }
+    reader.reset();
+
+    /* the writer dies with a chunk written but no index */
+    pid_t child = fork();
+    if (child == 0) {
+        auto doomed = c8::TrajectoryWriter::Create(file, 1, addrs, 2, error);
+        for (int s = 0; s < 5; s++)
+            doomed->Record(0, chip8[0], 0, 0);
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    reader = c8::TrajectoryReader::Open(file, error);
+    std::filesystem::remove(file);
+    if (reader != nullptr) return fail("a file never closed was opened");
+    return true;
+}
+#endif
+
+static bool
+fills_aligned(c8::Arena& arena)
+{
+    for (size_t i = 0; i < arena.Capacity(); i++) {
+        void* slot = arena.Allocate();
+        if (slot == nullptr || slot != arena.Slot(i) ||
+            reinterpret_cast<uintptr_t>(slot) % 64 != 0)
+            return fail("slot %zu of %zu misplaced", i, arena.Capacity());
+        std::memset(slot, 0xA5, 100);
+    }
+    if (arena.Allocate() != nullptr)
+        return fail("a full arena handed out a slot");
+    return true;
+}
+
+/* topologies without a CPU fall back to this machine, and arenas hand out
+ * every slot of their slab, wherever the slab comes from, aligned */
+static bool
+check_numa()
+{
+    for (const char* spec : { "", ";", ";;" }) {
+        c8::Topology topo = c8::Topology::Parse(spec);
+        if (topo.Nodes() == 0) return fail("\"%s\" parsed to no node", spec);
+        unsigned node;
+        topo.CpuFor(5, node);
+        if (node >= topo.Nodes()) return fail("CpuFor() picked node %u", node);
+    }
+    c8::Topology two = c8::Topology::Parse(";0-1;;2,3;");
+    unsigned node;
+    if (two.Nodes() != 2 || two.CpuFor(3, node) != 3 || node != 1)
+        return fail("\";0-1;;2,3;\" did not parse to two nodes of two CPUs");
+
+    int slabs = 0;
+    {
+        c8::Arena hooked{ 100,
+                          3,
+                          [&](size_t size) {
+                              slabs++;
+                              return static_cast<void*>(new std::byte[size]);
+                          },
+                          [&](void* slab, size_t) {
+                              slabs--;
+                              delete[] static_cast<std::byte*>(slab);
+                          } };
+        c8::NumaArena placed{ sizeof(c8::system), 5, 0 };
+        if (fills_aligned(hooked) == false || fills_aligned(placed) == false)
+            return false;
+    }
+    if (slabs != 0) return fail("%d slabs from hooks not released", slabs);
+    return true;
+}
+
+/* the upper 40 bits of every value stored for a hash derive from it, a hit
+ * carrying a value stored for another hash or torn apart shows there */
+static constexpr uint64_t VALUE_TAG = ~uint64_t{ 0xFFFFFF };
+
+static uint64_t
+ttable_value(const c8::Hash128& hash, uint64_t r)
+{
+    uint64_t tag = (hash.lo ^ hash.hi) * 0x9E3779B97F4A7C15ULL;
+    return (tag & VALUE_TAG) | (r & ~VALUE_TAG);
+}
+
+/* values equal to the key, zero, or anything else are found again, and
+ * threads racing on a small table only ever see values stored for the
+ * state they probe */
+static bool
+check_ttable()
+{
+    c8::TranspositionTable table{ 1 << 12 };
+    for (uint64_t i = 0; i < 256; i++) {
+        c8::Hash128 hash{ i, i * 0xD6E8FEB86659FD93ULL };
+        uint64_t values[] = { hash.hi | 1, 0, i + 1, ~i };
+        for (uint64_t v : values) {
+            table.Store(hash, v);
+            uint64_t got = ~v;
+            if (table.Probe(hash, got) == false || got != v)
+                return fail("stored %016llx, probe found %016llx",
+                            static_cast<unsigned long long>(v),
+                            static_cast<unsigned long long>(got));
+        }
+    }
+
+    c8::TranspositionTable shared{ 256 };
+    std::atomic<uint64_t> hits{ 0 }, wrong{ 0 };
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; t++)
+        threads.emplace_back([&, t] {
+            uint64_t rng = t + 1;
+            for (int i = 0; i < 200000; i++) {
+                uint64_t r = next_random(rng);
+                uint64_t k = r % 1024;
+                c8::Hash128 hash{ k * 0x9FB21C651E98DF25ULL, k ^ k << 40 };
+                if (r >> 10 & 1) {
+                    shared.Store(hash, ttable_value(hash, r >> 11));
+                    continue;
+                }
+                uint64_t got;
+                if (shared.Probe(hash, got) == false) continue;
+                hits++;
+                wrong += (got & VALUE_TAG) != ttable_value(hash, 0);
+            }
+        });
+    for (std::thread& t : threads)
+        t.join();
+    if (wrong != 0)
+        return fail("%llu of %llu hits found a value stored for another state",
+                    static_cast<unsigned long long>(wrong.load()),
+                    static_cast<unsigned long long>(hits.load()));
+    if (hits == 0) return fail("no probe of the shared table hit");
+    return true;
+}
+
+/* arithmetic that overflows wraps around, and the divisions that trap on
+ * INT64_MIN do not */
+static bool
+check_reward()
+{
+    /* le(mem[0x300..0x307]) of each instance */
+    const int64_t values[] = { INT64_MIN, 5, -7 };
+    std::vector<c8::system> machines;
+    for (int64_t v : values) {
+        machines.emplace_back(timer_image, 0);
+        for (int b = 0; b < 8; b++)
+            machines.back().SetMemory(0x300 + b, uint64_t(v) >> 8 * b);
+    }
+    c8::Batch batch{ c8::Quirks::COWGOD };
+    for (c8::system& chip8 : machines)
+        batch.Add(chip8);
+
+    struct expr {
+        const char* source;
+        int64_t (*want)(uint64_t x);
+    };
+    auto wrap = [](uint64_t v) { return static_cast<int64_t>(v); };
+    const expr exprs[] = {
+        { "le(mem[0x300..0x307])", wrap },
+        { "le(mem[0x300..0x307]) / -1",
+          [](uint64_t x) { return int64_t(0 - x); } },
+        { "le(mem[0x300..0x307]) % -1", [](uint64_t) { return int64_t{ 0 }; } },
+        { "-le(mem[0x300..0x307])", [](uint64_t x) { return int64_t(0 - x); } },
+        { "abs(le(mem[0x300..0x307]))",
+          [](uint64_t x) { return int64_t(x >> 63 ? 0 - x : x); } },
+        { "le(mem[0x300..0x307]) - 1",
+          [](uint64_t x) { return int64_t(x - 1); } },
+        { "le(mem[0x300..0x307]) + le(mem[0x300..0x307])",
+          [](uint64_t x) { return int64_t(x + x); } },
+        { "le(mem[0x300..0x307]) * -3",
+          [](uint64_t x) { return int64_t(x * uint64_t(-3)); } },
+        { "le(mem[0x300..0x307]) / 0", [](uint64_t) { return int64_t{ 0 }; } },
+        { "le(mem[0x300..0x307]) % 3",
+          [](uint64_t x) { return int64_t(x) % 3; } },
+        { "le(mem[0x300..0x307]) / 2",
+          [](uint64_t x) { return int64_t(x) / 2; } },
+    };
+    std::vector<int64_t> out(batch.Size());
+    for (const expr& e : exprs) {
+        std::string error;
+        auto reward = c8::RewardExpr::Compile(e.source, error);
+        if (reward == nullptr)
+            return fail("%s: %s", e.source, error.c_str());
+        reward->Evaluate(batch, out);
+        for (size_t i = 0; i < out.size(); i++)
+            if (out[i] != e.want(values[i]))
+                return fail("%s on %lld gave %lld, not %lld",
+                            e.source,
+                            static_cast<long long>(values[i]),
+                            static_cast<long long>(out[i]),
+                            static_cast<long long>(e.want(values[i])));
+    }
+    return true;
+}
+
+/* the AVX2 scans give exactly what the scalar ones do, over runs of every
+ * length and across the blocks snapshots are stored in. Small integer
+ * signals keep the float sums of the AVX2 path exact. */
+static bool
+check_ramsearch()
+{
+    constexpr size_t MEMSIZE = c8::Constants::MEMSIZE;
+    uint64_t rng = 70;
+    c8::RamSearch fast, slow{ false };
+    c8::system chip8{ timer_image, 0 };
+    std::vector<float> signal;
+    while (fast.Size() < 700) {
+        bool new_run = next_random(rng) % 3 == 0;
+        if (new_run) {
+            fast.NewRun();
+            slow.NewRun();
+        }
+        size_t length = next_random(rng) % 40 + 1;
+        for (size_t i = 0; i < length; i++) {
+            /* constant, counting up, counting down and random bytes, all
+             * starting over somewhere else in a new run */
+            for (size_t a = 0; a < MEMSIZE; a++) {
+                uint8_t b = chip8.GetMemory(a);
+                if (new_run && i == 0)
+                    b = next_random(rng);
+                else if (a % 4 == 1)
+                    b++;
+                else if (a % 4 == 2)
+                    b--;
+                else if (a % 4 == 3 && next_random(rng) % 2)
+                    b = next_random(rng);
+                chip8.SetMemory(a, b);
+            }
+            fast.Add(chip8);
+            slow.Add(chip8);
+            signal.push_back(float(next_random(rng) % 4));
+        }
+    }
+
+    const c8::RamPredicate preds[] = {
+        c8::INCREASED, c8::DECREASED, c8::CHANGED, c8::UNCHANGED, c8::EQUALS
+    };
+    for (int i = 0; i < 300; i++) {
+        if (i % 4 == 0) {
+            fast.Reset();
+            slow.Reset();
+        }
+        c8::RamPredicate pred = preds[next_random(rng) % 5];
+        uint8_t value = next_random(rng);
+        size_t first = next_random(rng) % fast.Size();
+        size_t last = i % 3 ? first + next_random(rng) % 50 : SIZE_MAX;
+        size_t left = fast.Filter(pred, value, first, last);
+        if (left != slow.Filter(pred, value, first, last) ||
+            fast.CandidateList() != slow.CandidateList())
+            return fail("filter %d over %zu..%zu differs", pred, first, last);
+    }
+
+    for (c8::RamSeries series : { c8::VALUES, c8::DELTAS }) {
+        fast.Reset();
+        slow.Reset();
+        std::vector<c8::RamCandidate> l = fast.Rank(signal, series, MEMSIZE);
+        std::vector<c8::RamCandidate> r = slow.Rank(signal, series, MEMSIZE);
+        for (size_t a = 0; a < MEMSIZE; a++)
+            if (l[a].addr != r[a].addr ||
+                l[a].correlation != r[a].correlation)
+                return fail("rank %zu of series %d differs", a, series);
+        if (fast.FilterCorrelated(signal, 0.05, series) !=
+              slow.FilterCorrelated(signal, 0.05, series) ||
+            fast.CandidateList() != slow.CandidateList())
+            return fail("correlated filter of series %d differs", series);
+    }
+    return true;
+}
+
+struct check {
+    const char* name;
+    bool (*fn)();
+};
+
+static const check checks[] = {
+    { "pool", check_pool },
+    { "bootcache", check_bootcache },
+    { "ttable", check_ttable },
+    { "numa", check_numa },
+    { "checkpoint", check_checkpoint },
+    { "reward", check_reward },
+    { "ramsearch", check_ramsearch },
+#ifdef CHIP8_HAVE_ZLIB
+    { "snapshot", check_snapshot },
+    { "trajectory", check_trajectory },
+#endif
+};
+
+int
+main(int argc, char** argv)
+{
+    int failed = 0;
+    for (const check& c : checks) {
+        bool wanted = argc == 1;
+        for (int i = 1; i < argc; i++)
+            wanted = wanted || std::strcmp(argv[i], c.name) == 0;
+        if (wanted == false) continue;
+        bool ok = c.fn();
+        printf("%s: %s\n", c.name, ok ? "ok" : "FAILED");
+        failed += ok == false;
+    }
+    return failed != 0;
+}
@@ -0,0 +1,37 @@
+; 8XYN arithmetic and VF, 7XNN leaving VF alone. V0 to VE are dumped as a
+; 15 row sprite at the top left, one register per row:
+; 0F F0 FF 0C CC 01 01 FB 00 05 01 01 AA 00 01
+    ld v0, 0x0F
+    ld v1, 0xF0
+    ld v2, v0
+    or v2, v1         ; FF
+    ld v3, 0x3C
+    and v3, v0        ; 0C
+    ld v4, 0x3C
+    xor v4, v1        ; CC
+    ld v5, 0xFF
+    ld v6, 0x02
+    add v5, v6        ; 01, carry
+    ld v6, vF         ; 01
+    ld v7, 0x05
+    ld v8, 0x0A
+    sub v7, v8        ; FB, borrow
+    ld v8, vF         ; 00
+    ld v9, 0x05
+    ld vA, 0x0A
+    subn v9, vA       ; 05, no borrow
+    ld vA, vF         ; 01
+    ld vB, 0xFE
+    ld vF, 0xAA
+    add vB, 0x03      ; 01, VF untouched
+    ld vC, vF         ; AA
+    ld vD, 0x12
+    sub vD, vD        ; 00, no borrow
+    ld vE, vF         ; 01
+    ld i, 0x300
+    ld [i], vE
+    ld i, 0x300
+    ld v0, 0
+    drw v0, v0, 15
+end:
+    jp end
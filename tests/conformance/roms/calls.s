@@ -0,0 +1,47 @@
+; nested calls adding 7 twenty times and keeping the score in BCD, then
+; the score drawn with the font and a BNNN jump table picking the B at
+; x=30: "140" and "B" on the top row
+    ld v0, 0
+    ld v1, 20
+loop:
+    call add7
+    add v1, 0xFF
+    se v1, 0
+    jp loop
+    call score
+    ld v0, 4
+    jp v0, table
+table:
+    jp end
+    jp end
+    jp good
+good:
+    ld v0, 0xB
+    ld f, v0
+    ld v1, 30
+    ld v2, 0
+    drw v1, v2, 5
+end:
+    jp end
+add7:
+    add v0, 7
+    call bcd
+    ret
+bcd:
+    ld i, 0x300
+    ld b, v0
+    ret
+score:
+    ld i, 0x300
+    ld v2, [i]
+    ld v3, 0
+    ld v4, 0
+    ld f, v0
+    drw v3, v4, 5
+    add v3, 5
+    ld f, v1
+    drw v3, v4, 5
+    add v3, 5
+    ld f, v2
+    drw v3, v4, 5
+    ret
@@ -0,0 +1,28 @@
+; FX0A latches the highest key held and waits for its release, then EXA1
+; and EX9E wait for key 7 to go down and up again. "3", "7" and "A" end up
+; on the top row once the manifest's key events have played
+    ld v5, 0
+    ld v6, 0
+    ld v0, k
+    ld f, v0
+    drw v5, v6, 5
+    ld v1, 7
+hold:
+    sknp v1
+    jp held
+    jp hold
+held:
+    ld f, v1
+    ld v5, 5
+    drw v5, v6, 5
+release:
+    skp v1
+    jp released
+    jp release
+released:
+    ld v2, 0xA
+    ld f, v2
+    ld v5, 10
+    drw v5, v6, 5
+end:
+    jp end
@@ -0,0 +1,25 @@
+; 8XY6 and 8XYE shift VY into VX under matt and VX in place under cowgod,
+; FX55 and FX65 advance I under matt only. Seven rows dumped at the top left:
+; matt   40 81 01 02 01 5A 01
+; cowgod 5A 81 00 0C 00 00 5A
+    ld v1, 0x81
+    ld v0, 0x06
+    shr v0, v1
+    ld v2, vF
+    ld v3, 0x06
+    shl v3, v1
+    ld v4, vF
+    ld i, 0x300
+    ld [i], v4
+    ld v0, 0x5A
+    ld [i], v0
+    ld i, 0x300
+    ld v1, [i]
+    ld v0, [i]
+    ld i, 0x306
+    ld [i], v0
+    ld i, 0x300
+    ld v0, 0
+    drw v0, v0, 7
+end:
+    jp end
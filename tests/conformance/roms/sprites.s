@@ -0,0 +1,46 @@
+; 00E0, XOR drawing and collisions, clipping at the right and bottom edges
+; and wrapping of the start position. Ends on a "0" at the top left, the
+; top three rows of an "8" clipped at (60, 29), a "2" at (20, 8) drawn from
+; (84, 40), a 3 row box at (50, 20) and the two collision flags as rows at
+; (40, 8): 01 00
+    ld v0, 0xF
+    ld f, v0
+    ld v1, 30
+    ld v2, 20
+    drw v1, v2, 5
+    cls
+    ld v0, 0
+    ld f, v0
+    ld v1, 0
+    ld v2, 0
+    drw v1, v2, 5
+    drw v1, v2, 5
+    ld v3, vF
+    drw v1, v2, 5
+    ld v4, vF
+    ld v0, 8
+    ld f, v0
+    ld v1, 60
+    ld v2, 29
+    drw v1, v2, 5
+    ld v0, 2
+    ld f, v0
+    ld v1, 84
+    ld v2, 40
+    drw v1, v2, 5
+    ld i, box
+    ld v1, 50
+    ld v2, 20
+    drw v1, v2, 3
+    ld v0, v3
+    ld v1, v4
+    ld i, 0x300
+    ld [i], v1
+    ld i, 0x300
+    ld v5, 40
+    ld v6, 8
+    drw v5, v6, 2
+end:
+    jp end
+box:
+    db 0xFF, 0x81, 0xFF
@@ -0,0 +1,29 @@
+; waits on the delay timer: "1" drawn, 30 frames waited, "2" drawn, 3
+; frames waited, "3" drawn, all on the top row
+    ld v5, 0
+    ld v6, 0
+    ld v0, 1
+    call digit
+    ld v0, 30
+    ld dt, v0
+    ld st, v0
+    call wait
+    ld v0, 2
+    call digit
+    ld v0, 3
+    ld dt, v0
+    call wait
+    ld v0, 3
+    call digit
+end:
+    jp end
+wait:
+    ld v1, dt
+    se v1, 0
+    jp wait
+    ret
+digit:
+    ld f, v0
+    drw v5, v6, 5
+    add v5, 5
+    ret